@@ -0,0 +1,43 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+std::atomic<bool> counting{false};
+std::atomic<std::size_t> allocations{0};
+}
+
+// The other forms of new end up here, and delete frees what malloc returned
+void* operator new(std::size_t size) {
+   if (counting.load(std::memory_order_relaxed)) {
+      allocations.fetch_add(1, std::memory_order_relaxed);
+   }
+
+   if (auto p = std::malloc(size == 0 ? 1 : size)) {
+      return p;
+   }
+
+   throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+   std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+   std::free(p);
+}
+
+void allocation_counter::enable() noexcept {
+   counting.store(true, std::memory_order_relaxed);
+}
+
+std::size_t allocation_counter::count() noexcept {
+   return allocations.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,19 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_ALLOCATIONCOUNTER_H
+#define EPOLL_WORK_QUEUE_ALLOCATIONCOUNTER_H
+
+#include <cstddef>
+
+// Counts the allocations of the executable it is linked into, which replaces
+// the global operator new to do so. Nothing is counted before enable() is called,
+// so allocations cost an atomic increment only where they are measured.
+namespace allocation_counter {
+void enable() noexcept;
+// Allocations made through operator new since enabled
+std::size_t count() noexcept;
+}
+
+#endif //EPOLL_WORK_QUEUE_ALLOCATIONCOUNTER_H
@@ -0,0 +1,60 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "ChunkFormat.h"
+
+#include <algorithm>
+
+namespace chunk_format {
+namespace {
+template <typename T>
+void put(std::string& out, T value) {
+   for (std::size_t i = 0; i < sizeof(T); i++) {
+      out += static_cast<char>((value >> (8 * (sizeof(T) - 1 - i))) & 0xff);
+   }
+}
+
+template <typename T>
+T get(std::string_view data) {
+   T value{};
+   for (std::size_t i = 0; i < sizeof(T); i++) {
+      value = static_cast<T>((value << 8) | static_cast<unsigned char>(data[i]));
+   }
+
+   return value;
+}
+}
+
+std::string encode_header(const Header& header) {
+   std::string bytes{MAGIC};
+   put(bytes, header.rows);
+   put(bytes, header.payload_size);
+   put(bytes, header.checksum);
+   put(bytes, uint32_t{0});
+
+   return bytes;
+}
+
+std::optional<Header> decode_header(std::string_view bytes) {
+   if (bytes.size() < HEADER_SIZE || !bytes.starts_with(MAGIC)) {
+      return {};
+   }
+
+   return Header{get<uint64_t>(bytes.substr(8)), get<uint64_t>(bytes.substr(16)), get<uint32_t>(bytes.substr(24))};
+}
+
+std::string_view key_column(std::string_view url) {
+   // Hosts are cut at the first '/', which is in the scheme if there is one
+   std::size_t authority = 0;
+   if (auto scheme = url.find("://"); scheme < url.find('/')) {
+      authority = scheme + 3;
+   }
+
+   return url.substr(0, std::min(url.find('/', authority), MAX_COLUMN_SIZE));
+}
+
+std::size_t record_size(std::string_view bytes) {
+   return 2 + get<uint16_t>(bytes);
+}
+}
@@ -0,0 +1,47 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_CHUNK_FORMAT_H
+#define EPOLL_WORK_QUEUE_CHUNK_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Binary chunks written by the chunker. Instead of CSV rows they hold just the URL
+// column of each row, cut down to what workers key on, so workers needn't scan rows.
+//
+// A chunk starts with a 32 byte header of big endian fields:
+//    "EWQCHNK1" rows:8 payload_size:8 crc32:4 reserved:4
+// The payload that follows is a record per row: size:2 column:size
+namespace chunk_format {
+const constexpr std::string_view MAGIC{"EWQCHNK1"};
+const constexpr std::size_t HEADER_SIZE = 32;
+const constexpr std::size_t MAX_COLUMN_SIZE = 0xffff;
+// Chunks are told apart from CSV by their name
+const constexpr std::string_view EXTENSION{".ewqc"};
+
+struct Header {
+   // Records in the payload
+   uint64_t rows;
+   uint64_t payload_size;
+   // CRC-32 of the payload, as zlib computes it
+   uint32_t checksum;
+};
+
+std::string encode_header(const Header& header);
+// Nothing unless the bytes start with a header
+std::optional<Header> decode_header(std::string_view bytes);
+
+// The part of a URL column a chunk keeps: the scheme, if any, and the authority.
+// Workers find the same domains in it as in the whole column.
+std::string_view key_column(std::string_view url);
+
+// The size of the record at the front of the bytes, once it has its size field
+std::size_t record_size(std::string_view bytes);
+}
+
+#endif //EPOLL_WORK_QUEUE_CHUNK_FORMAT_H
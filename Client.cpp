@@ -9,7 +9,8 @@
 const char* WorkerEventKindText[] = {
    "CONNECTED",
    "DISCONNECTED",
-   "MESSAGE_RECEIVED"};
+   "MESSAGE_RECEIVED",
+   "TIMER"};
 
 const char* WorkerActionKindText[] = {
    "SEND_MESSAGE",
@@ -29,6 +30,10 @@ int Client::getClientFD() const {
    return client_fd;
 }
 
+bool Client::isOutbound() const {
+   return outbound;
+}
+
 std::ostream& operator<<(std::ostream& os, const Client& w) {
    os << "worker(" << w.id << ',' << w.ip_address << ':' << w.port << ')';
    return os;
@@ -11,10 +11,14 @@
 
 // This is the kind of the event from a client
 // A client can either connect, disconnect (or be disconnected in case heartbeat expires)
-// or send us a message
+// or send us a message. Connections we opened ourselves additionally
+// get a periodic timer event, so we can send heartbeats over them.
+// Timers and watched descriptors that aren't clients fire TIMER and READABLE events.
 enum class ClientEventKind { CONNECTED,
                              DISCONNECTED,
-                             MESSAGE_RECEIVED };
+                             MESSAGE_RECEIVED,
+                             TIMER,
+                             READABLE };
 
 // This is the action in response to worker event.
 // We can either send the worker a message, disconnect it
@@ -59,15 +63,18 @@ class Client {
       int timer_fd,
       int client_fd,
       std::string ip_address,
-      unsigned short port) : id(id),
-                             timer_fd(timer_fd),
-                             client_fd(client_fd),
-                             ip_address(ip_address),
-                             port(port) {}
+      unsigned short port,
+      bool outbound = false) : id(id),
+                               timer_fd(timer_fd),
+                               client_fd(client_fd),
+                               ip_address(ip_address),
+                               port(port),
+                               outbound(outbound) {}
 
    unsigned int getID() const;
    int getTimerFD() const;
    int getClientFD() const;
+   bool isOutbound() const;
    int getStringOccurences(std::string listUrl) const;
 
    private:
@@ -81,6 +88,8 @@ class Client {
    std::string ip_address;
    // Port of the client
    unsigned short port;
+   // Did we open this connection, rather than accept it?
+   bool outbound;
 
    friend std::ostream& operator<<(std::ostream& os, const Client& w);
 };
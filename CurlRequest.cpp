@@ -3,6 +3,9 @@
 //
 
 #include "CurlRequest.h"
+#include <algorithm>
+#include <cctype>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -15,12 +18,54 @@ CurlGlobalSetup::~CurlGlobalSetup() {
    curl_global_cleanup();
 }
 
-CurlRequest::CurlRequest(CURL* handle) : ptr{handle, curl_easy_cleanup} {
+CurlRequest::CurlRequest(CURL* handle) : CurlRequest(handle, curl_easy_cleanup) {}
+
+CurlRequest::CurlRequest(CURL* handle, std::function<void(CURL*)> release) : ptr{handle, std::move(release)} {
    if (!ptr) {
       throw std::runtime_error("failed to initialize curl");
    }
 }
 
+CurlHandlePool::CurlHandlePool() : share{curl_share_init(), curl_share_cleanup}, idle{} {
+   if (!share) {
+      throw std::runtime_error("failed to initialize curl share");
+   }
+
+   curl_share_setopt(share.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+   curl_share_setopt(share.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+   curl_share_setopt(share.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+CurlHandlePool::~CurlHandlePool() {
+   // The share can only go once no handle uses it
+   for (auto handle : idle) {
+      curl_easy_cleanup(handle);
+   }
+}
+
+CurlRequest CurlHandlePool::acquire() {
+   CURL* handle{};
+   if (idle.empty()) {
+      handle = curl_easy_init();
+   } else {
+      handle = idle.back();
+      idle.pop_back();
+      curl_easy_reset(handle);
+   }
+
+   if (handle != nullptr) {
+      curl_easy_setopt(handle, CURLOPT_SHARE, share.get());
+      curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+      // Rather wait for a connection that can multiplex than open another
+      curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+      curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+   }
+
+   return {handle, [this](CURL* handle) {
+              idle.push_back(handle);
+           }};
+}
+
 void CurlRequest::set_url(const std::string& url) {
    curl_easy_setopt(ptr.get(), CURLOPT_URL, url.c_str());
 }
@@ -29,20 +74,140 @@ void CurlRequest::set_timeout(int timeout_secs) {
    curl_easy_setopt(ptr.get(), CURLOPT_TIMEOUT, timeout_secs);
 }
 
+void CurlRequest::set_accept_encoding() {
+   curl_easy_setopt(ptr.get(), CURLOPT_ACCEPT_ENCODING, "");
+}
+
+void CurlRequest::set_resume_from(std::size_t offset) {
+   curl_easy_setopt(ptr.get(), CURLOPT_RESUME_FROM_LARGE, static_cast<curl_off_t>(offset));
+}
+
 std::stringstream CurlRequest::execute() {
    std::stringstream responseData;
 
-   auto writeToString = +[](char* contents, size_t size, size_t nmemb, void* userdata) -> size_t {
-      auto& responseData = *reinterpret_cast<std::stringstream*>(userdata);
-      responseData << std::string_view(contents, size * nmemb);
+   execute([&](std::string_view contents) {
+      responseData << contents;
+   });
+
+   return responseData;
+}
+
+void CurlRequest::execute(std::function<void(std::string_view)> sink) {
+   execute_while([&](std::string_view contents) {
+      sink(contents);
+      return true;
+   });
+}
+
+void CurlRequest::execute_while(std::function<bool(std::string_view)> sink) {
+   // Exceptions must not unwind through curl, so they are parked here
+   // and rethrown once curl_easy_perform has returned
+   struct SinkContext {
+      std::function<bool(std::string_view)>& sink;
+      std::exception_ptr error;
+      bool stopped;
+   } context{sink, nullptr, false};
+
+   auto writeToSink = +[](char* contents, size_t size, size_t nmemb, void* userdata) -> size_t {
+      auto& context = *reinterpret_cast<SinkContext*>(userdata);
+      try {
+         if (!context.sink(std::string_view(contents, size * nmemb))) {
+            context.stopped = true;
+            return 0;
+         }
+      } catch (...) {
+         context.error = std::current_exception();
+         return 0;
+      }
       return size * nmemb;
    };
 
-   curl_easy_setopt(ptr.get(), CURLOPT_WRITEDATA, &responseData);
-   curl_easy_setopt(ptr.get(), CURLOPT_WRITEFUNCTION, writeToString);
+   curl_easy_setopt(ptr.get(), CURLOPT_WRITEDATA, &context);
+   curl_easy_setopt(ptr.get(), CURLOPT_WRITEFUNCTION, writeToSink);
+
+   auto res = curl_easy_perform(ptr.get());
+   if (context.error) {
+      std::rethrow_exception(context.error);
+   }
+
+   // Refusing the rest of the body fails the transfer as far as curl is concerned
+   if (context.stopped && res == CURLE_WRITE_ERROR) {
+      return;
+   }
+
+   if (res != CURLE_OK)
+      throw std::runtime_error(curl_easy_strerror(res));
+}
+
+std::optional<std::size_t> CurlRequest::identity_length() {
+   curl_off_t length{-1};
+   if (curl_easy_getinfo(ptr.get(), CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) != CURLE_OK || length < 0) {
+      return {};
+   }
+
+   // Local files have no headers at all
+   curl_header* encoding{};
+   if (curl_easy_header(ptr.get(), "Content-Encoding", 0, CURLH_HEADER, -1, &encoding) == CURLHE_OK && std::string_view(encoding->value) != "identity") {
+      return {};
+   }
+
+   return static_cast<std::size_t>(length);
+}
+
+std::string CurlRequest::fetch_validator() {
+   std::string headers;
+
+   auto writeHeader = +[](char* contents, size_t size, size_t nitems, void* userdata) -> size_t {
+      auto& headers = *reinterpret_cast<std::string*>(userdata);
+      headers.append(contents, size * nitems);
+      return size * nitems;
+   };
+
+   curl_easy_setopt(ptr.get(), CURLOPT_NOBODY, 1L);
+   curl_easy_setopt(ptr.get(), CURLOPT_HEADERDATA, &headers);
+   curl_easy_setopt(ptr.get(), CURLOPT_HEADERFUNCTION, writeHeader);
 
    if (auto res = curl_easy_perform(ptr.get()); res != CURLE_OK)
       throw std::runtime_error(curl_easy_strerror(res));
 
-   return responseData;
+   std::string etag, last_modified;
+   std::istringstream lines{headers};
+
+   for (std::string line; std::getline(lines, line, '\n');) {
+      if (!line.empty() && line.back() == '\r') {
+         line.pop_back();
+      }
+
+      auto pos = line.find(':');
+      if (pos == std::string::npos) {
+         continue;
+      }
+
+      std::string name{line.substr(0, pos)};
+      std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+
+      auto start = line.find_first_not_of(' ', pos + 1);
+      if (start == std::string::npos) {
+         continue;
+      }
+
+      auto value{line.substr(start)};
+      if (name == "etag") {
+         etag = value;
+      } else if (name == "last-modified") {
+         last_modified = value;
+      }
+   }
+
+   if (!etag.empty()) {
+      return "etag:" + etag;
+   }
+
+   if (!last_modified.empty()) {
+      curl_off_t length{-1};
+      curl_easy_getinfo(ptr.get(), CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+      return "lm:" + last_modified + '/' + std::to_string(length);
+   }
+
+   return {};
 }
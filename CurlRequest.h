@@ -5,8 +5,12 @@
 #ifndef EPOLL_WORK_QUEUE_CURL_REQUEST_H
 #define EPOLL_WORK_QUEUE_CURL_REQUEST_H
 
+#include <functional>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <curl/curl.h>
 
 class CurlGlobalSetup {
@@ -21,13 +25,51 @@ class CurlGlobalSetup {
 class CurlRequest {
    public:
    CurlRequest(CURL* handle);
+   // A handle that is handed to release instead of being cleaned up
+   CurlRequest(CURL* handle, std::function<void(CURL*)> release);
 
    void set_url(const std::string& url);
    void set_timeout(int timeout_secs);
+   // Advertises every content encoding curl can decode (gzip, deflate, ...),
+   // responses are then decoded on the fly
+   void set_accept_encoding();
+   // Starts the transfer at the byte offset instead of the beginning of the resource
+   void set_resume_from(std::size_t offset);
    std::stringstream execute();
+   // Performs the request, handing each piece of the body to the sink as it arrives
+   void execute(std::function<void(std::string_view)> sink);
+   // The same, the sink returning false once it wants no more of the body
+   void execute_while(std::function<bool(std::string_view)> sink);
+   // The size of the body being transferred, once its headers are in. Nothing if it is
+   // unknown, or content encoded so offsets into it aren't offsets into the resource.
+   std::optional<std::size_t> identity_length();
+   // Issues a HEAD request and returns a string identifying this version of the
+   // resource (ETag, else Last-Modified plus Content-Length), or empty if none
+   std::string fetch_validator();
 
    private:
-   std::unique_ptr<CURL, decltype(&curl_easy_cleanup)> ptr;
+   std::unique_ptr<CURL, std::function<void(CURL*)>> ptr;
+};
+
+// Easy handles kept for reuse, sharing their DNS cache, connections and TLS sessions,
+// so consecutive requests to a host skip the lookup, the handshakes and TCP slow start.
+// HTTP/2 is used where the server offers it. The share has no locks, so a pool and its
+// requests stay on one thread. The pool must outlive its requests.
+class CurlHandlePool {
+   public:
+   CurlHandlePool();
+   ~CurlHandlePool();
+
+   CurlHandlePool(const CurlHandlePool&) = delete;
+   CurlHandlePool& operator=(const CurlHandlePool&) = delete;
+
+   // A request on an idle handle, reset to the defaults, or on a new one.
+   // The handle goes back to the pool along with the request.
+   CurlRequest acquire();
+
+   private:
+   std::unique_ptr<CURLSH, decltype(&curl_share_cleanup)> share;
+   std::vector<CURL*> idle;
 };
 
 #endif
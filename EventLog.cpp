@@ -0,0 +1,147 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "EventLog.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+const constexpr std::string_view MAGIC{"EWQLOG1\n"};
+const constexpr char EVENT_TAG = 'E';
+const constexpr char ID_TAG = 'I';
+// Sizes of the records without the message
+const constexpr std::size_t EVENT_HEADER_SIZE = 1 + 1 + 1 + 4 + 8 + 4;
+const constexpr std::size_t ID_SIZE = 1 + 4;
+
+template <typename T>
+void put(std::ofstream& out, T value) {
+   char bytes[sizeof(T)];
+   for (std::size_t i = 0; i < sizeof(T); i++) {
+      bytes[i] = static_cast<char>((value >> (8 * (sizeof(T) - 1 - i))) & 0xff);
+   }
+
+   out.write(bytes, sizeof(T));
+}
+
+template <typename T>
+T get(const char* data) {
+   T value{};
+   for (std::size_t i = 0; i < sizeof(T); i++) {
+      value = static_cast<T>((value << 8) | static_cast<unsigned char>(data[i]));
+   }
+
+   return value;
+}
+}
+
+EventRecorder::EventRecorder(const std::string& path)
+   : out{path, std::ios::binary | std::ios::trunc},
+     depth(0),
+     start(std::chrono::steady_clock::now()) {
+   if (!out) {
+      throw std::runtime_error("can't create event log " + path);
+   }
+
+   out.write(MAGIC.data(), static_cast<std::streamsize>(MAGIC.size()));
+}
+
+WorkerAction EventRecorder::deliver(const std::function<WorkerAction(ClientEvent)>& callback, ClientEvent event) {
+   auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+   out.put(EVENT_TAG);
+   put(out, static_cast<uint8_t>(event.kind));
+   put(out, depth);
+   put(out, static_cast<uint32_t>(event.worker_id));
+   put(out, static_cast<uint64_t>(now.count()));
+   put(out, static_cast<uint32_t>(event.message.size()));
+   out.write(event.message.data(), static_cast<std::streamsize>(event.message.size()));
+
+   depth++;
+   auto action{callback(std::move(event))};
+   depth--;
+
+   return action;
+}
+
+void EventRecorder::record_id(unsigned int id) {
+   out.put(ID_TAG);
+   put(out, static_cast<uint32_t>(id));
+}
+
+EventReplay::EventReplay(const std::string& path)
+   : data{},
+     pos(MAGIC.size()),
+     greatest_id(0),
+     last_timestamp{} {
+   std::ifstream in{path, std::ios::binary};
+   if (!in) {
+      throw std::runtime_error("can't read event log " + path);
+   }
+
+   data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+   if (data.size() < MAGIC.size() || std::string_view(data.data(), MAGIC.size()) != MAGIC) {
+      throw std::runtime_error(path + " is not an event log");
+   }
+
+   // Check the records once, so replaying them needn't
+   for (auto at = pos; at < data.size();) {
+      if (data[at] == ID_TAG && data.size() - at >= ID_SIZE) {
+         greatest_id = std::max(greatest_id, get<uint32_t>(&data[at + 1]));
+         at += ID_SIZE;
+      } else if (data[at] == EVENT_TAG && data.size() - at >= EVENT_HEADER_SIZE && data[at + 1] <= static_cast<char>(ClientEventKind::READABLE)) {
+         greatest_id = std::max(greatest_id, get<uint32_t>(&data[at + 3]));
+         last_timestamp = std::chrono::nanoseconds(get<uint64_t>(&data[at + 7]));
+         at += EVENT_HEADER_SIZE + get<uint32_t>(&data[at + 15]);
+         if (at > data.size()) {
+            throw std::runtime_error(path + " ends in the middle of an event");
+         }
+      } else {
+         throw std::runtime_error(path + " has a corrupt record");
+      }
+   }
+}
+
+std::optional<ClientEvent> EventReplay::next_event() {
+   while (pos < data.size() && data[pos] == ID_TAG) {
+      pos += ID_SIZE;
+   }
+
+   if (pos == data.size()) {
+      return {};
+   }
+
+   return read_event();
+}
+
+std::optional<ClientEvent> EventReplay::next_nested(unsigned int depth) {
+   if (pos == data.size() || data[pos] != EVENT_TAG || static_cast<unsigned char>(data[pos + 2]) != depth) {
+      return {};
+   }
+
+   return read_event();
+}
+
+std::optional<unsigned int> EventReplay::next_id() {
+   if (pos == data.size() || data[pos] != ID_TAG) {
+      return {};
+   }
+
+   auto id = get<uint32_t>(&data[pos + 1]);
+   pos += ID_SIZE;
+
+   return id;
+}
+
+ClientEvent EventReplay::read_event() {
+   auto kind = static_cast<ClientEventKind>(data[pos + 1]);
+   auto worker_id = get<uint32_t>(&data[pos + 3]);
+   auto size = get<uint32_t>(&data[pos + 15]);
+   auto message = data.begin() + static_cast<std::ptrdiff_t>(pos + EVENT_HEADER_SIZE);
+   pos += EVENT_HEADER_SIZE + size;
+
+   return {kind, worker_id, std::vector<char>(message, message + size)};
+}
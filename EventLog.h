@@ -0,0 +1,79 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_EVENTLOG_H
+#define EPOLL_WORK_QUEUE_EVENTLOG_H
+
+#include "Client.h"
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+// A log of what a Server did with its callback: every event handed to it, when,
+// and how many callbacks were already in progress (a client dropped by disconnect()
+// gets its DISCONNECTED event within the callback that dropped it). The IDs handed
+// out by connect(), schedule(), watch() and adopt() are logged in between, so a
+// replay can give the callback the same IDs it got back then.
+//
+// The log starts with the 8 bytes "EWQLOG1\n". Its records are a one byte tag followed by big endian fields:
+//    'E' kind:1 depth:1 worker_id:4 timestamp_ns:8 size:4 message:size
+//    'I' id:4
+
+// Writes the log as the server runs
+class EventRecorder {
+   public:
+   // Throws if the log can't be created
+   EventRecorder(const std::string& path);
+
+   // Records the event, then hands it to the callback
+   WorkerAction deliver(const std::function<WorkerAction(ClientEvent)>& callback, ClientEvent event);
+   // Records an ID the server handed out
+   void record_id(unsigned int id);
+
+   private:
+   std::ofstream out;
+   // Callbacks in progress
+   uint8_t depth;
+   std::chrono::steady_clock::time_point start;
+};
+
+// Reads a log back, all of it up front so replaying it does no I/O
+class EventReplay {
+   public:
+   // Throws if the file can't be read or isn't a complete log
+   EventReplay(const std::string& path);
+
+   // The next event, skipping IDs nothing asked for
+   std::optional<ClientEvent> next_event();
+   // The next record, if it is an event that happened while this many callbacks were in progress
+   std::optional<ClientEvent> next_nested(unsigned int depth);
+   // The next record, if it is an ID
+   std::optional<unsigned int> next_id();
+
+   // The greatest ID in the log, IDs it doesn't have can be made up above it
+   unsigned int max_id() const noexcept {
+      return greatest_id;
+   }
+
+   // The time from the start of the recording to its last event
+   std::chrono::nanoseconds span() const noexcept {
+      return last_timestamp;
+   }
+
+   private:
+   std::vector<char> data;
+   std::size_t pos;
+   unsigned int greatest_id;
+   std::chrono::nanoseconds last_timestamp;
+
+   // Reads the event record at the position, moving past it
+   ClientEvent read_event();
+};
+
+#endif //EPOLL_WORK_QUEUE_EVENTLOG_H
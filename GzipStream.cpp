@@ -0,0 +1,63 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "GzipStream.h"
+
+#include <stdexcept>
+#include <string>
+
+GzipStream::GzipStream(std::function<void(std::string_view)> sink) : stream{}, finished(false), sink(sink), buffer{} {
+   // 16 + MAX_WBITS selects the gzip wrapper
+   if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+      throw std::runtime_error("inflateInit2 failed");
+   }
+}
+
+GzipStream::~GzipStream() {
+   inflateEnd(&stream);
+}
+
+void GzipStream::feed(std::string_view compressed) {
+   stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+   stream.avail_in = static_cast<uInt>(compressed.size());
+
+   // inflate may keep output of input it consumed when the buffer fills up, so it goes
+   // on until it has room to spare even once the input is all read
+   auto full = false;
+   while (stream.avail_in > 0 || full) {
+      // Concatenated gzip members are valid, start over on the next one
+      if (finished) {
+         if (inflateReset(&stream) != Z_OK) {
+            throw std::runtime_error("inflateReset failed");
+         }
+
+         finished = false;
+      }
+
+      stream.next_out = reinterpret_cast<Bytef*>(buffer.data());
+      stream.avail_out = static_cast<uInt>(buffer.size());
+
+      auto ret = inflate(&stream, Z_NO_FLUSH);
+      if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+         throw std::runtime_error("inflate failed: " + std::string(stream.msg ? stream.msg : "unknown error"));
+      }
+
+      if (auto produced = buffer.size() - stream.avail_out; produced > 0) {
+         sink(std::string_view(buffer.data(), produced));
+      }
+
+      full = ret == Z_OK && stream.avail_out == 0;
+      if (ret == Z_STREAM_END) {
+         finished = true;
+      } else if (ret == Z_BUF_ERROR) {
+         break;
+      }
+   }
+}
+
+void GzipStream::finish() const {
+   if (!finished) {
+      throw std::runtime_error("truncated gzip stream");
+   }
+}
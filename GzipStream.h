@@ -0,0 +1,37 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_GZIP_STREAM_H
+#define EPOLL_WORK_QUEUE_GZIP_STREAM_H
+
+#include <array>
+#include <functional>
+#include <string_view>
+#include <zlib.h>
+
+// Incremental gzip decoder. Compressed pieces go in through feed(),
+// decompressed pieces come out through the sink as soon as they are available,
+// so the full plaintext is never held in memory.
+class GzipStream {
+   public:
+   GzipStream(std::function<void(std::string_view)> sink);
+   ~GzipStream();
+
+   GzipStream(const GzipStream&) = delete;
+   GzipStream& operator=(const GzipStream&) = delete;
+
+   void feed(std::string_view compressed);
+   // Throws if the compressed stream was truncated
+   void finish() const;
+
+   private:
+   static const constexpr auto BUFFER_SIZE = 64 * 1024;
+
+   z_stream stream;
+   bool finished;
+   std::function<void(std::string_view)> sink;
+   std::array<char, BUFFER_SIZE> buffer;
+};
+
+#endif //EPOLL_WORK_QUEUE_GZIP_STREAM_H
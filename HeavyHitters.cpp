@@ -0,0 +1,207 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "HeavyHitters.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <charconv>
+
+HeavyHitters::HeavyHitters(std::size_t capacity)
+   : capacity(std::max(capacity, std::size_t{1})),
+     entries{},
+     heap{},
+     position{},
+     index{},
+     floor(0) {}
+
+void HeavyHitters::add(std::string_view domain) {
+   auto hash = utils::stable_hash(domain);
+   if (auto it{index.find(hash)}; it != index.end()) {
+      entries[it->second].count++;
+      sift_down(position[it->second]);
+      return;
+   }
+
+   if (entries.size() < capacity) {
+      entries.push_back({std::string(domain), 1, 0});
+      heap.push_back(entries.size() - 1);
+      position.push_back(heap.size() - 1);
+      index.emplace(hash, entries.size() - 1);
+      sift_up(heap.size() - 1);
+      return;
+   }
+
+   // The least counted domain makes way, the new one may have been it all along
+   auto& least = entries[heap.front()];
+   index.erase(utils::stable_hash(least.domain));
+   index.emplace(hash, heap.front());
+   least.domain.assign(domain);
+   least.error = least.count;
+   least.count++;
+   sift_down(0);
+}
+
+void HeavyHitters::merge(const HeavyHitters& other) {
+   auto mine = bound();
+   auto theirs = other.bound();
+
+   // A domain one summary has no counter for may have had up to its bound there
+   std::vector<Entry> merged{};
+   merged.reserve(entries.size() + other.entries.size());
+   for (auto& entry : entries) {
+      if (auto it{other.index.find(utils::stable_hash(entry.domain))}; it != other.index.end()) {
+         auto const& match = other.entries[it->second];
+         merged.push_back({std::move(entry.domain), entry.count + match.count, entry.error + match.error});
+      } else {
+         merged.push_back({std::move(entry.domain), entry.count + theirs, entry.error + theirs});
+      }
+   }
+
+   for (auto const& entry : other.entries) {
+      if (!index.contains(utils::stable_hash(entry.domain))) {
+         merged.push_back({entry.domain, entry.count + mine, entry.error + mine});
+      }
+   }
+
+   floor = mine + theirs;
+   if (merged.size() > capacity) {
+      auto by_count = [](const Entry& a, const Entry& b) { return a.count > b.count; };
+      std::nth_element(merged.begin(), merged.begin() + static_cast<std::ptrdiff_t>(capacity), merged.end(), by_count);
+      for (auto it = merged.begin() + static_cast<std::ptrdiff_t>(capacity); it != merged.end(); it++) {
+         floor = std::max(floor, it->count);
+      }
+      merged.resize(capacity);
+   }
+
+   entries = std::move(merged);
+   rebuild();
+}
+
+uint64_t HeavyHitters::bound() const noexcept {
+   if (entries.size() < capacity) {
+      return floor;
+   }
+
+   return std::max(floor, entries[heap.front()].count);
+}
+
+std::vector<HeavyHitters::Entry> HeavyHitters::top(std::size_t k) const {
+   std::vector<Entry> result{entries};
+   k = std::min(k, result.size());
+   std::partial_sort(result.begin(), result.begin() + static_cast<std::ptrdiff_t>(k), result.end(), [](const Entry& a, const Entry& b) {
+      return a.count > b.count || (a.count == b.count && a.domain < b.domain);
+   });
+   result.resize(k);
+
+   return result;
+}
+
+void HeavyHitters::print(std::ostream& out, std::size_t k) const {
+   for (auto const& entry : top(k)) {
+      out << entry.domain << ' ' << entry.count - entry.error << ".." << entry.count << '\n';
+   }
+}
+
+std::string HeavyHitters::serialize() const {
+   auto text{std::to_string(bound()) + '\n'};
+   for (auto const& entry : entries) {
+      text += std::to_string(entry.count) + ':' + std::to_string(entry.error) + ':' + entry.domain + '\n';
+   }
+
+   return text;
+}
+
+std::optional<HeavyHitters> HeavyHitters::parse(std::string_view text) {
+   auto number = [](std::string_view& field, char end, uint64_t& value) {
+      auto [ptr, ec] = std::from_chars(field.data(), field.data() + field.size(), value);
+      if (ec != std::errc{} || ptr == field.data() + field.size() || *ptr != end) {
+         return false;
+      }
+
+      field.remove_prefix(static_cast<std::size_t>(ptr - field.data()) + 1);
+      return true;
+   };
+
+   uint64_t floor{};
+   if (!number(text, '\n', floor)) {
+      return {};
+   }
+
+   std::vector<Entry> entries{};
+   while (!text.empty()) {
+      Entry entry{};
+      auto end = text.find('\n');
+      if (end == std::string_view::npos) {
+         return {};
+      }
+
+      auto line = text.substr(0, end + 1);
+      if (!number(line, ':', entry.count) || !number(line, ':', entry.error)) {
+         return {};
+      }
+
+      entry.domain = line.substr(0, line.size() - 1);
+      entries.push_back(std::move(entry));
+      text.remove_prefix(end + 1);
+   }
+
+   HeavyHitters summary{std::max(CAPACITY, entries.size())};
+   summary.entries = std::move(entries);
+   summary.floor = floor;
+   summary.rebuild();
+
+   return summary;
+}
+
+void HeavyHitters::swap_in_heap(std::size_t a, std::size_t b) {
+   std::swap(heap[a], heap[b]);
+   position[heap[a]] = a;
+   position[heap[b]] = b;
+}
+
+void HeavyHitters::sift_up(std::size_t at) {
+   while (at > 0) {
+      auto parent = (at - 1) / 2;
+      if (entries[heap[parent]].count <= entries[heap[at]].count) {
+         return;
+      }
+
+      swap_in_heap(at, parent);
+      at = parent;
+   }
+}
+
+void HeavyHitters::sift_down(std::size_t at) {
+   while (true) {
+      auto least = at;
+      for (auto child : {2 * at + 1, 2 * at + 2}) {
+         if (child < heap.size() && entries[heap[child]].count < entries[heap[least]].count) {
+            least = child;
+         }
+      }
+
+      if (least == at) {
+         return;
+      }
+
+      swap_in_heap(at, least);
+      at = least;
+   }
+}
+
+void HeavyHitters::rebuild() {
+   index.clear();
+   heap.resize(entries.size());
+   position.resize(entries.size());
+   for (std::size_t i = 0; i < entries.size(); i++) {
+      index.emplace(utils::stable_hash(entries[i].domain), i);
+      heap[i] = i;
+      position[i] = i;
+   }
+
+   for (auto i = heap.size() / 2; i-- > 0;) {
+      sift_down(i);
+   }
+}
@@ -0,0 +1,73 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_HEAVY_HITTERS_H
+#define EPOLL_WORK_QUEUE_HEAVY_HITTERS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// The most frequent domains of a stream, kept in a fixed number of counters (SpaceSaving).
+// A domain counted n times has a counter of at least n, if it has one, and one that
+// overcounts by at most error. Any domain more frequent than bound() has a counter.
+// Summaries of separate streams merge into one of the same size, with the bounds added up.
+class HeavyHitters {
+   public:
+   // Counters kept by default, any domain making up more than 1/CAPACITY of the rows is found
+   static const constexpr std::size_t CAPACITY = 1024;
+
+   struct Entry {
+      std::string domain;
+      // At least the true count
+      uint64_t count;
+      // At most how much count exceeds the true count by
+      uint64_t error;
+   };
+
+   explicit HeavyHitters(std::size_t capacity = CAPACITY);
+
+   void add(std::string_view domain);
+   void merge(const HeavyHitters& other);
+
+   // The greatest count a domain without a counter may have
+   uint64_t bound() const noexcept;
+   // The k domains with the greatest counts, the greatest first
+   std::vector<Entry> top(std::size_t k) const;
+   // Prints those as "<domain> <least>..<most>" lines, the range the true count is in
+   void print(std::ostream& out, std::size_t k) const;
+
+   bool empty() const noexcept {
+      return entries.empty();
+   }
+
+   // The summary as text, "<bound>\n" followed by a "<count>:<error>:<domain>\n" line per counter
+   std::string serialize() const;
+   static std::optional<HeavyHitters> parse(std::string_view text);
+
+   private:
+   std::size_t capacity;
+   std::vector<Entry> entries;
+   // Indices of the entries, as a heap with the smallest count on top
+   std::vector<std::size_t> heap;
+   // Where each entry is in the heap
+   std::vector<std::size_t> position;
+   // A mapping of the stable hash of a domain to its entry
+   std::unordered_map<uint64_t, std::size_t> index;
+   // What a domain dropped while merging may have had
+   uint64_t floor;
+
+   void sift_up(std::size_t at);
+   void sift_down(std::size_t at);
+   void swap_in_heap(std::size_t a, std::size_t b);
+   // Indexes and heaps the entries from scratch
+   void rebuild();
+};
+
+#endif //EPOLL_WORK_QUEUE_HEAVY_HITTERS_H
@@ -0,0 +1,226 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "IoUring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+IoUring::IoUring(unsigned int entries, unsigned short buffer_group, unsigned int buffer_count, unsigned int buffer_size)
+   : ring_fd(-1),
+     sq_ptr(MAP_FAILED),
+     sq_size(0),
+     sq_head(nullptr),
+     sq_tail(nullptr),
+     sq_mask(nullptr),
+     sq_array(nullptr),
+     sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+     sqes_size(0),
+     sq_local_tail(0),
+     sq_submitted(0),
+     cq_ptr(MAP_FAILED),
+     cq_size(0),
+     cq_head(nullptr),
+     cq_tail(nullptr),
+     cq_mask(nullptr),
+     cqes(nullptr),
+     buffer_group(buffer_group),
+     buffer_count(buffer_count),
+     buffer_size(buffer_size),
+     buffer_ring(static_cast<struct io_uring_buf*>(MAP_FAILED)),
+     buffer_ring_size(0),
+     buffers(nullptr),
+     buffer_tail(0),
+     enters(0) {
+   struct io_uring_params params;
+   memset(&params, 0, sizeof(params));
+
+   ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+   if (ring_fd == -1) {
+      throw std::runtime_error("io_uring_setup failed: " + std::string(std::strerror(errno)));
+   }
+
+   // Timed waits rely on IORING_ENTER_EXT_ARG
+   if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+      cleanup();
+      throw std::runtime_error("io_uring lacks required features");
+   }
+
+   sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+   cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+   sq_size = cq_size = std::max(sq_size, cq_size);
+
+   sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+   if (sq_ptr == MAP_FAILED) {
+      cleanup();
+      throw std::runtime_error("mmap of io_uring rings failed");
+   }
+   cq_ptr = sq_ptr;
+
+   auto sq_base = static_cast<char*>(sq_ptr);
+   sq_head = reinterpret_cast<unsigned*>(sq_base + params.sq_off.head);
+   sq_tail = reinterpret_cast<unsigned*>(sq_base + params.sq_off.tail);
+   sq_mask = reinterpret_cast<unsigned*>(sq_base + params.sq_off.ring_mask);
+   sq_array = reinterpret_cast<unsigned*>(sq_base + params.sq_off.array);
+   sq_local_tail = sq_submitted = *sq_tail;
+
+   auto cq_base = static_cast<char*>(cq_ptr);
+   cq_head = reinterpret_cast<unsigned*>(cq_base + params.cq_off.head);
+   cq_tail = reinterpret_cast<unsigned*>(cq_base + params.cq_off.tail);
+   cq_mask = reinterpret_cast<unsigned*>(cq_base + params.cq_off.ring_mask);
+   cqes = reinterpret_cast<struct io_uring_cqe*>(cq_base + params.cq_off.cqes);
+
+   sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+   sqes = static_cast<struct io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+   if (sqes == MAP_FAILED) {
+      cleanup();
+      throw std::runtime_error("mmap of io_uring sqes failed");
+   }
+
+   // The buffer ring must be page aligned and its size a power of two
+   if (buffer_count == 0 || (buffer_count & (buffer_count - 1)) != 0 || buffer_count > 32768) {
+      cleanup();
+      throw std::runtime_error("buffer_count must be a power of two");
+   }
+
+   buffer_ring_size = buffer_count * sizeof(struct io_uring_buf);
+   buffer_ring = static_cast<struct io_uring_buf*>(mmap(nullptr, buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+   if (buffer_ring == MAP_FAILED) {
+      cleanup();
+      throw std::runtime_error("mmap of buffer ring failed");
+   }
+
+   struct io_uring_buf_reg reg;
+   memset(&reg, 0, sizeof(reg));
+   reg.ring_addr = reinterpret_cast<__u64>(buffer_ring);
+   reg.ring_entries = buffer_count;
+   reg.bgid = buffer_group;
+
+   if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+      cleanup();
+      throw std::runtime_error("registering buffer ring failed: " + std::string(std::strerror(errno)));
+   }
+
+   buffers = new char[static_cast<size_t>(buffer_count) * buffer_size];
+   for (unsigned int i = 0; i < buffer_count; i++) {
+      recycle_buffer(static_cast<unsigned short>(i));
+   }
+}
+
+IoUring::~IoUring() {
+   cleanup();
+}
+
+struct io_uring_sqe* IoUring::get_sqe() {
+   auto head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+   if (sq_local_tail - head > *sq_mask) {
+      // Submission queue is full, hand it over to the kernel
+      submit();
+   }
+
+   auto index = sq_local_tail & *sq_mask;
+   auto sqe = &sqes[index];
+   memset(sqe, 0, sizeof(*sqe));
+
+   sq_array[index] = index;
+   sq_local_tail++;
+   __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+
+   return sqe;
+}
+
+void IoUring::submit() {
+   if (auto to_submit = sq_local_tail - sq_submitted; to_submit > 0) {
+      if (auto ret = enter(to_submit, 0, 0, nullptr, 0); ret > 0) {
+         sq_submitted += static_cast<unsigned>(ret);
+      }
+   }
+}
+
+bool IoUring::submit_and_wait(std::chrono::milliseconds timeout) {
+   struct __kernel_timespec ts;
+   ts.tv_sec = timeout.count() / 1000;
+   ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+
+   struct io_uring_getevents_arg arg;
+   memset(&arg, 0, sizeof(arg));
+   arg.ts = reinterpret_cast<__u64>(&ts);
+
+   auto to_submit = sq_local_tail - sq_submitted;
+   auto ret = enter(to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+   if (ret >= 0) {
+      sq_submitted += static_cast<unsigned>(ret);
+      return true;
+   }
+
+   return errno == ETIME || errno == EINTR || errno == EBUSY;
+}
+
+void IoUring::for_each_cqe(const std::function<void(const struct io_uring_cqe&)>& handler) {
+   auto head = *cq_head;
+   auto tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+   for (; head != tail; head++) {
+      // Copy the entry out, the handler may queue work that refills the ring
+      auto cqe{cqes[head & *cq_mask]};
+      __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+      handler(cqe);
+   }
+}
+
+const char* IoUring::buffer(unsigned short buffer_id) const {
+   return buffers + static_cast<size_t>(buffer_id) * buffer_size;
+}
+
+void IoUring::recycle_buffer(unsigned short buffer_id) {
+   auto& entry = buffer_ring[buffer_tail & (buffer_count - 1)];
+   entry.addr = reinterpret_cast<__u64>(buffer(buffer_id));
+   entry.len = buffer_size;
+   entry.bid = buffer_id;
+
+   // The ring tail overlays the reserved field of the first entry
+   buffer_tail++;
+   __atomic_store_n(&buffer_ring[0].resv, buffer_tail, __ATOMIC_RELEASE);
+}
+
+unsigned long IoUring::enter_calls() const noexcept {
+   return enters;
+}
+
+int IoUring::enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags, void* arg, size_t arg_size) {
+   enters++;
+   return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size));
+}
+
+void IoUring::cleanup() {
+   // Closing the ring cancels everything still in flight
+   if (ring_fd != -1) {
+      close(ring_fd);
+      ring_fd = -1;
+   }
+
+   if (sqes != MAP_FAILED) {
+      munmap(sqes, sqes_size);
+      sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+   }
+
+   if (sq_ptr != MAP_FAILED) {
+      munmap(sq_ptr, sq_size);
+      sq_ptr = cq_ptr = MAP_FAILED;
+   }
+
+   if (buffer_ring != MAP_FAILED) {
+      munmap(buffer_ring, buffer_ring_size);
+      buffer_ring = static_cast<struct io_uring_buf*>(MAP_FAILED);
+   }
+
+   delete[] buffers;
+   buffers = nullptr;
+}
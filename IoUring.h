@@ -0,0 +1,75 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_IO_URING_H
+#define EPOLL_WORK_QUEUE_IO_URING_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <linux/io_uring.h>
+
+// A minimal io_uring instance driven through the raw system calls:
+// submission and completion rings plus one ring of provided receive buffers.
+// Throws std::runtime_error if the kernel lacks any of the required features,
+// so the caller can fall back to epoll.
+class IoUring {
+   public:
+   IoUring(unsigned int entries, unsigned short buffer_group, unsigned int buffer_count, unsigned int buffer_size);
+   ~IoUring();
+
+   IoUring(const IoUring&) = delete;
+   IoUring& operator=(const IoUring&) = delete;
+
+   // Returns a zeroed submission entry, flushing the queue first if it is full
+   struct io_uring_sqe* get_sqe();
+   // Submits everything queued without waiting
+   void submit();
+   // Submits everything queued and waits for at least one completion or the timeout.
+   // Returns false on a fatal error.
+   bool submit_and_wait(std::chrono::milliseconds timeout);
+   // Hands every available completion to the handler and consumes it
+   void for_each_cqe(const std::function<void(const struct io_uring_cqe&)>& handler);
+   // Returns the data of a provided buffer selected by a completion
+   const char* buffer(unsigned short buffer_id) const;
+   // Gives a provided buffer back to the kernel
+   void recycle_buffer(unsigned short buffer_id);
+   // Number of io_uring_enter calls made so far
+   unsigned long enter_calls() const noexcept;
+
+   private:
+   int ring_fd;
+   // Submission queue
+   void* sq_ptr;
+   size_t sq_size;
+   unsigned* sq_head;
+   unsigned* sq_tail;
+   unsigned* sq_mask;
+   unsigned* sq_array;
+   struct io_uring_sqe* sqes;
+   size_t sqes_size;
+   unsigned sq_local_tail;
+   unsigned sq_submitted;
+   // Completion queue
+   void* cq_ptr;
+   size_t cq_size;
+   unsigned* cq_head;
+   unsigned* cq_tail;
+   unsigned* cq_mask;
+   struct io_uring_cqe* cqes;
+   // Provided buffer ring
+   unsigned short buffer_group;
+   unsigned int buffer_count;
+   unsigned int buffer_size;
+   struct io_uring_buf* buffer_ring;
+   size_t buffer_ring_size;
+   char* buffers;
+   unsigned short buffer_tail;
+   unsigned long enters;
+
+   int enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags, void* arg, size_t arg_size);
+   void cleanup();
+};
+
+#endif //EPOLL_WORK_QUEUE_IO_URING_H
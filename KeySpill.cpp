@@ -0,0 +1,228 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "KeySpill.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace key_spill {
+namespace {
+// About what a hash takes in a set: its node, as allocated, and its share of the buckets
+const constexpr std::size_t BYTES_PER_KEY = 48;
+
+std::atomic<std::size_t> budget{0};
+}
+
+void set_budget(std::size_t bytes) {
+   budget = bytes;
+}
+
+bool limited() noexcept {
+   return budget != 0;
+}
+
+std::size_t resident_limit() noexcept {
+   std::size_t bytes = budget;
+   if (bytes == 0) {
+      return std::numeric_limits<std::size_t>::max();
+   }
+
+   return std::max<std::size_t>(bytes / BYTES_PER_KEY, 1);
+}
+
+std::size_t partition_limit() noexcept {
+   std::size_t bytes = budget;
+   if (bytes == 0) {
+      return std::numeric_limits<std::size_t>::max();
+   }
+
+   return std::max<std::size_t>(bytes / sizeof(uint64_t), 1);
+}
+}
+
+namespace {
+// Hashes gathered for a partition before they are written
+const constexpr std::size_t WRITE_HASHES = 4096;
+// Hashes read from a partition at once
+const constexpr std::size_t READ_HASHES = 64 << 10;
+
+[[noreturn]] void fail(const char* what) {
+   throw std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+}
+
+KeySpill::~KeySpill() {
+   close_files();
+}
+
+KeySpill::KeySpill(KeySpill&& other) noexcept : shift(other.shift), files(std::exchange(other.files, {})) {
+}
+
+KeySpill& KeySpill::operator=(KeySpill&& other) noexcept {
+   if (this != &other) {
+      close_files();
+      shift = other.shift;
+      files = std::exchange(other.files, {});
+   }
+
+   return *this;
+}
+
+void KeySpill::write(const std::unordered_set<uint64_t>& hashes) {
+   write_all(hashes);
+}
+
+void KeySpill::append(const KeySpill& other) {
+   if (other.empty()) {
+      return;
+   }
+
+   for (std::size_t partition = 0; partition < PARTITIONS; partition++) {
+      other.read_blocks(partition, [&](std::span<const uint64_t> hashes) { write_all(hashes); });
+   }
+}
+
+void KeySpill::for_each_partition(const std::unordered_set<uint64_t>& resident, const std::function<void(std::vector<uint64_t>&)>& f) const {
+   std::vector<std::vector<uint64_t>> resident_parts(PARTITIONS);
+   for (auto hash : resident) {
+      resident_parts[partition_of(hash)].push_back(hash);
+   }
+
+   for (std::size_t partition = 0; partition < PARTITIONS; partition++) {
+      auto spilled = empty() ? 0 : size_of(partition);
+      auto resident_part{std::exchange(resident_parts[partition], {})};
+
+      // Too many to deduplicate in memory, spread them over the bits after. Those left
+      // once all bits are used up are copies of a few hashes, written once per spill.
+      if (spilled + resident_part.size() > key_spill::partition_limit() && shift >= PARTITION_BITS) {
+         KeySpill finer{shift - PARTITION_BITS};
+         finer.write_all(resident_part);
+         std::vector<uint64_t>{}.swap(resident_part);
+         if (spilled > 0) {
+            read_blocks(partition, [&](std::span<const uint64_t> hashes) { finer.write_all(hashes); });
+         }
+         finer.for_each_partition({}, f);
+         continue;
+      }
+
+      std::vector<uint64_t> hashes{};
+      hashes.reserve(spilled + resident_part.size());
+      if (spilled > 0) {
+         read_blocks(partition, [&](std::span<const uint64_t> block) { hashes.insert(hashes.end(), block.begin(), block.end()); });
+      }
+      hashes.insert(hashes.end(), resident_part.begin(), resident_part.end());
+      std::vector<uint64_t>{}.swap(resident_part);
+
+      std::sort(hashes.begin(), hashes.end());
+      hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+      f(hashes);
+   }
+}
+
+std::size_t KeySpill::partition_of(uint64_t hash) const noexcept {
+   // The lower bits pick buckets in sets, and those after them split states into parts,
+   // so the first partitions are picked by the upper bits
+   return static_cast<std::size_t>(hash >> shift) % PARTITIONS;
+}
+
+template <typename Hashes>
+void KeySpill::write_all(const Hashes& hashes) {
+   if (hashes.empty()) {
+      return;
+   }
+
+   open_files();
+   std::vector<std::vector<uint64_t>> pending(PARTITIONS);
+   for (auto hash : hashes) {
+      auto& partition = pending[partition_of(hash)];
+      partition.push_back(hash);
+      if (partition.size() == WRITE_HASHES) {
+         write_partition(partition_of(hash), partition);
+         partition.clear();
+      }
+   }
+
+   for (std::size_t partition = 0; partition < PARTITIONS; partition++) {
+      write_partition(partition, pending[partition]);
+   }
+}
+
+void KeySpill::open_files() {
+   if (!files.empty()) {
+      return;
+   }
+
+   auto pattern{(std::filesystem::temp_directory_path() / "ewq-spill-XXXXXX").string()};
+   for (std::size_t partition = 0; partition < PARTITIONS; partition++) {
+      std::string path{pattern};
+      auto fd = mkostemp(path.data(), O_CLOEXEC);
+      if (fd == -1) {
+         fail(("can't create a spill file in " + pattern).c_str());
+      }
+
+      unlink(path.c_str());
+      files.push_back(fd);
+   }
+}
+
+void KeySpill::close_files() noexcept {
+   for (auto fd : files) {
+      close(fd);
+   }
+   files.clear();
+}
+
+std::size_t KeySpill::size_of(std::size_t partition) const {
+   struct stat st;
+   if (fstat(files[partition], &st) == -1) {
+      fail("can't read a spill file");
+   }
+
+   return static_cast<std::size_t>(st.st_size) / sizeof(uint64_t);
+}
+
+void KeySpill::read_blocks(std::size_t partition, const std::function<void(std::span<const uint64_t>)>& f) const {
+   std::vector<uint64_t> block(READ_HASHES);
+   auto size = size_of(partition) * sizeof(uint64_t);
+   for (std::size_t done = 0; done < size;) {
+      auto wanted = std::min(size - done, block.size() * sizeof(uint64_t));
+      auto n = pread(files[partition], block.data(), wanted, static_cast<off_t>(done));
+      if (n == -1 && errno == EINTR) {
+         continue;
+      }
+      // Whole hashes are asked for, a regular file gives them all but at its end
+      if (n <= 0 || static_cast<std::size_t>(n) % sizeof(uint64_t) != 0) {
+         fail("can't read a spill file");
+      }
+
+      done += static_cast<std::size_t>(n);
+      f(std::span<const uint64_t>{block.data(), static_cast<std::size_t>(n) / sizeof(uint64_t)});
+   }
+}
+
+void KeySpill::write_partition(std::size_t partition, const std::vector<uint64_t>& hashes) {
+   auto data = reinterpret_cast<const char*>(hashes.data());
+   std::size_t size = hashes.size() * sizeof(uint64_t);
+   for (std::size_t done = 0; done < size;) {
+      auto n = ::write(files[partition], data + done, size - done);
+      if (n == -1 && errno == EINTR) {
+         continue;
+      }
+      if (n == -1) {
+         fail("can't write a spill file");
+      }
+      done += static_cast<std::size_t>(n);
+   }
+}
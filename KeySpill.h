@@ -0,0 +1,79 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_KEY_SPILL_H
+#define EPOLL_WORK_QUEUE_KEY_SPILL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <unordered_set>
+#include <vector>
+
+// How many keys a state keeps in memory. Without a budget there is no limit, with one the
+// keys past it are spilled to disk (see KeySpill), the budget being the memory the keys of
+// a chunk may take on the worker.
+namespace key_spill {
+// Smaller budgets would spill after every piece of a chunk, into thousands of files
+const constexpr std::size_t MIN_BUDGET = 64 << 10;
+
+void set_budget(std::size_t bytes);
+bool limited() noexcept;
+std::size_t resident_limit() noexcept;
+// The hashes a spilled partition may hold to be deduplicated in memory
+std::size_t partition_limit() noexcept;
+}
+
+// Hashes of keys moved out of memory, into unnamed temporary files in $TMPDIR (/tmp by
+// default) that are gone once closed. The hashes are spread over PARTITIONS files by
+// their upper bits, so a hash is in the same file whenever it is written, and each file
+// is deduplicated on its own: read back sequentially, sorted and made unique. Hashes are
+// appended as they are, once for every time they are written, so a file may outgrow the
+// budget. Such a file is spread over PARTITIONS files again by the bits after, as often
+// as it takes, before it is deduplicated.
+class KeySpill {
+   public:
+   static const constexpr unsigned int PARTITION_BITS = 6;
+   static const constexpr std::size_t PARTITIONS = std::size_t{1} << PARTITION_BITS;
+
+   KeySpill() = default;
+   ~KeySpill();
+
+   KeySpill(KeySpill&& other) noexcept;
+   KeySpill& operator=(KeySpill&& other) noexcept;
+   KeySpill(const KeySpill&) = delete;
+   KeySpill& operator=(const KeySpill&) = delete;
+
+   bool empty() const noexcept {
+      return files.empty();
+   }
+
+   void write(const std::unordered_set<uint64_t>& hashes);
+   // Appends the hashes spilled by another
+   void append(const KeySpill& other);
+   // Calls f with the distinct hashes of each partition in turn, counting the resident
+   // ones along with those spilled
+   void for_each_partition(const std::unordered_set<uint64_t>& resident, const std::function<void(std::vector<uint64_t>&)>& f) const;
+
+   private:
+   // Where the bits picking the partition of a hash start
+   unsigned int shift = 64 - PARTITION_BITS;
+   // One per partition, opened on the first write
+   std::vector<int> files{};
+
+   explicit KeySpill(unsigned int shift) : shift(shift) {}
+
+   std::size_t partition_of(uint64_t hash) const noexcept;
+   template <typename Hashes>
+   void write_all(const Hashes& hashes);
+   void open_files();
+   void close_files() noexcept;
+   std::size_t size_of(std::size_t partition) const;
+   // Calls f with the hashes of the partition, a block at a time
+   void read_blocks(std::size_t partition, const std::function<void(std::span<const uint64_t>)>& f) const;
+   void write_partition(std::size_t partition, const std::vector<uint64_t>& hashes);
+};
+
+#endif //EPOLL_WORK_QUEUE_KEY_SPILL_H
@@ -0,0 +1,122 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "LeaderConnection.h"
+
+#include <cerrno>
+#include <poll.h>
+#include <stdexcept>
+
+LeaderConnection::LeaderConnection(const std::string& host, const std::string& port) : socket_fd(-1), channel{}, frames{}, send_mutex{} {
+   auto kind = utils::address_kind(host);
+   if (kind == utils::AddressKind::TCP) {
+      socket_fd = utils::connect_tcp_fd(host, port);
+      return;
+   }
+
+   if (kind == utils::AddressKind::FD) {
+      socket_fd = std::stoi(utils::address_path(host));
+      return;
+   }
+
+   socket_fd = utils::connect_unix_fd(utils::address_path(host));
+
+   if (kind == utils::AddressKind::SHM) {
+      try {
+         channel = ShmChannel::receive_handshake(socket_fd);
+      } catch (const std::runtime_error&) {
+         close(socket_fd);
+         throw;
+      }
+   }
+}
+
+LeaderConnection::~LeaderConnection() {
+   close(socket_fd);
+}
+
+bool LeaderConnection::send(const std::vector<char>& message) {
+   std::unique_lock<std::mutex> lock(send_mutex);
+
+   if (!channel) {
+      return utils::send_to_socket(socket_fd, message);
+   }
+
+   // Frames bigger than the room in the ring go through in pieces, as the leader reads them
+   auto framed{utils::frame(message)};
+   std::size_t sent = 0;
+   while (true) {
+      sent += channel->write(framed.data() + sent, framed.size() - sent);
+      if (sent == framed.size()) {
+         return true;
+      }
+
+      // Only sleep once the leader knows to ring us
+      if (!channel->arm_room()) {
+         continue;
+      }
+
+      struct pollfd pfds[2] = {{channel->room_fd(), POLLIN, 0}, {socket_fd, POLLIN, 0}};
+      auto poll_ret = poll(pfds, 2, -1);
+      if (poll_ret < 0 && errno == EINTR) {
+         continue;
+      }
+
+      // Errors, and anything on the socket, mean the leader went away
+      if (poll_ret < 0 || pfds[1].revents) {
+         return false;
+      }
+
+      channel->acknowledge_room();
+   }
+}
+
+bool LeaderConnection::wait(std::chrono::seconds timeout) {
+   // A previous read may have buffered further messages already
+   if (frames.ready()) {
+      return true;
+   }
+
+   if (!channel) {
+      struct pollfd pfd {socket_fd, POLLIN, 0};
+      return poll(&pfd, 1, static_cast<int>(std::chrono::milliseconds(timeout).count())) != 0;
+   }
+
+   while (true) {
+      channel->read(frames);
+      if (frames.ready() || frames.is_corrupt()) {
+         return true;
+      }
+
+      // Only sleep once the leader knows to ring us
+      if (!channel->arm()) {
+         continue;
+      }
+
+      struct pollfd pfds[2] = {{channel->doorbell_fd(), POLLIN, 0}, {socket_fd, POLLIN, 0}};
+      auto poll_ret = poll(pfds, 2, static_cast<int>(std::chrono::milliseconds(timeout).count()));
+      if (poll_ret == 0) {
+         return false;
+      }
+
+      // Errors, and anything on the socket, mean the leader went away
+      if (poll_ret < 0 || pfds[1].revents) {
+         return true;
+      }
+
+      channel->acknowledge();
+   }
+}
+
+std::optional<std::vector<char>> LeaderConnection::receive() {
+   if (!channel) {
+      return utils::read_from_socket(socket_fd, frames);
+   }
+
+   return frames.next();
+}
+
+bool LeaderConnection::keep_alive(std::chrono::seconds timeout) {
+   return utils::enable_keepalive(socket_fd, timeout);
+}
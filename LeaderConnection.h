@@ -0,0 +1,49 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_LEADER_CONNECTION_H
+#define EPOLL_WORK_QUEUE_LEADER_CONNECTION_H
+
+#include "ShmChannel.h"
+#include "utils.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// The worker's connection to its leader. Messages go over the socket, or,
+// for "shm:" addresses, through the shared memory channel the leader passes
+// over the socket, which is then only watched for the leader going away.
+class LeaderConnection {
+   public:
+   // Connects to a TCP host and port, or a "unix:"/"shm:" address with an empty port.
+   // An "fd:" address is a socket that is connected already.
+   LeaderConnection(const std::string& host, const std::string& port);
+   ~LeaderConnection();
+
+   LeaderConnection(const LeaderConnection&) = delete;
+   LeaderConnection& operator=(const LeaderConnection&) = delete;
+
+   // Sends a message, may be called from any thread
+   bool send(const std::vector<char>& message);
+   // Waits up to the timeout until a message or the end of the connection
+   // can be received. Returns false on timeout.
+   bool wait(std::chrono::seconds timeout);
+   // Receives the next message, or nothing once the leader went away
+   std::optional<std::vector<char>> receive();
+   // Has the kernel probe a TCP connection, so receive() also ends once the leader's
+   // host stops answering for the timeout, see utils::enable_keepalive
+   bool keep_alive(std::chrono::seconds timeout);
+
+   private:
+   int socket_fd;
+   std::unique_ptr<ShmChannel> channel;
+   utils::FrameBuffer frames;
+   std::mutex send_mutex;
+};
+
+#endif //EPOLL_WORK_QUEUE_LEADER_CONNECTION_H
@@ -0,0 +1,135 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "PerfCounters.h"
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace perf_counters {
+namespace {
+std::atomic<bool> on{false};
+// Has a thread failed to open its counters, and said so?
+std::atomic<bool> reported{false};
+
+const constexpr std::array<uint64_t, 4> EVENTS{PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                               PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+// The counters of a thread, read all at once through the first one, none if they can't be opened
+class Group {
+   public:
+   Group() : fds{} {
+      for (auto event : EVENTS) {
+         perf_event_attr attr{};
+         attr.size = sizeof(attr);
+         attr.type = PERF_TYPE_HARDWARE;
+         attr.config = event;
+         attr.exclude_kernel = 1;
+         attr.exclude_hv = 1;
+         attr.read_format = PERF_FORMAT_GROUP;
+
+         auto fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, fds.empty() ? -1 : fds.front(), PERF_FLAG_FD_CLOEXEC));
+         if (fd == -1) {
+            if (!reported.exchange(true)) {
+               std::cerr << "client: hardware counters unavailable (" << std::strerror(errno) << "), measuring CPU time only" << std::endl;
+            }
+
+            close_all();
+            return;
+         }
+
+         fds.push_back(fd);
+      }
+   }
+
+   ~Group() {
+      close_all();
+   }
+
+   Group(const Group&) = delete;
+   Group& operator=(const Group&) = delete;
+
+   void read_into(utils::PhaseCounters& counters) const {
+      if (fds.empty()) {
+         return;
+      }
+
+      // The number of counters, then their values in the order they were opened
+      std::array<uint64_t, 1 + EVENTS.size()> values{};
+      if (::read(fds.front(), values.data(), sizeof(values)) != static_cast<ssize_t>(sizeof(values))) {
+         return;
+      }
+
+      counters.cycles = values[1];
+      counters.instructions = values[2];
+      counters.cache_misses = values[3];
+      counters.branch_misses = values[4];
+   }
+
+   private:
+   std::vector<int> fds;
+
+   void close_all() {
+      for (auto fd : fds) {
+         close(fd);
+      }
+      fds.clear();
+   }
+};
+}
+
+void enable() {
+   on = true;
+}
+
+bool enabled() noexcept {
+   return on;
+}
+
+utils::PhaseCounters read() {
+   utils::PhaseCounters counters{};
+   if (!on) {
+      return counters;
+   }
+
+   thread_local Group group{};
+   group.read_into(counters);
+
+   timespec cpu{};
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+   counters.cpu_ns = static_cast<uint64_t>(cpu.tv_sec) * 1'000'000'000 + static_cast<uint64_t>(cpu.tv_nsec);
+
+   return counters;
+}
+}
+
+PhaseClock::PhaseClock(utils::Timings& into)
+   : into(&into),
+     phase(utils::WorkPhase::FETCH),
+     since(std::chrono::steady_clock::now()),
+     counted(perf_counters::read()) {
+}
+
+PhaseClock::~PhaseClock() {
+   enter(phase);
+}
+
+void PhaseClock::enter(utils::WorkPhase next) {
+   auto now{std::chrono::steady_clock::now()};
+   auto counters{perf_counters::read()};
+   into->ns(phase) += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - since).count());
+   into->counters(phase) += counters - counted;
+
+   phase = next;
+   since = now;
+   counted = counters;
+}
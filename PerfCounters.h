@@ -0,0 +1,50 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_PERF_COUNTERS_H
+#define EPOLL_WORK_QUEUE_PERF_COUNTERS_H
+
+#include "utils.h"
+
+#include <chrono>
+
+// Hardware counters of the calling thread, through perf_event_open: cycles, instructions,
+// cache misses and branch misses, counted in user space so that perf_event_paranoid 2,
+// the usual default, permits them. Where it doesn't, or the CPU has no counters to offer
+// (as in most VMs), only the thread's CPU time is measured. Each thread opens its counters
+// on its first reading, and nothing is read before enable() is called.
+namespace perf_counters {
+void enable();
+bool enabled() noexcept;
+
+// What the calling thread did so far, nothing unless enabled
+utils::PhaseCounters read();
+}
+
+// Splits the wall clock time and the counters of the calling thread into the phases
+// of the work, adding whatever happened since the last switch to the phase left.
+// It starts out fetching and takes note of the current phase once destroyed.
+class PhaseClock {
+   public:
+   explicit PhaseClock(utils::Timings& into);
+   ~PhaseClock();
+
+   PhaseClock(const PhaseClock&) = delete;
+   PhaseClock& operator=(const PhaseClock&) = delete;
+
+   void enter(utils::WorkPhase next);
+
+   // Where the time goes, to add the counters of other threads to
+   utils::Timings& timings() noexcept {
+      return *into;
+   }
+
+   private:
+   utils::Timings* into;
+   utils::WorkPhase phase;
+   std::chrono::steady_clock::time_point since;
+   utils::PhaseCounters counted;
+};
+
+#endif //EPOLL_WORK_QUEUE_PERF_COUNTERS_H
@@ -0,0 +1,84 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "PhiAccrual.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+PhiAccrual::PhiAccrual(std::chrono::nanoseconds expected_interval)
+   : gaps{},
+     count(0),
+     sum(0),
+     sum_of_squares(0),
+     last(std::chrono::steady_clock::now()) {
+   auto expected = std::chrono::duration<double>(expected_interval).count();
+   for (auto gap : {expected * 0.75, expected * 1.25}) {
+      gaps[count++] = gap;
+      sum += gap;
+      sum_of_squares += gap * gap;
+   }
+}
+
+void PhiAccrual::arrived(std::chrono::steady_clock::time_point at) {
+   auto gap = std::chrono::duration<double>(at - last).count();
+   last = at;
+
+   auto slot = count++ % WINDOW;
+   if (count > WINDOW) {
+      sum -= gaps[slot];
+      sum_of_squares -= gaps[slot] * gaps[slot];
+   }
+   gaps[slot] = gap;
+   sum += gap;
+   sum_of_squares += gap * gap;
+
+   // Sums kept by adding and subtracting drift, start over from the gaps now and then
+   if (slot == WINDOW - 1) {
+      sum = std::accumulate(gaps.begin(), gaps.end(), 0.0);
+      sum_of_squares = std::inner_product(gaps.begin(), gaps.end(), gaps.begin(), 0.0);
+   }
+}
+
+double PhiAccrual::phi(std::chrono::steady_clock::time_point now) const {
+   auto silence = std::chrono::duration<double>(now - last).count();
+   auto deviations = (silence - mean()) / deviation();
+   // The chance of a gap at least that long
+   auto later = 0.5 * std::erfc(deviations / std::sqrt(2.0));
+
+   return later > 0 ? -std::log10(later) : HUGE_VAL;
+}
+
+std::chrono::nanoseconds PhiAccrual::timeout(double deviations) const {
+   auto seconds = std::max(mean() + deviations * deviation(), 0.0);
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(seconds));
+}
+
+double PhiAccrual::deviations_for(double threshold) {
+   // phi only grows with the deviations, so halve the interval the answer is in
+   double low = -40;
+   double high = 40;
+   for (auto i = 0; i < 64; i++) {
+      auto middle = (low + high) / 2;
+      auto later = 0.5 * std::erfc(middle / std::sqrt(2.0));
+      if (later > 0 && -std::log10(later) < threshold) {
+         low = middle;
+      } else {
+         high = middle;
+      }
+   }
+
+   return high;
+}
+
+double PhiAccrual::mean() const noexcept {
+   return sum / static_cast<double>(std::min(count, WINDOW));
+}
+
+double PhiAccrual::deviation() const noexcept {
+   auto n = static_cast<double>(std::min(count, WINDOW));
+   auto variance = std::max(sum_of_squares / n - mean() * mean(), 0.0);
+   return std::max(std::sqrt(variance), std::chrono::duration<double>(MIN_DEVIATION).count());
+}
@@ -0,0 +1,51 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_PHI_ACCRUAL_H
+#define EPOLL_WORK_QUEUE_PHI_ACCRUAL_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+
+// Suspicion that a peer is gone, from the gaps between the messages it sent (phi accrual).
+// Gaps are taken to be normally distributed like the last WINDOW of them, and phi is
+// -log10 of the chance that a live peer stays silent for as long as it has. A peer sending
+// steadily is suspected soon after it stops, one whose messages jitter only much later.
+class PhiAccrual {
+   public:
+   // Gaps the distribution is estimated from
+   static const constexpr std::size_t WINDOW = 100;
+   // Gaps of a peer that sends like clockwork still vary a little, e.g. with scheduling
+   static const constexpr auto MIN_DEVIATION = std::chrono::milliseconds(250);
+
+   // Until the peer sent something, gaps are expected to be about the interval, give or take a quarter
+   explicit PhiAccrual(std::chrono::nanoseconds expected_interval);
+
+   // Notes that the peer sent something at the time
+   void arrived(std::chrono::steady_clock::time_point at);
+   // The suspicion level at the time, 0 right after a message and growing without bound
+   double phi(std::chrono::steady_clock::time_point now) const;
+   // How long after its last message the peer is suspected with the given deviations
+   std::chrono::nanoseconds timeout(double deviations) const;
+   std::chrono::steady_clock::time_point last_arrival() const noexcept {
+      return last;
+   }
+   // When phi reaches the threshold, in standard deviations above the mean gap. Suspecting
+   // a peer at phi 8 means wrongly suspecting about one live peer in 10^8 gaps.
+   static double deviations_for(double threshold);
+
+   private:
+   std::array<double, WINDOW> gaps;
+   // Gaps noted so far, the oldest is overwritten once the window is full
+   std::size_t count;
+   double sum;
+   double sum_of_squares;
+   std::chrono::steady_clock::time_point last;
+
+   double mean() const noexcept;
+   double deviation() const noexcept;
+};
+
+#endif //EPOLL_WORK_QUEUE_PHI_ACCRUAL_H
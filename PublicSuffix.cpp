@@ -0,0 +1,128 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "PublicSuffix.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+namespace {
+// A label of the trie of public suffix rules, read right to left
+struct SuffixNode {
+   // The label's position in SUFFIX_LABELS
+   uint32_t label;
+   uint8_t length;
+   uint8_t flags;
+   // The node's children, sorted by label
+   uint16_t children;
+   uint32_t first_child;
+};
+
+// The labels up to here are a public suffix
+const constexpr uint8_t RULE = 1;
+// The labels up to here are not a public suffix, though a wildcard says so
+const constexpr uint8_t EXCEPTION = 2;
+// Any label below this one is a public suffix
+const constexpr uint8_t WILDCARD = 4;
+
+#include "PublicSuffixTable.inc"
+
+std::string_view label_of(const SuffixNode& node) {
+   return {SUFFIX_LABELS + node.label, node.length};
+}
+
+const SuffixNode* find_child(const SuffixNode& node, std::string_view label) {
+   auto first = SUFFIX_NODES + node.first_child;
+   auto last = first + node.children;
+   auto child = std::lower_bound(first, last, label, [](const SuffixNode& n, std::string_view l) {
+      return label_of(n) < l;
+   });
+
+   return child != last && label_of(*child) == label ? child : nullptr;
+}
+
+bool is_ip_address(std::string_view host) {
+   // Top level domains are never numeric
+   auto last = host.substr(std::min(host.rfind('.') + 1, host.size()));
+   return host.starts_with('[') || (!last.empty() && std::all_of(last.begin(), last.end(), [](char c) { return c >= '0' && c <= '9'; }));
+}
+}
+
+std::string_view public_suffix::registrable_domain(std::string_view host) noexcept {
+   if (host.empty() || is_ip_address(host)) {
+      return host;
+   }
+
+   // Where each label starts, the last label first. Host names have at most 127 labels.
+   std::array<std::size_t, 128> starts{};
+   std::size_t labels{};
+   // Labels in the public suffix, the default rule "*" makes it at least one
+   std::size_t suffix{1};
+   const SuffixNode* node = SUFFIX_NODES;
+   auto end = host.size();
+
+   while (labels < starts.size()) {
+      auto dot = end == 0 ? std::string_view::npos : host.rfind('.', end - 1);
+      auto start = dot == std::string_view::npos ? 0 : dot + 1;
+      starts[labels++] = start;
+
+      if (node != nullptr) {
+         auto child = find_child(*node, host.substr(start, end - start));
+         if (child != nullptr && (child->flags & EXCEPTION)) {
+            suffix = labels - 1;
+            node = nullptr;
+         } else {
+            if (node->flags & WILDCARD) {
+               suffix = labels;
+            }
+            if (child != nullptr && (child->flags & RULE)) {
+               suffix = labels;
+            }
+            node = child;
+         }
+      }
+
+      // Once no rule can match any more, one label past the suffix is all we need
+      if ((node == nullptr && labels > suffix) || dot == std::string_view::npos) {
+         break;
+      }
+      end = dot;
+   }
+
+   if (labels <= suffix) {
+      return host;
+   }
+
+   return host.substr(starts[suffix]);
+}
+
+std::string_view public_suffix::normalize_host(std::string_view url, std::array<char, 256>& buffer) noexcept {
+   if (auto scheme = url.find("://"); scheme < url.find('/')) {
+      url.remove_prefix(scheme + 3);
+   }
+
+   url = url.substr(0, url.find_first_of("/?#"));
+   if (auto at = url.rfind('@'); at != std::string_view::npos) {
+      url.remove_prefix(at + 1);
+   }
+
+   // The port follows the brackets of an IPv6 address
+   if (url.starts_with('[')) {
+      url = url.substr(0, std::min(url.find(']'), url.size() - 1) + 1);
+   } else {
+      url = url.substr(0, url.find(':'));
+   }
+
+   if (url.ends_with('.')) {
+      url.remove_suffix(1);
+   }
+
+   auto length = std::min(url.size(), buffer.size());
+   std::transform(url.begin(), url.begin() + static_cast<std::ptrdiff_t>(length), buffer.begin(), [](char c) {
+      return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+   });
+
+   return {buffer.data(), length};
+}
@@ -0,0 +1,23 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_PUBLIC_SUFFIX_H
+#define EPOLL_WORK_QUEUE_PUBLIC_SUFFIX_H
+
+#include <array>
+#include <string_view>
+
+namespace public_suffix {
+// The registrable domain of a lowercase host name: its public suffix plus one more
+// label, by the public suffix list compiled in at build time. IP addresses, and hosts
+// that are public suffixes themselves, are their own registrable domain.
+// The result is part of the host, nothing is allocated.
+std::string_view registrable_domain(std::string_view host) noexcept;
+
+// The host of a URL in lowercase, without scheme, userinfo, port and trailing dot,
+// copied to the buffer. Hosts longer than any valid one are cut off.
+std::string_view normalize_host(std::string_view url, std::array<char, 256>& buffer) noexcept;
+}
+
+#endif //EPOLL_WORK_QUEUE_PUBLIC_SUFFIX_H
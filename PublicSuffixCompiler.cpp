@@ -0,0 +1,254 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+// Flags of a node of the trie, see PublicSuffix.cpp
+const constexpr unsigned RULE = 1;
+const constexpr unsigned EXCEPTION = 2;
+const constexpr unsigned WILDCARD = 4;
+
+struct Node {
+   unsigned flags = 0;
+   std::map<std::string, Node> children;
+};
+
+std::vector<uint32_t> decode_utf8(const std::string& s) {
+   std::vector<uint32_t> code_points{};
+   for (std::size_t i = 0; i < s.size();) {
+      auto c = static_cast<unsigned char>(s[i]);
+      auto length = c < 0x80 ? 1 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+      uint32_t cp = length == 1 ? c : c & (0x3f >> (length - 1));
+      for (auto j = 1; j < length && i + static_cast<std::size_t>(j) < s.size(); j++) {
+         cp = (cp << 6) | (static_cast<unsigned char>(s[i + static_cast<std::size_t>(j)]) & 0x3f);
+      }
+
+      code_points.push_back(cp);
+      i += static_cast<std::size_t>(length);
+   }
+
+   return code_points;
+}
+
+// The ASCII form of an internationalized label, as hosts appear in URLs (RFC 3492)
+std::string punycode(const std::string& label) {
+   const uint32_t base = 36, tmin = 1, tmax = 26, skew = 38, damp = 700;
+   auto digit = [](uint32_t d) { return static_cast<char>(d < 26 ? 'a' + d : '0' + d - 26); };
+   auto adapt = [&](uint32_t delta, uint32_t points, bool first) {
+      delta = first ? delta / damp : delta / 2;
+      delta += delta / points;
+      uint32_t k = 0;
+      while (delta > ((base - tmin) * tmax) / 2) {
+         delta /= base - tmin;
+         k += base;
+      }
+      return k + (base - tmin + 1) * delta / (delta + skew);
+   };
+
+   auto code_points = decode_utf8(label);
+   std::string output{};
+   for (auto cp : code_points) {
+      if (cp < 0x80) {
+         output += static_cast<char>(cp);
+      }
+   }
+
+   auto basic = static_cast<uint32_t>(output.size());
+   if (basic > 0) {
+      output += '-';
+   }
+
+   uint32_t n = 0x80, delta = 0, bias = 72, handled = basic;
+   while (handled < code_points.size()) {
+      auto m = UINT32_MAX;
+      for (auto cp : code_points) {
+         if (cp >= n && cp < m) {
+            m = cp;
+         }
+      }
+
+      delta += (m - n) * (handled + 1);
+      n = m;
+      for (auto cp : code_points) {
+         if (cp < n) {
+            delta++;
+         }
+
+         if (cp == n) {
+            auto q = delta;
+            for (auto k = base;; k += base) {
+               auto t = k <= bias ? tmin : k >= bias + tmax ? tmax : k - bias;
+               if (q < t) {
+                  break;
+               }
+
+               output += digit(t + (q - t) % (base - t));
+               q = (q - t) / (base - t);
+            }
+
+            output += digit(q);
+            bias = adapt(delta, handled + 1, handled == basic);
+            delta = 0;
+            handled++;
+         }
+      }
+
+      delta++;
+      n++;
+   }
+
+   return "xn--" + output;
+}
+
+void add_rule(Node& root, std::vector<std::string> labels, unsigned flags) {
+   auto* node = &root;
+   for (auto label = labels.rbegin(); label != labels.rend(); label++) {
+      node = &node->children[*label];
+   }
+
+   node->flags |= flags;
+}
+
+void add_line(Node& root, std::string rule) {
+   auto flags = RULE;
+   if (rule.starts_with('!')) {
+      flags = EXCEPTION;
+      rule.erase(0, 1);
+   }
+
+   std::vector<std::string> labels{};
+   std::istringstream parts{rule};
+   for (std::string label; std::getline(parts, label, '.');) {
+      for (auto& c : label) {
+         if (c >= 'A' && c <= 'Z') {
+            c = static_cast<char>(c - 'A' + 'a');
+         }
+      }
+      labels.push_back(label);
+   }
+
+   // "*.foo" marks every label under foo as a suffix
+   if (!labels.empty() && labels.front() == "*") {
+      labels.erase(labels.begin());
+      flags = WILDCARD;
+   }
+
+   add_rule(root, labels, flags);
+
+   // URLs carry internationalized labels in their ASCII form
+   auto ascii{labels};
+   auto international{false};
+   for (auto& label : ascii) {
+      for (auto c : label) {
+         if (static_cast<unsigned char>(c) >= 0x80) {
+            label = punycode(label);
+            international = true;
+            break;
+         }
+      }
+   }
+
+   if (international) {
+      add_rule(root, ascii, flags);
+   }
+}
+
+void write_string(std::ostream& out, const std::string& s) {
+   out << "   \"";
+   std::size_t column{};
+   for (auto c : s) {
+      if (column++ == 100) {
+         out << "\"\n   \"";
+         column = 0;
+      }
+
+      if (static_cast<unsigned char>(c) >= 0x80) {
+         // Always three digits, so no digit that follows is taken for part of it
+         out << '\\' << static_cast<char>('0' + ((static_cast<unsigned char>(c) >> 6) & 7))
+             << static_cast<char>('0' + ((static_cast<unsigned char>(c) >> 3) & 7))
+             << static_cast<char>('0' + (static_cast<unsigned char>(c) & 7));
+      } else if (c == '"' || c == '\\') {
+         out << '\\' << c;
+      } else {
+         out << c;
+      }
+   }
+   out << "\"";
+}
+}
+
+/// Compiles the public suffix list into a trie of the labels read right to left,
+/// as C++ arrays for PublicSuffix.cpp. Siblings are stored next to each other,
+/// sorted, so lookups binary search them. Without a list only the default rule
+/// "*" applies, every top level domain is a public suffix.
+/// Example:
+///    ./psl_compile /usr/share/publicsuffix/public_suffix_list.dat PublicSuffixTable.inc
+int main(int argc, char* argv[]) {
+   if (argc != 2 && argc != 3) {
+      std::cerr << "Usage: " << argv[0] << " [public_suffix_list.dat] <output>" << std::endl;
+      return 1;
+   }
+
+   Node root{};
+   std::string source{argc == 3 ? argv[1] : "none"};
+   if (argc == 3) {
+      std::ifstream in{argv[1]};
+      if (!in) {
+         std::cerr << "can't read " << argv[1] << std::endl;
+         return 1;
+      }
+
+      // A rule is the first word of a line, comments start with "//"
+      for (std::string line; std::getline(in, line);) {
+         std::istringstream words{line};
+         std::string rule{};
+         if (words >> rule && !rule.starts_with("//")) {
+            add_line(root, rule);
+         }
+      }
+   }
+
+   // Breadth first, so the children of each node end up next to each other
+   std::string labels{};
+   std::ostringstream nodes{};
+   std::deque<std::pair<std::string, const Node*>> queue{{"", &root}};
+   std::size_t next_child = 1, count = 0;
+   while (!queue.empty()) {
+      auto [label, node] = queue.front();
+      queue.pop_front();
+
+      nodes << "   {" << labels.size() << ", " << label.size() << ", " << node->flags << ", "
+            << node->children.size() << ", " << next_child << "},\n";
+      labels += label;
+      next_child += node->children.size();
+      count++;
+
+      for (auto const& [child_label, child] : node->children) {
+         queue.emplace_back(child_label, &child);
+      }
+   }
+
+   std::ofstream out{argv[argc - 1]};
+   out << "// Generated by psl_compile from " << source << ", do not edit\n\n";
+   out << "static const constexpr char SUFFIX_LABELS[] =\n";
+   write_string(out, labels);
+   out << ";\n\n";
+   out << "// " << count << " nodes, the root first\n";
+   out << "static const constexpr SuffixNode SUFFIX_NODES[] = {\n" << nodes.str() << "};\n";
+
+   if (!out) {
+      std::cerr << "can't write " << argv[argc - 1] << std::endl;
+      return 1;
+   }
+
+   return 0;
+}
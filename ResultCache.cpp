@@ -0,0 +1,107 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "ResultCache.h"
+#include "CurlRequest.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+
+namespace {
+const constexpr auto FILE_SCHEME = std::string_view("file://");
+}
+
+ResultCache::ResultCache(std::string path) : path(path), entries{}, dirty(false) {
+   std::ifstream in{path};
+
+   // A missing cache file simply means a cold start
+   for (std::string line; std::getline(in, line, '\n');) {
+      auto url_end = line.find('\t');
+      auto validator_end = line.rfind('\t');
+      if (url_end == std::string::npos || url_end == validator_end) {
+         continue;
+      }
+
+      std::size_t result;
+      if (std::sscanf(line.c_str() + validator_end + 1, "%zu", &result) != 1) {
+         continue;
+      }
+
+      entries.insert_or_assign(line.substr(0, validator_end), result);
+   }
+}
+
+bool ResultCache::enabled() const noexcept {
+   return !path.empty();
+}
+
+std::optional<std::size_t> ResultCache::lookup(const std::string& url, const std::string& validator) const {
+   if (auto it{entries.find(make_key(url, validator))}; it != entries.end()) {
+      return it->second;
+   }
+
+   return {};
+}
+
+void ResultCache::store(const std::string& url, const std::string& validator, std::size_t result) {
+   entries.insert_or_assign(make_key(url, validator), result);
+   dirty = true;
+}
+
+void ResultCache::save() {
+   if (!enabled() || !dirty) {
+      return;
+   }
+
+   // Write a sibling file and rename it over, so an interrupted save
+   // never leaves a truncated cache behind
+   auto tmp_path{path + ".tmp"};
+   {
+      std::ofstream out{tmp_path, std::ios::trunc};
+      for (auto const& [key, result] : entries) {
+         out << key << '\t' << result << '\n';
+      }
+
+      if (!out) {
+         std::cerr << "failed to write result cache " << tmp_path << std::endl;
+         return;
+      }
+   }
+
+   if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+      std::cerr << "failed to replace result cache " << path << std::endl;
+      return;
+   }
+
+   dirty = false;
+}
+
+std::string ResultCache::validator_for(const std::string& url, CurlHandlePool& handles) {
+   if (url.starts_with(FILE_SCHEME)) {
+      struct stat st;
+      if (stat(url.c_str() + FILE_SCHEME.size(), &st) == -1) {
+         return {};
+      }
+
+      return "stat:" + std::to_string(st.st_size) + '/' + std::to_string(st.st_mtim.tv_sec) + '.' + std::to_string(st.st_mtim.tv_nsec);
+   }
+
+   try {
+      auto curl{handles.acquire()};
+      curl.set_url(url);
+      curl.set_timeout(30);
+
+      return curl.fetch_validator();
+   } catch (const std::runtime_error&) {
+      // Unvalidated chunks are just recomputed
+      return {};
+   }
+}
+
+std::string ResultCache::make_key(const std::string& url, const std::string& validator) {
+   return url + '\t' + validator;
+}
@@ -0,0 +1,48 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_RESULT_CACHE_H
+#define EPOLL_WORK_QUEUE_RESULT_CACHE_H
+
+#include "CurlRequest.h"
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+// A persistent store of per-chunk results. Entries are keyed by the chunk URL
+// together with a validator identifying the exact version of the chunk, so a
+// changed chunk never hits a stale entry.
+class ResultCache {
+   public:
+   ResultCache() : path{}, entries{}, dirty(false) {}
+   ResultCache(std::string path);
+
+   // Is there a backing file to persist to?
+   bool enabled() const noexcept;
+   // Looks up the cached result of this version of the chunk
+   std::optional<std::size_t> lookup(const std::string& url, const std::string& validator) const;
+   // Records the result of this version of the chunk
+   void store(const std::string& url, const std::string& validator, std::size_t result);
+   // Writes the cache back to its file, if anything changed
+   void save();
+
+   // Computes the validator of a chunk: size and mtime for file:// URLs,
+   // ETag or Last-Modified for anything else, asked for on a handle of the pool.
+   // Empty if it can't be determined.
+   static std::string validator_for(const std::string& url, CurlHandlePool& handles);
+
+   private:
+   // Location of the cache file
+   std::string path;
+   // Mapping of URL and validator to the result
+   std::unordered_map<std::string, std::size_t> entries;
+   // Were entries added since the last load or save?
+   bool dirty;
+
+   static std::string make_key(const std::string& url, const std::string& validator);
+};
+
+#endif //EPOLL_WORK_QUEUE_RESULT_CACHE_H
@@ -4,18 +4,147 @@
 
 #include "Server.h"
 
-Server::Server(Callback callback)
+namespace {
+// Period of the io_uring timer of outbound connections
+struct __kernel_timespec heartbeat_interval_ts {};
+
+struct __kernel_timespec to_kernel_timespec(std::chrono::nanoseconds duration) {
+   auto seconds = std::chrono::duration_cast<std::chrono::seconds>(duration);
+   return {seconds.count(), (duration - seconds).count()};
+}
+}
+
+Server::Server(Callback callback, ServerBackend backend)
    : running(false),
      client_id(0),
      tcp_fd(0),
+     unix_path{},
+     shm(false),
      epoll_fd(0),
-     callback(callback) {
+     callback(callback),
+     backend(backend),
+     liveness(ServerLiveness::HEARTBEATS),
+     suspicion_threshold(DEFAULT_SUSPICION_THRESHOLD),
+     suspicion_deviations(PhiAccrual::deviations_for(DEFAULT_SUSPICION_THRESHOLD)),
+     arrivals_by_id{},
+     timeouts_by_id{},
+     stats{},
+     ring{},
+     clients_by_id{},
+     channels_by_id{},
+     clients_by_doorbell_fd{},
+     frames_by_id{},
+     sends_by_id{},
+     scheduled_by_fd{},
+     scheduled_by_id{},
+     watched_by_fd{},
+     ring_in_flight(0),
+     recorder{},
+     replay_log{},
+     replay_depth(0) {
 }
 
 Server::~Server() {}
 
-void Server::start(std::string port) {
-   tcp_fd = utils::create_tcp_fd(port);
+std::ostream& operator<<(std::ostream& os, const ServerStats& s) {
+   os << "server_stats(estimated_syscalls=" << s.estimated_syscalls
+      << ",loop_iterations=" << s.loop_iterations
+      << ",messages_received=" << s.messages_received
+      << ",messages_sent=" << s.messages_sent
+      << ",callback_us=" << s.callback_ns / 1000
+      << ",longest_callback_us=" << s.longest_callback_ns / 1000 << ')';
+   return os;
+}
+
+void Server::set_liveness(ServerLiveness mode) {
+   liveness = mode;
+}
+
+void Server::set_suspicion_threshold(double phi) {
+   suspicion_threshold = phi;
+   suspicion_deviations = PhiAccrual::deviations_for(phi);
+}
+
+bool Server::times_out(const Client& client) const noexcept {
+   return !client.isOutbound() && liveness == ServerLiveness::HEARTBEATS;
+}
+
+void Server::heard_from(const Client& client) {
+   auto& arrivals = arrivals_by_id.at(client.getID());
+   arrivals.arrived(std::chrono::steady_clock::now());
+
+   auto timeout = suspicion_timeout(arrivals);
+   if (backend == ServerBackend::IO_URING) {
+      timeouts_by_id[client.getID()] = to_kernel_timespec(timeout);
+      queue_ring_op(RingOp::TIMEOUT_UPDATE, client.getID());
+      return;
+   }
+
+   utils::update_timer_fd(client.getTimerFD(), timeout);
+   stats.estimated_syscalls++;
+}
+
+std::chrono::nanoseconds Server::suspicion_timeout(const PhiAccrual& arrivals) const {
+   // A timeout of zero would disarm the timer anyway
+   return std::max<std::chrono::nanoseconds>(arrivals.timeout(suspicion_deviations), CLIENT_TIMEOUT);
+}
+
+bool Server::suspected(const Client& client) {
+   // The event loop may have been too busy to read what the client sent in time,
+   // reading it pushes the timeout back
+   char byte;
+   auto pending = recv(client.getClientFD(), &byte, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+   stats.estimated_syscalls++;
+
+   auto now{std::chrono::steady_clock::now()};
+   auto& arrivals = arrivals_by_id.at(client.getID());
+   auto silence = now - arrivals.last_arrival();
+   if (!pending && silence >= CLIENT_TIMEOUT && arrivals.phi(now) >= suspicion_threshold) {
+      return true;
+   }
+
+   // The timer went off a little early, or what is pending pushes it back once read
+   auto left = pending ? suspicion_timeout(arrivals) : std::max<std::chrono::nanoseconds>(suspicion_timeout(arrivals) - silence, std::chrono::milliseconds(1));
+   if (backend == ServerBackend::IO_URING) {
+      // The timeout that expired is gone, a new one takes its place
+      timeouts_by_id[client.getID()] = to_kernel_timespec(left);
+      queue_ring_op(RingOp::TIMEOUT, client.getID());
+      return false;
+   }
+
+   utils::update_timer_fd(client.getTimerFD(), left);
+   stats.estimated_syscalls++;
+
+   return false;
+}
+
+ServerBackend Server::get_backend() const noexcept {
+   return backend;
+}
+
+const ServerStats& Server::get_stats() const noexcept {
+   return stats;
+}
+
+void Server::start(std::string address) {
+   if (replay_log) {
+      stats = {};
+      running = true;
+      return;
+   }
+
+   auto kind = utils::address_kind(address);
+   if (kind == utils::AddressKind::FD) {
+      throw std::runtime_error("can't listen on an inherited socket");
+   }
+   if (kind == utils::AddressKind::TCP) {
+      tcp_fd = utils::create_tcp_fd(address);
+   } else {
+      unix_path = utils::address_path(address);
+      tcp_fd = utils::create_unix_fd(unix_path);
+   }
+   shm = kind == utils::AddressKind::SHM;
+
    if (tcp_fd == -1) {
       throw std::runtime_error("create_and_bind failed");
    }
@@ -28,6 +157,19 @@ void Server::start(std::string port) {
       throw std::runtime_error("listen failed");
    }
 
+   stats = {};
+
+   if (backend == ServerBackend::IO_URING) {
+      if (shm) {
+         std::cerr << "shared memory channels need epoll, falling back to it" << std::endl;
+      } else if (start_uring()) {
+         running = true;
+         return;
+      }
+
+      backend = ServerBackend::EPOLL;
+   }
+
    epoll_fd = utils::create_epoll_fd();
    if (epoll_fd == -1) {
       throw std::runtime_error("create_epoll_fd failed");
@@ -44,10 +186,357 @@ void Server::stop() {
    running = false;
 }
 
+unsigned int Server::connect(const std::string& host, const std::string& port) {
+   if (replay_log) {
+      return next_id();
+   }
+
+   auto kind = utils::address_kind(host);
+   if (kind == utils::AddressKind::FD) {
+      throw std::runtime_error("can't connect to an inherited socket");
+   }
+
+   if (kind == utils::AddressKind::SHM && backend != ServerBackend::EPOLL) {
+      throw std::runtime_error("shared memory channels need the epoll backend");
+   }
+
+   auto client_fd = kind == utils::AddressKind::TCP ? utils::connect_tcp_fd(host, port) : utils::connect_unix_fd(utils::address_path(host));
+   auto timer_fd = -1;
+
+   // Notice the other server going away even while we only wait for it
+   if (liveness == ServerLiveness::KEEPALIVE && !utils::enable_keepalive(client_fd, CLIENT_TIMEOUT)) {
+      close(client_fd);
+      throw std::runtime_error("enable_keepalive failed");
+   }
+
+   // The server passes the channel right after accepting us
+   std::unique_ptr<ShmChannel> channel{};
+   if (kind == utils::AddressKind::SHM) {
+      channel = ShmChannel::receive_handshake(client_fd);
+   }
+
+   if (backend == ServerBackend::EPOLL) {
+      if (!utils::make_socket_nonblocking(client_fd)) {
+         throw std::runtime_error("make_socket_nonblocking failed");
+      }
+
+      if (!utils::add_descriptor_to_epoll(epoll_fd, client_fd, EPOLLIN | EPOLLET)) {
+         throw std::runtime_error("add_descriptor_to_epoll on client_fd failed");
+      }
+
+      // Outbound connections get a periodic timer to send heartbeats on
+      timer_fd = utils::create_timer_fd(HEARTBEAT_INTERVAL, HEARTBEAT_INTERVAL);
+
+      if (!utils::add_descriptor_to_epoll(epoll_fd, timer_fd, EPOLLIN | EPOLLET)) {
+         throw std::runtime_error("add_descriptor_to_epoll on timer_fd failed");
+      }
+   }
+
+   auto client = std::make_shared<Client>(
+      next_id(),
+      timer_fd,
+      client_fd,
+      host,
+      static_cast<unsigned short>(kind == utils::AddressKind::TCP ? std::stoi(port) : 0),
+      true);
+
+   clients_by_id[client->getID()] = client;
+
+   if (channel) {
+      attach_channel(*client, std::move(channel));
+   }
+
+   if (backend == ServerBackend::IO_URING) {
+      arm_recv(client->getID());
+      queue_ring_op(RingOp::TIMEOUT, client->getID());
+   } else {
+      clients_by_fd[client->getClientFD()] = client;
+      clients_by_timer_fd[client->getTimerFD()] = client;
+   }
+
+   return client->getID();
+}
+
+bool Server::send(unsigned int id, std::vector<char> message) {
+   if (replay_log) {
+      stats.messages_sent++;
+      replay_nested();
+      return true;
+   }
+
+   if (auto c = clients_by_id.find(id); c != clients_by_id.end()) {
+      auto client{*c->second};
+      handle_worker_action(client, WorkerAction(WorkerActionKind::SEND_MESSAGE, std::move(message)));
+      return true;
+   }
+
+   return false;
+}
+
+bool Server::disconnect(unsigned int id) {
+   if (replay_log) {
+      replay_nested();
+      return true;
+   }
+
+   if (auto c = clients_by_id.find(id); c != clients_by_id.end()) {
+      auto client{*c->second};
+      handle_worker_action(client, WorkerAction(WorkerActionKind::DISCONNECT));
+      return true;
+   }
+
+   return false;
+}
+
+unsigned int Server::schedule(std::chrono::seconds delay) {
+   auto id = next_id();
+   if (replay_log) {
+      return id;
+   }
+
+   // A zero expiry would disarm the timer instead
+   delay = std::max(delay, std::chrono::seconds(1));
+
+   if (backend == ServerBackend::IO_URING) {
+      auto& ts = scheduled_by_id[id];
+      ts.tv_sec = delay.count();
+      ts.tv_nsec = 0;
+
+      auto sqe = queue_ring_op(RingOp::SCHEDULED, id);
+      sqe->opcode = IORING_OP_TIMEOUT;
+      sqe->fd = -1;
+      sqe->addr = reinterpret_cast<uint64_t>(&ts);
+      sqe->len = 1;
+
+      return id;
+   }
+
+   auto timer_fd = utils::create_timer_fd(delay);
+   // timerfd_create, timerfd_settime and epoll_ctl
+   stats.estimated_syscalls += 3;
+
+   if (!utils::add_descriptor_to_epoll(epoll_fd, timer_fd, EPOLLIN | EPOLLET)) {
+      throw std::runtime_error("add_descriptor_to_epoll on timer_fd failed");
+   }
+
+   scheduled_by_fd[timer_fd] = id;
+
+   return id;
+}
+
+unsigned int Server::watch(int fd) {
+   auto id = next_id();
+   if (replay_log) {
+      return id;
+   }
+
+   if (backend == ServerBackend::IO_URING) {
+      auto sqe = queue_ring_op(RingOp::WATCH, id);
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = fd;
+      sqe->poll32_events = POLLIN;
+
+      return id;
+   }
+
+   if (!utils::add_descriptor_to_epoll(epoll_fd, fd, EPOLLIN | EPOLLONESHOT)) {
+      throw std::runtime_error("add_descriptor_to_epoll on watched fd failed");
+   }
+   stats.estimated_syscalls++;
+
+   watched_by_fd[fd] = id;
+
+   return id;
+}
+
+unsigned int Server::adopt(int fd) {
+   if (replay_log) {
+      return next_id();
+   }
+
+   if (!utils::make_socket_nonblocking(fd)) {
+      throw std::runtime_error("make_socket_nonblocking failed");
+   }
+   stats.estimated_syscalls += 2;
+
+   return add_client(fd, "fd:" + std::to_string(fd), 0)->getID();
+}
+
+std::shared_ptr<Client> Server::add_client(int fd, std::string address, unsigned short port) {
+   if (liveness == ServerLiveness::KEEPALIVE) {
+      if (!utils::enable_keepalive(fd, CLIENT_TIMEOUT)) {
+         throw std::runtime_error("enable_keepalive failed");
+      }
+      // getsockopt and up to five setsockopt
+      stats.estimated_syscalls += 6;
+   }
+
+   if (backend == ServerBackend::IO_URING) {
+      auto client = std::make_shared<Client>(next_id(), -1, fd, address, port);
+
+      clients_by_id[client->getID()] = client;
+      arm_recv(client->getID());
+      if (times_out(*client)) {
+         // Clients are expected to heartbeat every HEARTBEAT_INTERVAL until they showed otherwise
+         auto const& arrivals = arrivals_by_id.emplace(client->getID(), PhiAccrual{HEARTBEAT_INTERVAL}).first->second;
+         timeouts_by_id[client->getID()] = to_kernel_timespec(suspicion_timeout(arrivals));
+         queue_ring_op(RingOp::TIMEOUT, client->getID());
+      }
+
+      return client;
+   }
+
+   if (!utils::add_descriptor_to_epoll(epoll_fd, fd, EPOLLIN | EPOLLET)) {
+      throw std::runtime_error("add_descriptor_to_epoll on client_fd failed");
+   }
+   stats.estimated_syscalls++;
+
+   // Without heartbeats there is nothing to time out, errors on the socket show the client is gone
+   if (liveness == ServerLiveness::KEEPALIVE) {
+      auto client = std::make_shared<Client>(next_id(), -1, fd, address, port);
+
+      clients_by_id[client->getID()] = client;
+      clients_by_fd[client->getClientFD()] = client;
+
+      return client;
+   }
+
+   // Clients are expected to heartbeat every HEARTBEAT_INTERVAL until they showed otherwise
+   PhiAccrual arrivals{HEARTBEAT_INTERVAL};
+   auto timer_fd = utils::create_timer_fd(suspicion_timeout(arrivals));
+   // epoll_ctl, timerfd_create and timerfd_settime
+   stats.estimated_syscalls += 3;
+
+   if (!utils::add_descriptor_to_epoll(epoll_fd, timer_fd, EPOLLIN | EPOLLET)) {
+      throw std::runtime_error("add_descriptor_to_epoll on timer_fd failed");
+   }
+
+   auto client = std::make_shared<Client>(next_id(), timer_fd, fd, address, port);
+
+   clients_by_id[client->getID()] = client;
+   clients_by_fd[client->getClientFD()] = client;
+   clients_by_timer_fd[client->getTimerFD()] = client;
+   arrivals_by_id.emplace(client->getID(), arrivals);
+
+   return client;
+}
+
+unsigned int Server::next_id() {
+   if (replay_log) {
+      // Calls the recorded callback didn't make get IDs the log never uses
+      if (auto id{replay_log->next_id()}; id.has_value()) {
+         return *id;
+      }
+
+      return client_id++;
+   }
+
+   auto id = client_id++;
+   if (recorder) {
+      recorder->record_id(id);
+   }
+
+   return id;
+}
+
+void Server::record(const std::string& path) {
+   recorder = std::make_unique<EventRecorder>(path);
+   callback = [callback = std::move(callback), recorder = recorder.get()](ClientEvent event) {
+      return recorder->deliver(callback, std::move(event));
+   };
+}
+
+void Server::replay(const std::string& path) {
+   replay_log = std::make_unique<EventReplay>(path);
+   client_id = replay_log->max_id() + 1;
+}
+
+std::chrono::nanoseconds Server::replayed_time() const noexcept {
+   return replay_log ? replay_log->span() : std::chrono::nanoseconds{};
+}
+
+WorkerAction Server::deliver(ClientEvent event) {
+   auto started{std::chrono::steady_clock::now()};
+   auto action{callback(std::move(event))};
+   auto elapsed = static_cast<unsigned long>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count());
+   stats.callback_ns += elapsed;
+   stats.longest_callback_ns = std::max(stats.longest_callback_ns, elapsed);
+
+   return action;
+}
+
+void Server::fire(ClientEventKind kind, unsigned int id) {
+   // There is no client to act on, only stopping makes sense
+   if (deliver({kind, id}).kind == WorkerActionKind::EXIT) {
+      stop();
+   }
+}
+
 bool Server::run() {
+   if (replay_log) {
+      return run_replay();
+   }
+
+   if (backend == ServerBackend::IO_URING) {
+      return run_uring();
+   }
+
+   return run_epoll();
+}
+
+bool Server::run_replay() {
+   while (running) {
+      auto event{replay_log->next_event()};
+      if (!event.has_value()) {
+         break;
+      }
+
+      replay_event(std::move(*event));
+   }
+
+   return true;
+}
+
+void Server::replay_event(ClientEvent event) {
+   // Each event stands in for an iteration of the event loop
+   stats.loop_iterations++;
+   if (event.kind == ClientEventKind::MESSAGE_RECEIVED) {
+      stats.messages_received++;
+   }
+
+   replay_depth++;
+   auto action{deliver(std::move(event))};
+   replay_depth--;
+
+   // Like the event loops, ignore what the callback makes of nested events
+   if (replay_depth > 0) {
+      return;
+   }
+
+   if (action.kind == WorkerActionKind::SEND_MESSAGE) {
+      stats.messages_sent++;
+   } else if (action.kind == WorkerActionKind::EXIT) {
+      stop();
+   }
+}
+
+void Server::replay_nested() {
+   // Outside of callbacks everything is a top level event
+   if (replay_depth == 0) {
+      return;
+   }
+
+   while (auto event{replay_log->next_nested(replay_depth)}) {
+      replay_event(std::move(*event));
+   }
+}
+
+bool Server::run_epoll() {
    struct epoll_event events[EPOLL_MAX_EVENTS];
 
    while (running) {
+      stats.loop_iterations++;
+      stats.estimated_syscalls++;
       auto epoll_ret = epoll_wait(
          epoll_fd,
          events,
@@ -75,7 +564,7 @@ bool Server::run() {
             auto clients{accept_clients()};
             // mark each worker as connected
             for (auto client : clients) {
-               handle_worker_action(*client, callback({ClientEventKind::CONNECTED, client->getID()}));
+               handle_worker_action(*client, deliver({ClientEventKind::CONNECTED, client->getID()}));
             }
          } else {
             if (ev & (EPOLLHUP | EPOLLERR)) {
@@ -83,27 +572,94 @@ bool Server::run() {
                if (auto fd_client = clients_by_fd.find(fd); fd_client != clients_by_fd.end()) {
                   auto c{*fd_client->second};
                   remove_client(c);
-                  handle_worker_action(c, callback({ClientEventKind::DISCONNECTED, c.getID()}));
+                  handle_worker_action(c, deliver({ClientEventKind::DISCONNECTED, c.getID()}));
                }
             } else if (auto fd_client = clients_by_fd.find(fd); fd_client != clients_by_fd.end()) {
                // handle client event
                auto c{*fd_client->second};
-               if (auto message{read_from_client(*fd_client->second)}; message.has_value()) {
-                  utils::update_timer_fd(c.getTimerFD(), CLIENT_TIMEOUT);
-                  handle_worker_action(c, callback({ClientEventKind::MESSAGE_RECEIVED, c.getID(), *message}));
+               if (ev & EPOLLOUT) {
+                  // the socket has room for what was queued, stop watching it once all fits
+                  if (flush_sends(c)) {
+                     if (!utils::modify_descriptor_in_epoll(epoll_fd, fd, EPOLLIN | EPOLLET)) {
+                        throw std::runtime_error("modify_descriptor_in_epoll on client_fd failed");
+                     }
+                     stats.estimated_syscalls++;
+                  }
+
+                  if (!(ev & EPOLLIN) || clients_by_id.find(c.getID()) == clients_by_id.end()) {
+                     continue;
+                  }
+               }
+
+               if (auto messages{read_from_client(c)}; messages.has_value()) {
+                  if (times_out(c)) {
+                     heard_from(c);
+                  }
+
+                  dispatch_messages(c, std::move(*messages));
+               } else {
+                  remove_client(c);
+                  handle_worker_action(c, deliver({ClientEventKind::DISCONNECTED, c.getID()}));
+               }
+            } else if (auto bell_client = clients_by_doorbell_fd.find(fd); bell_client != clients_by_doorbell_fd.end()) {
+               auto c{*bell_client->second};
+               if (auto& channel = *channels_by_id[c.getID()]; fd == channel.room_fd()) {
+                  // the client made room for what was queued
+                  channel.acknowledge_room();
+                  flush_sends(c);
+                  continue;
+               }
+
+               // messages arrived in the shared memory channel
+               if (auto messages{read_from_channel(c)}; messages.has_value()) {
+                  if (times_out(c)) {
+                     heard_from(c);
+                  }
+
+                  dispatch_messages(c, std::move(*messages));
                } else {
                   remove_client(c);
-                  handle_worker_action(c, callback({ClientEventKind::DISCONNECTED, c.getID()}));
+                  handle_worker_action(c, deliver({ClientEventKind::DISCONNECTED, c.getID()}));
                }
             } else if (auto timer_client = clients_by_timer_fd.find(fd); timer_client != clients_by_timer_fd.end()) {
                // read timer value, just for compliance
                uint64_t value;
                read(fd, &value, sizeof(value));
+               stats.estimated_syscalls++;
 
-               // evict client as timeout for heartbeat expired
                auto c{*timer_client->second};
+               if (c.isOutbound()) {
+                  handle_worker_action(c, deliver({ClientEventKind::TIMER, c.getID()}));
+                  continue;
+               }
+
+               // evict client once it went silent for longer than its heartbeats suggest
+               if (!suspected(c)) {
+                  continue;
+               }
+
                remove_client(c);
-               handle_worker_action(c, callback({ClientEventKind::DISCONNECTED, c.getID()}));
+               handle_worker_action(c, deliver({ClientEventKind::DISCONNECTED, c.getID()}));
+            } else if (auto scheduled = scheduled_by_fd.find(fd); scheduled != scheduled_by_fd.end()) {
+               // one-shot timers are used up when they fire
+               auto id = scheduled->second;
+               scheduled_by_fd.erase(scheduled);
+               if (!utils::remove_client_from_epoll(epoll_fd, fd)) {
+               }
+
+               close(fd);
+               stats.estimated_syscalls += 2;
+
+               fire(ClientEventKind::TIMER, id);
+            } else if (auto watched = watched_by_fd.find(fd); watched != watched_by_fd.end()) {
+               // watches fire once, the descriptor belongs to the caller
+               auto id = watched->second;
+               watched_by_fd.erase(watched);
+               if (!utils::remove_client_from_epoll(epoll_fd, fd)) {
+               }
+               stats.estimated_syscalls++;
+
+               fire(ClientEventKind::READABLE, id);
             }
          }
       }
@@ -118,10 +674,11 @@ std::vector<std::shared_ptr<Client>> Server::accept_clients() {
    std::vector<std::shared_ptr<Client>> clients{};
 
    while (true) {
-      struct sockaddr_in in_addr;
+      struct sockaddr_storage in_addr;
       socklen_t in_len = sizeof(in_addr);
 
       auto client_fd = accept(tcp_fd, (struct sockaddr*) &in_addr, &in_len);
+      stats.estimated_syscalls++;
       if (client_fd == -1) {
          if (errno == EAGAIN || errno == EWOULDBLOCK) {
             return clients;
@@ -133,27 +690,22 @@ std::vector<std::shared_ptr<Client>> Server::accept_clients() {
       if (!utils::make_socket_nonblocking(client_fd)) {
          throw std::runtime_error("make_socket_nonblocking failed");
       }
+      // fcntl twice
+      stats.estimated_syscalls += 2;
 
-      if (!utils::add_descriptor_to_epoll(epoll_fd, client_fd, EPOLLIN | EPOLLET)) {
-         throw std::runtime_error("add_descriptor_to_epoll on client_fd failed");
-      }
+      auto client = add_client(client_fd, utils::peer_address_to_string(in_addr), utils::peer_port(in_addr));
 
-      auto timer_fd = utils::create_timer_fd(CLIENT_TIMEOUT);
+      // Co-located clients get their messages through shared memory from here on
+      if (shm) {
+         auto channel = std::make_unique<ShmChannel>();
+         if (!channel->send_handshake(client->getClientFD())) {
+            throw std::runtime_error("shared memory handshake failed");
+         }
+         stats.estimated_syscalls++;
 
-      if (!utils::add_descriptor_to_epoll(epoll_fd, timer_fd, EPOLLIN | EPOLLET)) {
-         throw std::runtime_error("add_descriptor_to_epoll on timer_fd failed");
+         attach_channel(*client, std::move(channel));
       }
 
-      auto client = std::make_shared<Client>(
-         client_id++,
-         timer_fd,
-         client_fd,
-         utils::ip_address_to_string(in_addr),
-         ntohs(in_addr.sin_port));
-
-      clients_by_fd[client->getClientFD()] = client;
-      clients_by_timer_fd[client->getTimerFD()] = client;
-
       clients.push_back(std::move(client));
    }
 
@@ -161,6 +713,54 @@ std::vector<std::shared_ptr<Client>> Server::accept_clients() {
 }
 
 void Server::remove_client(Client client) {
+   frames_by_id.erase(client.getID());
+   arrivals_by_id.erase(client.getID());
+
+   if (backend == ServerBackend::IO_URING) {
+      if (clients_by_id.erase(client.getID()) == 0) {
+         return;
+      }
+
+      // Queued sends resolve the descriptor on submission, flush them
+      // before the descriptor number can be reused by a new client
+      ring->submit();
+      timeouts_by_id.erase(client.getID());
+
+      queue_ring_op(RingOp::CANCEL, client.getID())->addr = (static_cast<uint64_t>(RingOp::RECV) << 32) | client.getID();
+      queue_ring_op(RingOp::CANCEL, client.getID())->addr = (static_cast<uint64_t>(RingOp::TIMEOUT) << 32) | client.getID();
+
+      close(client.getClientFD());
+      stats.estimated_syscalls++;
+
+      // Keep the in-flight message alive until its completion arrives
+      if (auto sends = sends_by_id.find(client.getID()); sends != sends_by_id.end()) {
+         if (sends->second.empty()) {
+            sends_by_id.erase(sends);
+         } else {
+            sends->second.resize(1);
+         }
+      }
+
+      return;
+   }
+
+   clients_by_id.erase(client.getID());
+   sends_by_id.erase(client.getID());
+
+   if (auto channel = channels_by_id.find(client.getID()); channel != channels_by_id.end()) {
+      if (!utils::remove_client_from_epoll(epoll_fd, channel->second->doorbell_fd())) {
+      }
+
+      if (!utils::remove_client_from_epoll(epoll_fd, channel->second->room_fd())) {
+      }
+
+      stats.estimated_syscalls += 2 + channel->second->doorbell_syscalls();
+      clients_by_doorbell_fd.erase(channel->second->doorbell_fd());
+      clients_by_doorbell_fd.erase(channel->second->room_fd());
+      channels_by_id.erase(channel);
+   }
+
+   stats.estimated_syscalls += 4;
    if (auto c = clients_by_fd.find(client.getClientFD()); c != clients_by_fd.end()) {
       if (!utils::remove_client_from_epoll(epoll_fd, c->second->getClientFD())) {
       }
@@ -180,27 +780,133 @@ void Server::remove_client(Client client) {
    }
 }
 
-std::optional<std::vector<char>> Server::read_from_client(const Client& client) {
-   char buffer[512];
-   std::vector<char> message{};
-   ssize_t recv_ret = recv(client.getClientFD(), buffer, sizeof(buffer), 0);
+std::optional<std::vector<std::vector<char>>> Server::read_from_client(const Client& client) {
+   char buffer[4096];
+   auto& frames = frames_by_id[client.getID()];
+
+   // edge triggered, so drain the socket completely
+   while (true) {
+      ssize_t recv_ret = recv(client.getClientFD(), buffer, sizeof(buffer), 0);
+      stats.estimated_syscalls++;
+
+      if (recv_ret > 0) {
+         frames.append(buffer, static_cast<size_t>(recv_ret));
+      } else if (recv_ret == 0) {
+         // client disconnected
+         return {};
+      } else {
+         if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+         }
 
-   if (recv_ret > 0) {
-      std::copy(buffer, buffer + recv_ret, std::back_inserter(message));
-   } else if (recv_ret == 0) {
-      // client disconnected
-      return {};
-   } else if (recv_ret < 0) {
-      if (!(errno == EAGAIN || errno == EWOULDBLOCK)) {
          // something went badly wrong
          throw std::runtime_error("recv_ret < 0 and" + std::string(std::strerror(errno)));
       }
    }
 
-   return {message};
+   return take_frames(client.getID());
+}
+
+void Server::attach_channel(const Client& client, std::unique_ptr<ShmChannel> channel) {
+   if (!utils::add_descriptor_to_epoll(epoll_fd, channel->doorbell_fd(), EPOLLIN | EPOLLET)) {
+      throw std::runtime_error("add_descriptor_to_epoll on doorbell failed");
+   }
+
+   if (!utils::add_descriptor_to_epoll(epoll_fd, channel->room_fd(), EPOLLIN | EPOLLET)) {
+      throw std::runtime_error("add_descriptor_to_epoll on room doorbell failed");
+   }
+   stats.estimated_syscalls += 2;
+
+   // Nothing can have arrived yet, so this just lets the peer ring us
+   channel->arm();
+
+   clients_by_doorbell_fd[channel->doorbell_fd()] = clients_by_id[client.getID()];
+   clients_by_doorbell_fd[channel->room_fd()] = clients_by_id[client.getID()];
+   channels_by_id[client.getID()] = std::move(channel);
+}
+
+std::optional<std::vector<std::vector<char>>> Server::read_from_channel(const Client& client) {
+   auto& channel = *channels_by_id[client.getID()];
+   auto& frames = frames_by_id[client.getID()];
+
+   channel.acknowledge();
+
+   // Read until the ring stays empty after announcing we go back to sleep
+   do {
+      channel.read(frames);
+   } while (!channel.arm());
+
+   return take_frames(client.getID());
+}
+
+void Server::dispatch_messages(const Client& client, std::vector<std::vector<char>> messages) {
+   for (auto& message : messages) {
+      // handling the previous message may have removed the client
+      if (!running || clients_by_id.find(client.getID()) == clients_by_id.end()) {
+         break;
+      }
+
+      stats.messages_received++;
+      handle_worker_action(client, deliver({ClientEventKind::MESSAGE_RECEIVED, client.getID(), std::move(message)}));
+   }
+}
+
+std::optional<std::vector<std::vector<char>>> Server::take_frames(unsigned int id) {
+   auto& frames = frames_by_id[id];
+   std::vector<std::vector<char>> messages{};
+
+   while (auto message{frames.next()}) {
+      messages.push_back(std::move(*message));
+   }
+
+   // a client announcing absurd frames is not speaking our protocol
+   if (frames.is_corrupt()) {
+      std::cerr << "client " << id << " sent a frame over " << utils::FrameBuffer::MAX_FRAME_SIZE << " bytes, dropping it" << std::endl;
+      return {};
+   }
+
+   return messages;
 }
 
 void Server::cleanup() {
+   if (backend == ServerBackend::IO_URING) {
+      // Cancel everything and wait for the kernel to let go of our buffers
+      queue_ring_op(RingOp::CANCEL, 0)->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+      for (auto i = 0; i < 10 && ring_in_flight > 0; i++) {
+         if (!ring->submit_and_wait(std::chrono::milliseconds(100))) {
+            break;
+         }
+
+         ring->for_each_cqe([&](const struct io_uring_cqe& cqe) {
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+               ring->recycle_buffer(static_cast<unsigned short>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+               ring_in_flight--;
+            }
+         });
+      }
+
+      for (auto const& [id, c] : clients_by_id) {
+         close(c->getClientFD());
+      }
+
+      clients_by_id.clear();
+      frames_by_id.clear();
+      sends_by_id.clear();
+      scheduled_by_id.clear();
+      ring.reset();
+      ring_in_flight = 0;
+
+      close(tcp_fd);
+
+      client_id = 0;
+      tcp_fd = 0;
+
+      return;
+   }
+
    for (auto const& [a, c] : clients_by_fd) {
       if (!utils::remove_client_from_epoll(epoll_fd, c->getClientFD())) {
       }
@@ -213,8 +919,32 @@ void Server::cleanup() {
       close(c->getTimerFD());
    }
 
+   for (auto const& [id, channel] : channels_by_id) {
+      stats.estimated_syscalls += channel->doorbell_syscalls();
+   }
+
+   for (auto const& [fd, id] : scheduled_by_fd) {
+      if (!utils::remove_client_from_epoll(epoll_fd, fd)) {
+      }
+
+      close(fd);
+   }
+
+   clients_by_id.clear();
    clients_by_fd.clear();
    clients_by_timer_fd.clear();
+   clients_by_doorbell_fd.clear();
+   channels_by_id.clear();
+   frames_by_id.clear();
+   sends_by_id.clear();
+   scheduled_by_fd.clear();
+
+   for (auto const& [fd, id] : watched_by_fd) {
+      if (!utils::remove_client_from_epoll(epoll_fd, fd)) {
+      }
+   }
+
+   watched_by_fd.clear();
 
    if (!utils::remove_client_from_epoll(epoll_fd, tcp_fd)) {
    }
@@ -222,38 +952,345 @@ void Server::cleanup() {
    close(tcp_fd);
    close(epoll_fd);
 
+   if (!unix_path.empty()) {
+      unlink(unix_path.c_str());
+      unix_path.clear();
+   }
+
    client_id = 0;
    tcp_fd = 0;
    epoll_fd = 0;
 }
 
 void Server::handle_worker_action(const Client& client, WorkerAction action) {
-   size_t total_sent{};
-   auto message_size{action.message.size()};
+   std::vector<char> data{};
 
    switch (action.kind) {
       case WorkerActionKind::SEND_MESSAGE:
-         while (total_sent < message_size) {
-            auto write_ret = write(client.getClientFD(), &action.message[total_sent], (message_size - total_sent));
-            if (write_ret < 0) {
-               if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                  return;
-               }
+         stats.messages_sent++;
+         data = utils::frame(action.message);
 
-               remove_client(client);
-               callback({ClientEventKind::DISCONNECTED, client.getID()});
+         // Messages go out one after another, whole, so the client's frames stay in sync. Only
+         // one write per client is in flight with io_uring, with epoll the queue waits for room
+         // in the socket or the shared memory channel.
+         sends_by_id[client.getID()].push_back({std::move(data), 0});
+         if (sends_by_id[client.getID()].size() == 1) {
+            if (backend == ServerBackend::IO_URING) {
+               arm_send(client.getID());
+            } else {
+               flush_sends(client);
             }
-
-            total_sent += static_cast<size_t>(write_ret);
          }
 
          break;
       case WorkerActionKind::DISCONNECT:
          remove_client(client);
-         callback({ClientEventKind::DISCONNECTED, client.getID()});
+         deliver({ClientEventKind::DISCONNECTED, client.getID()});
          break;
 
       case WorkerActionKind::EXIT: stop(); break;
       case WorkerActionKind::NOOP: break;
    }
 }
+
+bool Server::flush_sends(const Client& client) {
+   auto sends = sends_by_id.find(client.getID());
+   if (sends == sends_by_id.end()) {
+      return true;
+   }
+
+   auto& queue = sends->second;
+   if (auto channel = channels_by_id.find(client.getID()); channel != channels_by_id.end()) {
+      while (!queue.empty()) {
+         auto& front = queue.front();
+         front.sent += channel->second->write(&front.data[front.sent], front.data.size() - front.sent);
+         if (front.sent == front.data.size()) {
+            queue.pop_front();
+            continue;
+         }
+
+         // The rest goes out once the client read enough and rang us
+         if (channel->second->arm_room()) {
+            return false;
+         }
+      }
+
+      sends_by_id.erase(sends);
+
+      return true;
+   }
+
+   while (!queue.empty()) {
+      auto& front = queue.front();
+      auto write_ret = ::send(client.getClientFD(), &front.data[front.sent], front.data.size() - front.sent, MSG_NOSIGNAL);
+      stats.estimated_syscalls++;
+      if (write_ret < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+
+         if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // The rest goes out once the peer read enough
+            if (!utils::modify_descriptor_in_epoll(epoll_fd, client.getClientFD(), EPOLLIN | EPOLLOUT | EPOLLET)) {
+               throw std::runtime_error("modify_descriptor_in_epoll on client_fd failed");
+            }
+            stats.estimated_syscalls++;
+
+            return false;
+         }
+
+         remove_client(client);
+         deliver({ClientEventKind::DISCONNECTED, client.getID()});
+         return false;
+      }
+
+      front.sent += static_cast<size_t>(write_ret);
+      if (front.sent == front.data.size()) {
+         queue.pop_front();
+      }
+   }
+
+   sends_by_id.erase(sends);
+
+   return true;
+}
+
+bool Server::start_uring() {
+   try {
+      ring = std::make_unique<IoUring>(URING_ENTRIES, URING_BUFFER_GROUP, URING_BUFFER_COUNT, URING_BUFFER_SIZE);
+   } catch (const std::runtime_error& e) {
+      std::cerr << "io_uring unavailable, falling back to epoll: " << e.what() << std::endl;
+      return false;
+   }
+
+   heartbeat_interval_ts.tv_sec = HEARTBEAT_INTERVAL.count();
+   heartbeat_interval_ts.tv_nsec = 0;
+   ring_in_flight = 0;
+
+   arm_accept();
+
+   return true;
+}
+
+bool Server::run_uring() {
+   while (running) {
+      stats.loop_iterations++;
+
+      // Everything queued by the previous iteration goes out in this one call
+      if (!ring->submit_and_wait(std::chrono::duration_cast<std::chrono::milliseconds>(EPOLL_TIMEOUT))) {
+         std::cerr << "io_uring_enter failed: " << errno << ' ' << std::string(std::strerror(errno)) << std::endl;
+         stats.estimated_syscalls += ring->enter_calls();
+         return false;
+      }
+
+      ring->for_each_cqe([this](const struct io_uring_cqe& cqe) { handle_completion(cqe); });
+   }
+
+   stats.estimated_syscalls += ring->enter_calls();
+
+   cleanup();
+
+   return true;
+}
+
+struct io_uring_sqe* Server::queue_ring_op(RingOp op, unsigned int id) {
+   auto sqe = ring->get_sqe();
+   sqe->user_data = (static_cast<uint64_t>(op) << 32) | id;
+   ring_in_flight++;
+
+   switch (op) {
+      case RingOp::CANCEL:
+         sqe->opcode = IORING_OP_ASYNC_CANCEL;
+         sqe->fd = -1;
+         break;
+      case RingOp::TIMEOUT:
+         sqe->opcode = IORING_OP_TIMEOUT;
+         sqe->fd = -1;
+         sqe->addr = reinterpret_cast<uint64_t>(clients_by_id[id]->isOutbound() ? &heartbeat_interval_ts : &timeouts_by_id[id]);
+         sqe->len = 1;
+         break;
+      case RingOp::TIMEOUT_UPDATE:
+         sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+         sqe->fd = -1;
+         sqe->addr = (static_cast<uint64_t>(RingOp::TIMEOUT) << 32) | id;
+         sqe->addr2 = reinterpret_cast<uint64_t>(&timeouts_by_id[id]);
+         sqe->timeout_flags = IORING_TIMEOUT_UPDATE;
+         break;
+      default: break;
+   }
+
+   return sqe;
+}
+
+void Server::arm_accept() {
+   auto sqe = queue_ring_op(RingOp::ACCEPT, 0);
+   sqe->opcode = IORING_OP_ACCEPT;
+   sqe->fd = tcp_fd;
+   sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+   sqe->accept_flags = SOCK_CLOEXEC;
+}
+
+void Server::arm_recv(unsigned int id) {
+   auto sqe = queue_ring_op(RingOp::RECV, id);
+   sqe->opcode = IORING_OP_RECV;
+   sqe->fd = clients_by_id[id]->getClientFD();
+   sqe->ioprio = IORING_RECV_MULTISHOT;
+   sqe->flags = IOSQE_BUFFER_SELECT;
+   sqe->buf_group = URING_BUFFER_GROUP;
+}
+
+void Server::arm_send(unsigned int id) {
+   auto& send = sends_by_id[id].front();
+
+   auto sqe = queue_ring_op(RingOp::SEND, id);
+   sqe->opcode = IORING_OP_SEND;
+   sqe->fd = clients_by_id[id]->getClientFD();
+   sqe->addr = reinterpret_cast<uint64_t>(send.data.data() + send.sent);
+   sqe->len = static_cast<uint32_t>(send.data.size() - send.sent);
+   sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+void Server::lose_client(Client client) {
+   remove_client(client);
+   handle_worker_action(client, deliver({ClientEventKind::DISCONNECTED, client.getID()}));
+}
+
+void Server::handle_completion(const struct io_uring_cqe& cqe) {
+   auto op = static_cast<RingOp>(cqe.user_data >> 32);
+   auto id = static_cast<unsigned int>(cqe.user_data & 0xffffffff);
+
+   if (!(cqe.flags & IORING_CQE_F_MORE)) {
+      ring_in_flight--;
+   }
+
+   // Completions may arrive after their client was removed
+   auto it = clients_by_id.find(id);
+   auto alive = it != clients_by_id.end();
+
+   switch (op) {
+      case RingOp::ACCEPT: {
+         if (!(cqe.flags & IORING_CQE_F_MORE) && running) {
+            arm_accept();
+         }
+
+         if (cqe.res < 0) {
+            std::cerr << "accept failed: " << std::string(std::strerror(-cqe.res)) << std::endl;
+            break;
+         }
+
+         // Peers of any family, like accept_clients
+         struct sockaddr_storage in_addr;
+         socklen_t in_len = sizeof(in_addr);
+         memset(&in_addr, 0, sizeof(in_addr));
+         getpeername(cqe.res, (struct sockaddr*) &in_addr, &in_len);
+         stats.estimated_syscalls++;
+
+         auto client = add_client(cqe.res, utils::peer_address_to_string(in_addr), utils::peer_port(in_addr));
+
+         handle_worker_action(*client, deliver({ClientEventKind::CONNECTED, client->getID()}));
+         break;
+      }
+      case RingOp::RECV: {
+         if (cqe.flags & IORING_CQE_F_BUFFER) {
+            auto buffer_id = static_cast<unsigned short>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            if (cqe.res > 0 && alive) {
+               frames_by_id[id].append(ring->buffer(buffer_id), static_cast<size_t>(cqe.res));
+            }
+
+            ring->recycle_buffer(buffer_id);
+         }
+
+         if (!alive) {
+            break;
+         }
+
+         auto c{*it->second};
+         if (cqe.res > 0) {
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+               arm_recv(id);
+            }
+
+            if (times_out(c)) {
+               heard_from(c);
+            }
+
+            auto messages{take_frames(id)};
+            if (!messages.has_value()) {
+               lose_client(c);
+               break;
+            }
+
+            dispatch_messages(c, std::move(*messages));
+         } else if (cqe.res == -ENOBUFS) {
+            // Ran out of provided buffers, try again once they are recycled
+            arm_recv(id);
+         } else if (cqe.res != -ECANCELED) {
+            // client disconnected or something went wrong
+            lose_client(c);
+         }
+
+         break;
+      }
+      case RingOp::SEND: {
+         auto sends = sends_by_id.find(id);
+         if (sends == sends_by_id.end() || sends->second.empty()) {
+            break;
+         }
+
+         if (!alive) {
+            sends_by_id.erase(sends);
+            break;
+         }
+
+         if (cqe.res < 0) {
+            lose_client(*it->second);
+            break;
+         }
+
+         auto& send = sends->second.front();
+         send.sent += static_cast<size_t>(cqe.res);
+         if (send.sent == send.data.size()) {
+            sends->second.pop_front();
+         }
+
+         if (!sends->second.empty()) {
+            arm_send(id);
+         }
+
+         break;
+      }
+      case RingOp::TIMEOUT: {
+         if (!alive || cqe.res != -ETIME) {
+            break;
+         }
+
+         auto c{*it->second};
+         if (c.isOutbound()) {
+            queue_ring_op(RingOp::TIMEOUT, id);
+            handle_worker_action(c, deliver({ClientEventKind::TIMER, id}));
+         } else if (suspected(c)) {
+            // evict client once it went silent for longer than its heartbeats suggest
+            lose_client(c);
+         }
+
+         break;
+      }
+      case RingOp::SCHEDULED: {
+         scheduled_by_id.erase(id);
+         if (cqe.res == -ETIME && running) {
+            fire(ClientEventKind::TIMER, id);
+         }
+
+         break;
+      }
+      case RingOp::WATCH: {
+         if (cqe.res >= 0 && running) {
+            fire(ClientEventKind::READABLE, id);
+         }
+
+         break;
+      }
+      case RingOp::TIMEOUT_UPDATE:
+      case RingOp::CANCEL: break;
+   }
+}
@@ -6,9 +6,15 @@
 #define EPOLL_WORK_QUEUE_SERVER_H
 
 #include "Client.h"
+#include "EventLog.h"
+#include "IoUring.h"
+#include "PhiAccrual.h"
+#include "ShmChannel.h"
 #include "utils.h"
 
+#include <algorithm>
 #include <chrono>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <memory>
@@ -16,37 +22,144 @@
 #include <string>
 #include <unordered_map>
 #include <arpa/inet.h>
+#include <poll.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 using Callback = std::function<WorkerAction(ClientEvent)>;
 
+// The I/O mechanism driving the server event loop
+enum class ServerBackend { EPOLL,
+                           IO_URING };
+
+// How the server tells that an accepted client is gone. With HEARTBEATS a client is dropped
+// once it stayed silent for long enough to be suspected of being gone, going by how regularly
+// its messages arrived so far, and for CLIENT_TIMEOUT at least, see PhiAccrual and
+// Server::set_suspicion_threshold.
+// With KEEPALIVE clients needn't send anything, the kernel probes idle TCP connections
+// and errors out those whose peer stopped acknowledging for CLIENT_TIMEOUT, see
+// utils::enable_keepalive. Peers on this host close their sockets when they die either way.
+enum class ServerLiveness { HEARTBEATS,
+                            KEEPALIVE };
+
+// Counters of the work done by the event loop, used to compare backends
+struct ServerStats {
+   // System calls issued by the event loop itself, as tallied where they are made. Helpers
+   // making several count as many as they make on the usual path, io_uring counts its
+   // enters, shared memory channels their doorbells. An estimate: `strace -c -f` counts them.
+   unsigned long estimated_syscalls;
+   // Iterations of the event loop
+   unsigned long loop_iterations;
+   // Messages handed to the callback
+   unsigned long messages_received;
+   // Messages written to clients
+   unsigned long messages_sent;
+   // Time spent in the callback, in total and at most at once. The event loop waits for it.
+   unsigned long callback_ns;
+   unsigned long longest_callback_ns;
+
+   friend std::ostream& operator<<(std::ostream& os, const ServerStats& s);
+};
+
 class Server {
    public:
-   Server(){};
-   Server(Callback callback);
+   static const constexpr double DEFAULT_SUSPICION_THRESHOLD = 8.0;
+
+   Server() : Server(Callback{}) {}
+   Server(Callback callback, ServerBackend backend = ServerBackend::EPOLL);
    ~Server();
 
+   Server(Server&&) = default;
+   Server& operator=(Server&&) = default;
+
    // Does the server event loop.
    // This call will terminate once stop() is called
    bool run();
-   // Marks the server as ready for run()
-   void start(std::string port);
+   // Marks the server as ready for run(), listening on a TCP port,
+   // "unix:<path>" or "shm:<path>" (see utils::AddressKind)
+   void start(std::string address);
    // Lets the server exit the run() loop
    void stop();
+   // Opens a connection to another server, after start(). The host may also
+   // be a "unix:<path>" or "shm:<path>" address, the port is ignored then. Its messages reach
+   // the callback like those of any client, plus a TIMER event every HEARTBEAT_INTERVAL.
+   // Returns the client ID of the connection.
+   unsigned int connect(const std::string& host, const std::string& port);
+   // Sends a message to any client, not just the one whose event is being handled
+   bool send(unsigned int client_id, std::vector<char> message);
+   // Drops a client, the callback gets its DISCONNECTED event as usual
+   bool disconnect(unsigned int client_id);
+   // Fires a single TIMER event after the delay. Returns the ID the event carries,
+   // which is drawn from the client IDs so it never names a client.
+   unsigned int schedule(std::chrono::seconds delay);
+   // Fires a single READABLE event once the descriptor becomes readable, e.g. a pidfd
+   // whose process exited. Returns the ID the event carries, like schedule().
+   // The descriptor stays owned by the caller.
+   unsigned int watch(int fd);
+   // Takes over a connected socket as if it had been accepted, e.g. one end of a
+   // socketpair handed to a child process. Returns its client ID. There is no
+   // CONNECTED event, the caller already knows.
+   unsigned int adopt(int fd);
+   // Writes every event handed to the callback, and every ID handed out, to a binary
+   // log at the path, see EventLog.h. Call before start(). Throws if it can't be created.
+   void record(const std::string& path);
+   // Replays a log written by record() instead of doing any I/O. run() hands the callback
+   // its events as fast as it takes them, and the calls the callback makes return what
+   // they returned when it was recorded. Call before start(). Throws if it can't be read.
+   void replay(const std::string& path);
+   // The time covered by the log being replayed
+   std::chrono::nanoseconds replayed_time() const noexcept;
+   // Picks how clients are kept track of, HEARTBEATS by default. Call before start().
+   void set_liveness(ServerLiveness mode);
+   // The phi at which a client that sends heartbeats is dropped, see PhiAccrual. Lower
+   // notices dead clients sooner, higher drops fewer live ones. Call before start().
+   void set_suspicion_threshold(double phi);
+   // The backend actually in use, after any fallback in start()
+   ServerBackend get_backend() const noexcept;
+   // Counters of the last run
+   const ServerStats& get_stats() const noexcept;
 
    private:
    static const constexpr auto EPOLL_MAX_EVENTS = 64;
    static const constexpr auto EPOLL_TIMEOUT = std::chrono::seconds(1);
+   // How long the peer of a TCP connection may stop acknowledging with KEEPALIVE, and how
+   // long a client may stay silent with HEARTBEATS at least, however steadily it sent before.
+   // A busy event loop iteration or a retransmit then doesn't get a client dropped.
    static const constexpr auto CLIENT_TIMEOUT = std::chrono::seconds(5);
+   static const constexpr auto HEARTBEAT_INTERVAL = std::chrono::seconds(1);
+   static const constexpr auto URING_ENTRIES = 256u;
+   static const constexpr auto URING_BUFFER_GROUP = static_cast<unsigned short>(0);
+   static const constexpr auto URING_BUFFER_COUNT = 256u;
+   static const constexpr auto URING_BUFFER_SIZE = 512u;
+
+   // The kinds of operation submitted to io_uring, stored in the upper
+   // half of the user data with the client ID in the lower half
+   enum class RingOp : uint64_t { ACCEPT,
+                                  RECV,
+                                  SEND,
+                                  TIMEOUT,
+                                  TIMEOUT_UPDATE,
+                                  SCHEDULED,
+                                  WATCH,
+                                  CANCEL };
+
+   // A message being written to a client, by io_uring or once its socket has room again
+   struct PendingSend {
+      std::vector<char> data;
+      size_t sent;
+   };
 
    // Are we running?
    bool running;
    // Sequence for client IDs
    unsigned int client_id;
-   // File descriptor of the TCP server socket
+   // File descriptor of the listening socket, TCP or Unix domain
    int tcp_fd;
+   // Path of the listening Unix domain socket, if any
+   std::string unix_path;
+   // Do accepted clients talk through shared memory channels?
+   bool shm;
    // File descriptor of the epoll queue
    int epoll_fd;
    // Mapping of client FDs to clients
@@ -55,17 +168,114 @@ class Server {
    std::unordered_map<int, std::shared_ptr<Client>> clients_by_timer_fd;
    // The callback
    Callback callback;
+   // The requested backend
+   ServerBackend backend;
+   // How accepted clients are kept track of
+   ServerLiveness liveness;
+   // The phi a silent client is dropped at, and how many standard deviations past its
+   // mean gap that is
+   double suspicion_threshold;
+   double suspicion_deviations;
+   // The gaps between messages of each client that times out
+   std::unordered_map<unsigned int, PhiAccrual> arrivals_by_id;
+   // When the timeout of each client that times out expires, when using io_uring
+   std::unordered_map<unsigned int, struct __kernel_timespec> timeouts_by_id;
+   // Counters of the event loop
+   ServerStats stats;
+   // The io_uring instance, when using that backend
+   std::unique_ptr<IoUring> ring;
+   // Mapping of client IDs to clients
+   std::unordered_map<unsigned int, std::shared_ptr<Client>> clients_by_id;
+   // Shared memory channels of clients, when listening on "shm:"
+   std::unordered_map<unsigned int, std::unique_ptr<ShmChannel>> channels_by_id;
+   // Mapping of channel doorbell FDs to clients
+   std::unordered_map<int, std::shared_ptr<Client>> clients_by_doorbell_fd;
+   // Partially received frames of each client
+   std::unordered_map<unsigned int, utils::FrameBuffer> frames_by_id;
+   // Messages queued for each client. With io_uring the front one is in flight, with epoll
+   // they wait for the client's socket to have room again, the front one partly written.
+   std::unordered_map<unsigned int, std::deque<PendingSend>> sends_by_id;
+   // Mapping of one-shot timer FDs to the ID of their event, when using epoll
+   std::unordered_map<int, unsigned int> scheduled_by_fd;
+   // Expiry of each pending one-shot timer, when using io_uring
+   std::unordered_map<unsigned int, struct __kernel_timespec> scheduled_by_id;
+   // Mapping of watched FDs to the ID of their event, when using epoll
+   std::unordered_map<int, unsigned int> watched_by_fd;
+   // Number of submitted io_uring operations that will still complete
+   unsigned long ring_in_flight;
+   // The log the callback's events are written to, when recording
+   std::unique_ptr<EventRecorder> recorder;
+   // The log being replayed, when replaying
+   std::unique_ptr<EventReplay> replay_log;
+   // Callbacks in progress, when replaying
+   unsigned int replay_depth;
 
    // Accept new client when ready
    std::vector<std::shared_ptr<Client>> accept_clients();
    // Remove existing client: close the socket, remove from epoll and maps
    void remove_client(Client client);
-   // Handle event arriving from the client
-   std::optional<std::vector<char>> read_from_client(const Client& client);
+   // Handle event arriving from the client, returns the complete messages
+   // or nothing if the client disconnected
+   std::optional<std::vector<std::vector<char>>> read_from_client(const Client& client);
+   // Drains the shared memory channel of the client, returns the complete messages
+   std::optional<std::vector<std::vector<char>>> read_from_channel(const Client& client);
+   // Starts delivering the messages of the client through the channel
+   void attach_channel(const Client& client, std::unique_ptr<ShmChannel> channel);
+   // Hands received messages to the callback, as long as the client stays connected
+   void dispatch_messages(const Client& client, std::vector<std::vector<char>> messages);
+   // Takes the complete messages received from the client so far,
+   // or nothing if the client broke the framing
+   std::optional<std::vector<std::vector<char>>> take_frames(unsigned int client_id);
    // Handle the response to a worker event
    void handle_worker_action(const Client& client, WorkerAction action);
+   // Writes the messages queued for the client while its socket or channel takes them,
+   // when using epoll. Returns true once all are written. A full one is watched for room.
+   bool flush_sends(const Client& client);
+   // Is the client dropped when it stays silent for too long?
+   bool times_out(const Client& client) const noexcept;
+   // Notes that a client that times out sent something and pushes its timeout back
+   void heard_from(const Client& client);
+   // How long after its last message a client is suspected, CLIENT_TIMEOUT at least
+   std::chrono::nanoseconds suspicion_timeout(const PhiAccrual& arrivals) const;
+   // Is a client whose timer expired gone? If not, its timer is armed again.
+   bool suspected(const Client& client);
+   // Hands an event to the callback, timing it
+   WorkerAction deliver(ClientEvent event);
+   // Hands a fired one-shot timer or watch to the callback
+   void fire(ClientEventKind kind, unsigned int id);
+   // Registers a connected client socket with the event loop
+   std::shared_ptr<Client> add_client(int fd, std::string address, unsigned short port);
    // Cleanup the clients and sockets
    void cleanup();
+   // Draws the ID of a new client, timer or watch
+   unsigned int next_id();
+
+   // The replay loop
+   bool run_replay();
+   // Hands a replayed event to the callback
+   void replay_event(ClientEvent event);
+   // Hands the callback the events recorded within the callback in progress, once it
+   // calls what caused them
+   void replay_nested();
+
+   // The epoll event loop
+   bool run_epoll();
+   // The io_uring event loop
+   bool run_uring();
+   // Set up io_uring, returns false if the kernel does not support it
+   bool start_uring();
+   // Queue an io_uring operation on behalf of the client
+   struct io_uring_sqe* queue_ring_op(RingOp op, unsigned int client_id);
+   // Handle a single io_uring completion
+   void handle_completion(const struct io_uring_cqe& cqe);
+   // Queue the multishot accept
+   void arm_accept();
+   // Queue the multishot receive for the client
+   void arm_recv(unsigned int client_id);
+   // Queue the write of the front message queued for the client
+   void arm_send(unsigned int client_id);
+   // Remove the client and let the callback know
+   void lose_client(Client client);
 };
 
 #endif //EPOLL_WORK_QUEUE_SERVER_H
@@ -0,0 +1,257 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "ShmChannel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+namespace {
+const constexpr char HANDSHAKE[] = "SHM";
+const constexpr auto HANDSHAKE_FDS = 5;
+
+static_assert((ShmChannel::RING_CAPACITY & (ShmChannel::RING_CAPACITY - 1)) == 0, "ring capacity must be a power of two");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring indices must be lock free to be shared between processes");
+}
+
+ShmChannel::ShmChannel() : end(End::SERVER), memfd(-1), server_doorbell(-1), client_doorbell(-1), server_room(-1), client_room(-1), shared(nullptr), syscalls(0) {
+   memfd = memfd_create("epoll-work-queue", MFD_CLOEXEC);
+   if (memfd == -1) {
+      throw std::runtime_error("memfd_create failed: " + std::string(std::strerror(errno)));
+   }
+
+   if (ftruncate(memfd, sizeof(Shared)) == -1) {
+      close(memfd);
+      throw std::runtime_error("ftruncate failed: " + std::string(std::strerror(errno)));
+   }
+
+   server_doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+   client_doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+   server_room = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+   client_room = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+   if (server_doorbell == -1 || client_doorbell == -1 || server_room == -1 || client_room == -1) {
+      close(memfd);
+      close(server_doorbell);
+      close(client_doorbell);
+      close(server_room);
+      close(client_room);
+      throw std::runtime_error("eventfd failed: " + std::string(std::strerror(errno)));
+   }
+
+   // A fresh memfd is zero filled, which is an empty ring with nobody waiting
+   map();
+}
+
+ShmChannel::ShmChannel(End end, int memfd, int server_doorbell, int client_doorbell, int server_room, int client_room)
+   : end(end), memfd(memfd), server_doorbell(server_doorbell), client_doorbell(client_doorbell), server_room(server_room), client_room(client_room), shared(nullptr), syscalls(0) {
+   map();
+}
+
+ShmChannel::~ShmChannel() {
+   if (shared) {
+      munmap(shared, sizeof(Shared));
+   }
+
+   close(memfd);
+   close(server_doorbell);
+   close(client_doorbell);
+   close(server_room);
+   close(client_room);
+}
+
+void ShmChannel::map() {
+   auto addr = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+   if (addr == MAP_FAILED) {
+      throw std::runtime_error("mmap of channel failed: " + std::string(std::strerror(errno)));
+   }
+
+   shared = static_cast<Shared*>(addr);
+}
+
+bool ShmChannel::send_handshake(int socket_fd) const {
+   int fds[HANDSHAKE_FDS] = {memfd, server_doorbell, client_doorbell, server_room, client_room};
+   char control[CMSG_SPACE(sizeof(fds))];
+   memset(control, 0, sizeof(control));
+
+   struct iovec iov;
+   iov.iov_base = const_cast<char*>(HANDSHAKE);
+   iov.iov_len = sizeof(HANDSHAKE);
+
+   struct msghdr msg;
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof(control);
+
+   auto cmsg = CMSG_FIRSTHDR(&msg);
+   cmsg->cmsg_level = SOL_SOCKET;
+   cmsg->cmsg_type = SCM_RIGHTS;
+   cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+   memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+   return sendmsg(socket_fd, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(HANDSHAKE));
+}
+
+std::unique_ptr<ShmChannel> ShmChannel::receive_handshake(int socket_fd) {
+   int fds[HANDSHAKE_FDS];
+   char control[CMSG_SPACE(sizeof(fds))];
+   char payload[sizeof(HANDSHAKE)];
+
+   struct iovec iov;
+   iov.iov_base = payload;
+   iov.iov_len = sizeof(payload);
+
+   struct msghdr msg;
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof(control);
+
+   if (recvmsg(socket_fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != static_cast<ssize_t>(sizeof(HANDSHAKE))) {
+      throw std::runtime_error("shared memory handshake failed");
+   }
+
+   auto cmsg = CMSG_FIRSTHDR(&msg);
+   if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)) || memcmp(payload, HANDSHAKE, sizeof(HANDSHAKE)) != 0) {
+      throw std::runtime_error("shared memory handshake carried no channel");
+   }
+
+   memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+   return std::unique_ptr<ShmChannel>(new ShmChannel(End::CLIENT, fds[0], fds[1], fds[2], fds[3], fds[4]));
+}
+
+ShmChannel::Ring& ShmChannel::incoming() const noexcept {
+   return end == End::SERVER ? shared->to_server : shared->to_client;
+}
+
+ShmChannel::Ring& ShmChannel::outgoing() const noexcept {
+   return end == End::SERVER ? shared->to_client : shared->to_server;
+}
+
+int ShmChannel::outgoing_doorbell() const noexcept {
+   return end == End::SERVER ? client_doorbell : server_doorbell;
+}
+
+int ShmChannel::doorbell_fd() const noexcept {
+   return end == End::SERVER ? server_doorbell : client_doorbell;
+}
+
+int ShmChannel::incoming_room() const noexcept {
+   return end == End::SERVER ? client_room : server_room;
+}
+
+int ShmChannel::room_fd() const noexcept {
+   return end == End::SERVER ? server_room : client_room;
+}
+
+std::size_t ShmChannel::write(const char* data, std::size_t size) {
+   auto& ring = outgoing();
+   auto head = ring.head.load(std::memory_order_acquire);
+   auto tail = ring.tail.load(std::memory_order_relaxed);
+
+   size = std::min<std::size_t>(size, RING_CAPACITY - (tail - head));
+   if (size == 0) {
+      return 0;
+   }
+
+   // Copy in at most two pieces, around the end of the ring
+   auto offset = tail & (RING_CAPACITY - 1);
+   auto first = std::min(size, RING_CAPACITY - offset);
+   memcpy(ring.data + offset, data, first);
+   memcpy(ring.data, data + first, size - first);
+
+   ring.tail.store(tail + size, std::memory_order_seq_cst);
+
+   // Pairs with the store in arm(): either the reader sees our data,
+   // or we see that it is waiting and wake it
+   if (ring.reader_waiting.exchange(0, std::memory_order_seq_cst)) {
+      ring_bell(outgoing_doorbell());
+   }
+
+   return size;
+}
+
+std::size_t ShmChannel::read(utils::FrameBuffer& frames) {
+   auto& ring = incoming();
+   auto head = ring.head.load(std::memory_order_relaxed);
+   auto tail = ring.tail.load(std::memory_order_acquire);
+   auto size = tail - head;
+
+   if (size == 0) {
+      return 0;
+   }
+
+   auto offset = head & (RING_CAPACITY - 1);
+   auto first = std::min<uint64_t>(size, RING_CAPACITY - offset);
+   frames.append(ring.data + offset, first);
+   frames.append(ring.data, size - first);
+
+   ring.head.store(tail, std::memory_order_seq_cst);
+
+   // Pairs with the store in arm_room(), like write() with arm()
+   if (ring.writer_waiting.exchange(0, std::memory_order_seq_cst)) {
+      ring_bell(incoming_room());
+   }
+
+   return size;
+}
+
+bool ShmChannel::arm() {
+   auto& ring = incoming();
+   ring.reader_waiting.store(1, std::memory_order_seq_cst);
+
+   if (ring.tail.load(std::memory_order_seq_cst) != ring.head.load(std::memory_order_relaxed)) {
+      ring.reader_waiting.store(0, std::memory_order_relaxed);
+      return false;
+   }
+
+   return true;
+}
+
+void ShmChannel::acknowledge() {
+   clear_bell(doorbell_fd());
+}
+
+bool ShmChannel::arm_room() {
+   auto& ring = outgoing();
+   ring.writer_waiting.store(1, std::memory_order_seq_cst);
+
+   if (ring.tail.load(std::memory_order_relaxed) - ring.head.load(std::memory_order_seq_cst) < RING_CAPACITY) {
+      ring.writer_waiting.store(0, std::memory_order_relaxed);
+      return false;
+   }
+
+   return true;
+}
+
+void ShmChannel::acknowledge_room() {
+   clear_bell(room_fd());
+}
+
+void ShmChannel::ring_bell(int fd) {
+   uint64_t one = 1;
+   syscalls++;
+   if (::write(fd, &one, sizeof(one)) != sizeof(one)) {
+      // the counter is full, the doorbell was rung
+   }
+}
+
+void ShmChannel::clear_bell(int fd) {
+   uint64_t value;
+   syscalls++;
+   if (::read(fd, &value, sizeof(value)) != sizeof(value)) {
+      // nothing to clear, the doorbell wasn't rung
+   }
+}
+
+unsigned long ShmChannel::doorbell_syscalls() const noexcept {
+   return syscalls;
+}
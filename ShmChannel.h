@@ -0,0 +1,106 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_SHM_CHANNEL_H
+#define EPOLL_WORK_QUEUE_SHM_CHANNEL_H
+
+#include "utils.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// A pair of single producer, single consumer byte rings in a memfd shared by
+// the coordinator and a co-located worker, one ring per direction.
+// Frames are written into the rings exactly as they would be onto a socket,
+// in pieces if they don't fit, the reader reassembles them like a socket's.
+// Each direction has an eventfd doorbell, rung only when the reader announced
+// it is about to sleep, so a busy reader never costs the writer a syscall.
+// Likewise each has a room doorbell, rung when the writer waits for the
+// reader to make room, so one end may receive while another thread sends.
+class ShmChannel {
+   public:
+   // Which side of the channel we are: the server reads what the client writes and vice versa
+   enum class End { SERVER,
+                    CLIENT };
+
+   static const constexpr std::size_t RING_CAPACITY = 256 * 1024;
+
+   // Creates a fresh channel, owned by the server
+   ShmChannel();
+   ~ShmChannel();
+
+   ShmChannel(const ShmChannel&) = delete;
+   ShmChannel& operator=(const ShmChannel&) = delete;
+
+   // Passes the memfd and doorbells to the client over a Unix domain socket
+   bool send_handshake(int socket_fd) const;
+   // Attaches to the channel the server passed over a Unix domain socket
+   static std::unique_ptr<ShmChannel> receive_handshake(int socket_fd);
+
+   // Appends as much of the bytes to our outgoing ring as fits, returns how many
+   std::size_t write(const char* data, std::size_t size);
+   // Moves everything in our incoming ring to the frame buffer, returns the byte count
+   std::size_t read(utils::FrameBuffer& frames);
+   // Announces we are about to wait on our doorbell. Returns false if data
+   // arrived meanwhile, in which case we must read instead of waiting.
+   bool arm();
+   // The doorbell rung when our incoming ring has data
+   int doorbell_fd() const noexcept;
+   // Clears our doorbell after it was rung
+   void acknowledge();
+   // Announces we are about to wait for room in our outgoing ring. Returns false
+   // if the reader made room meanwhile, in which case we must write instead.
+   bool arm_room();
+   // The doorbell rung when the reader made room in our outgoing ring
+   int room_fd() const noexcept;
+   // Clears our room doorbell after it was rung
+   void acknowledge_room();
+   // System calls spent on doorbells so far
+   unsigned long doorbell_syscalls() const noexcept;
+
+   private:
+   struct alignas(64) Ring {
+      alignas(64) std::atomic<uint64_t> head;
+      alignas(64) std::atomic<uint64_t> tail;
+      alignas(64) std::atomic<uint32_t> reader_waiting;
+      alignas(64) std::atomic<uint32_t> writer_waiting;
+      alignas(64) char data[RING_CAPACITY];
+   };
+
+   struct Shared {
+      // Written by the client, read by the server
+      Ring to_server;
+      // Written by the server, read by the client
+      Ring to_client;
+   };
+
+   ShmChannel(End end, int memfd, int server_doorbell, int client_doorbell, int server_room, int client_room);
+
+   End end;
+   int memfd;
+   // Rung when to_server has data
+   int server_doorbell;
+   // Rung when to_client has data
+   int client_doorbell;
+   // Rung when to_client has room
+   int server_room;
+   // Rung when to_server has room
+   int client_room;
+   Shared* shared;
+   unsigned long syscalls;
+
+   Ring& incoming() const noexcept;
+   Ring& outgoing() const noexcept;
+   int outgoing_doorbell() const noexcept;
+   int incoming_room() const noexcept;
+   // Rings a doorbell, unless it is rung already
+   void ring_bell(int fd);
+   // Clears a doorbell, unless it wasn't rung
+   void clear_bell(int fd);
+   void map();
+};
+
+#endif //EPOLL_WORK_QUEUE_SHM_CHANNEL_H
@@ -0,0 +1,92 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "TaskTable.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+TaskId TaskTable::add(std::string_view url) {
+   if (entries.size() >= std::numeric_limits<TaskId>::max()) {
+      throw std::runtime_error("too many tasks");
+   }
+
+   arena.append(url);
+   ends.push_back(arena.size());
+   entries.push_back({TaskState::PENDING, 0});
+
+   return static_cast<TaskId>(entries.size() - 1);
+}
+
+std::string_view TaskTable::url(TaskId id) const noexcept {
+   auto start = id == 0 ? 0 : ends[id - 1];
+   return std::string_view(arena).substr(start, ends[id] - start);
+}
+
+std::size_t TaskTable::size() const noexcept {
+   return entries.size();
+}
+
+TaskState TaskTable::state(TaskId id) const noexcept {
+   return entries[id].state;
+}
+
+void TaskTable::set_state(TaskId id, TaskState state) noexcept {
+   entries[id].state = state;
+}
+
+unsigned int TaskTable::attempts(TaskId id) const noexcept {
+   return entries[id].attempts;
+}
+
+unsigned int TaskTable::add_attempt(TaskId id) noexcept {
+   auto& attempts = entries[id].attempts;
+   if (attempts < std::numeric_limits<uint8_t>::max()) {
+      attempts++;
+   }
+
+   return attempts;
+}
+
+void TaskTable::clear_attempts(TaskId id) noexcept {
+   entries[id].attempts = 0;
+}
+
+std::size_t TaskTable::count(TaskState state) const noexcept {
+   return static_cast<std::size_t>(std::count_if(entries.begin(), entries.end(), [&](const Entry& e) { return e.state == state; }));
+}
+
+bool TaskQueue::empty() const noexcept {
+   return length == 0;
+}
+
+std::size_t TaskQueue::size() const noexcept {
+   return length;
+}
+
+TaskId TaskQueue::front() const noexcept {
+   return ring[head];
+}
+
+void TaskQueue::push_back(TaskId id) {
+   if (length == ring.size()) {
+      // Unroll the ring into the front of a twice as large one
+      std::vector<TaskId> grown(ring.size() * 2);
+      for (std::size_t i = 0; i < length; i++) {
+         grown[i] = ring[(head + i) & (ring.size() - 1)];
+      }
+
+      ring = std::move(grown);
+      head = 0;
+   }
+
+   ring[(head + length) & (ring.size() - 1)] = id;
+   length++;
+}
+
+void TaskQueue::pop_front() noexcept {
+   head = (head + 1) & (ring.size() - 1);
+   length--;
+}
@@ -0,0 +1,80 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_TASK_TABLE_H
+#define EPOLL_WORK_QUEUE_TASK_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Tasks are referred to by their index in the TaskTable
+using TaskId = uint32_t;
+
+// Where a task is in its life
+enum class TaskState : uint8_t { PENDING,
+                                 ASSIGNED,
+                                 RETRYING,
+                                 DONE,
+                                 FAILED };
+
+// Every work item of the job, stored once. The URLs live back to back in one
+// arena and their state in a packed vector, everything else refers to them by ID.
+class TaskTable {
+   public:
+   TaskTable() : arena{}, ends{}, entries{} {}
+
+   // Adds a PENDING task, throws once there are more than TaskId can tell apart
+   TaskId add(std::string_view url);
+   // Only valid until the next add()
+   std::string_view url(TaskId id) const noexcept;
+   std::size_t size() const noexcept;
+
+   TaskState state(TaskId id) const noexcept;
+   void set_state(TaskId id, TaskState state) noexcept;
+   // How often workers failed on the task
+   unsigned int attempts(TaskId id) const noexcept;
+   // Counts another failure, returns the new count
+   unsigned int add_attempt(TaskId id) noexcept;
+   void clear_attempts(TaskId id) noexcept;
+   // The number of tasks in the state
+   std::size_t count(TaskState state) const noexcept;
+
+   private:
+   // 2 bytes per task, attempts saturate
+   struct Entry {
+      TaskState state;
+      uint8_t attempts;
+   };
+
+   // All URLs, without separators
+   std::string arena;
+   // End of each URL in the arena, the start is the end of the previous one
+   std::vector<std::size_t> ends;
+   std::vector<Entry> entries;
+};
+
+// A FIFO of task IDs in a ring buffer that doubles when full
+class TaskQueue {
+   public:
+   TaskQueue() : ring(INITIAL_CAPACITY), head(0), length(0) {}
+
+   bool empty() const noexcept;
+   std::size_t size() const noexcept;
+   TaskId front() const noexcept;
+   void push_back(TaskId id);
+   void pop_front() noexcept;
+
+   private:
+   static const constexpr std::size_t INITIAL_CAPACITY = 64;
+
+   // Capacity is a power of two, so positions wrap with a mask
+   std::vector<TaskId> ring;
+   std::size_t head;
+   std::size_t length;
+};
+
+#endif //EPOLL_WORK_QUEUE_TASK_TABLE_H
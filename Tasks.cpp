@@ -0,0 +1,43 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "Tasks.h"
+
+namespace tasks {
+bool count_only(utils::TaskKind kind) {
+   return Tasks::dispatch(kind, []<Task T>(T) { return T::COUNT_ONLY; });
+}
+
+bool resumable(utils::TaskKind kind) {
+   return Tasks::dispatch(kind, []<Task T>(T) { return Resumable<T>; });
+}
+
+AnyResult::AnyResult(utils::TaskKind kind) : task(kind), value{} {
+   Tasks::dispatch(kind, [&]<Task T>(T) { value.emplace<Tasks::index_of<T>()>(); });
+}
+
+bool AnyResult::merge(std::size_t count, std::string_view serialized) {
+   return Tasks::dispatch(task, [&]<Task T>(T) {
+      auto parsed{T::parse(count, serialized)};
+      if (!parsed.has_value()) {
+         return false;
+      }
+
+      T::merge(std::get<Tasks::index_of<T>()>(value), std::move(*parsed));
+      return true;
+   });
+}
+
+std::size_t AnyResult::count() const {
+   return Tasks::dispatch(task, [&]<Task T>(T) -> std::size_t { return T::count(std::get<Tasks::index_of<T>()>(value)); });
+}
+
+std::string AnyResult::serialize() const {
+   return Tasks::dispatch(task, [&]<Task T>(T) { return T::serialize(std::get<Tasks::index_of<T>()>(value)); });
+}
+
+void AnyResult::print(std::ostream& out, std::size_t limit) const {
+   Tasks::dispatch(task, [&]<Task T>(T) { T::print(std::get<Tasks::index_of<T>()>(value), out, limit); });
+}
+}
@@ -0,0 +1,366 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_TASKS_H
+#define EPOLL_WORK_QUEUE_TASKS_H
+
+#include "HeavyHitters.h"
+#include "KeySpill.h"
+#include "PublicSuffix.h"
+#include "utils.h"
+
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// What workers compute from the URL column of the rows of their chunks, and how the
+// results of chunks come together. A task maps each column to a key and adds it to the
+// state of its chunk, combining what was added after each piece of the chunk. A finished
+// chunk's state is reduced into a result, and results merge: on the worker over the
+// chunks of a message, on relays and on the coordinator over those of a job. Results
+// travel as their count, in the header of a RESULT message, and whatever else they hold,
+// serialized on the lines after it.
+//
+// Tasks are registered in Registry below. Workers dispatch on the task kind of a message
+// once, everything per row is compiled for the task at hand. Adding a task takes a
+// utils::TaskKind with a name, a type modelling Task and a place in the registry.
+namespace tasks {
+// Where a key that isn't part of the column is put together, no key is longer
+using KeyBuffer = std::array<char, 256>;
+
+template <typename T>
+concept Task = requires(typename T::State& state, typename T::Result& result, std::string_view text, KeyBuffer& buffer, std::ostream& out) {
+   { T::KIND } -> std::convertible_to<utils::TaskKind>;
+   // Results are nothing but their count: they are cached, and cheap enough to merge on the event loop
+   { T::COUNT_ONLY } -> std::convertible_to<bool>;
+   { T::key(text, buffer) } -> std::same_as<std::string_view>;
+   T::map(state, text);
+   T::combine(state);
+   // Adds the state of another part of the same chunk
+   T::absorb(state, std::move(state));
+   T::reduce(std::move(state), result);
+   T::merge(result, std::move(result));
+   { T::count(std::as_const(result)) } -> std::convertible_to<std::size_t>;
+   { T::serialize(std::as_const(result)) } -> std::same_as<std::string>;
+   // Nothing if the serialized result is malformed
+   { T::parse(std::size_t{}, text) } -> std::same_as<std::optional<typename T::Result>>;
+   // The count, and what else there is to tell about the result up to the limit, on lines of their own
+   T::print(std::as_const(result), out, std::size_t{});
+};
+
+// A task whose chunks can be handed to another worker half done, from a checkpoint with
+// the hashes of the keys seen so far. The count of its finished chunks is all of their result.
+// The rows of a chunk can also be shared between workers, the leader counting the hashes
+// of the keys of all of their ranges.
+template <typename T>
+concept Resumable = Task<T> && T::COUNT_ONLY && requires(typename T::State& state, const utils::Checkpoint& checkpoint) {
+   T::resume(state, checkpoint);
+   // From then on, keeps the hashes of the keys first seen for take_new_keys
+   T::track_new_keys(state);
+   // The hashes of the keys first seen since the previous call, or since tracking started
+   { T::take_new_keys(state) } -> std::same_as<std::vector<uint64_t>>;
+   // The hashes of every key seen, once combined
+   { T::keys(std::as_const(state)) } -> std::same_as<std::vector<uint64_t>>;
+};
+
+// A task whose states split into parts by key, parts that reduce to results which merge
+// into that of the whole state. The parts of a chunk can then be absorbed on threads of their own.
+template <typename T>
+concept Partitioned = Task<T> && requires(typename T::State& state, std::size_t parts) {
+   { T::split(std::move(state), parts) } -> std::same_as<std::vector<typename T::State>>;
+};
+
+// The host of a URL column is the part before the first '/'
+inline std::string_view host_key(std::string_view url) noexcept {
+   return url.substr(0, url.find('/'));
+}
+
+// Keys are kept as stable hashes, so those seen so far can be handed to another worker.
+// Under a memory budget they are spilled once there are more than it allows.
+struct DistinctState {
+   std::unordered_set<uint64_t> seen{};
+   // Seen before those in memory, see KeySpill
+   KeySpill spilled{};
+   // Mapped since the last combine
+   std::vector<uint64_t> found{};
+   // Seen since they were last taken, only kept once tracked
+   std::vector<uint64_t> fresh{};
+   bool tracking = false;
+};
+
+// Moves the keys in memory to disk when there are too many, freeing their set
+inline void spill_over_budget(DistinctState& state) {
+   if (state.seen.size() > key_spill::resident_limit()) {
+      state.spilled.write(state.seen);
+      state.seen = {};
+   }
+}
+
+// The distinct hosts or registrable domains of each chunk, added up over the chunks.
+// Only chunks that share no domains add up to the distinct domains of all of them.
+// Keys that come back once spilled are new as far as take_new_keys() is concerned.
+template <utils::TaskKind Kind>
+struct Distinct {
+   static const constexpr utils::TaskKind KIND = Kind;
+   static const constexpr bool COUNT_ONLY = true;
+   using State = DistinctState;
+   using Result = uint64_t;
+
+   static std::string_view key(std::string_view url, KeyBuffer& buffer) noexcept {
+      if constexpr (Kind == utils::TaskKind::DISTINCT_REGISTRABLE_DOMAINS) {
+         return public_suffix::registrable_domain(public_suffix::normalize_host(url, buffer));
+      } else {
+         return host_key(url);
+      }
+   }
+
+   static void map(State& state, std::string_view key) {
+      state.found.push_back(utils::stable_hash(key));
+   }
+
+   static void combine(State& state) {
+      for (auto hash : state.found) {
+         if (state.seen.insert(hash).second && state.tracking) {
+            state.fresh.push_back(hash);
+         }
+      }
+      state.found.clear();
+      spill_over_budget(state);
+   }
+
+   static void absorb(State& state, State&& other) {
+      auto add = [&](auto const& hashes) {
+         for (auto hash : hashes) {
+            if (state.seen.insert(hash).second && state.tracking) {
+               state.fresh.push_back(hash);
+            }
+         }
+      };
+      add(other.seen);
+      add(other.found);
+      state.spilled.append(other.spilled);
+      spill_over_budget(state);
+   }
+
+   static void reduce(State&& state, Result& result) {
+      combine(state);
+      if (state.spilled.empty()) {
+         result += state.seen.size();
+         return;
+      }
+
+      state.spilled.for_each_partition(state.seen, [&](auto const& hashes) { result += hashes.size(); });
+   }
+
+   static void merge(Result& result, Result&& other) noexcept {
+      result += other;
+   }
+
+   static std::size_t count(const Result& result) noexcept {
+      return static_cast<std::size_t>(result);
+   }
+
+   static std::string serialize(const Result&) {
+      return {};
+   }
+
+   static std::optional<Result> parse(std::size_t count, std::string_view text) {
+      if (!text.empty()) {
+         return {};
+      }
+
+      return count;
+   }
+
+   static void print(const Result& result, std::ostream& out, std::size_t) {
+      out << result << '\n';
+   }
+
+   // Hashes are told apart by their upper half, the lower one picks their bucket in the sets.
+   // The parts are left to be combined by whoever absorbs them. Spilled keys are read back
+   // into the parts, so states are only split without a memory budget.
+   static std::vector<State> split(State&& state, std::size_t parts) {
+      std::vector<State> split_state(parts);
+      auto add = [&](auto const& hashes) {
+         for (auto hash : hashes) {
+            split_state[static_cast<std::size_t>(hash >> 32) % parts].found.push_back(hash);
+         }
+      };
+      add(state.found);
+      if (state.spilled.empty()) {
+         add(state.seen);
+      } else {
+         state.spilled.for_each_partition(state.seen, add);
+      }
+
+      return split_state;
+   }
+
+   static void resume(State& state, const utils::Checkpoint& checkpoint) {
+      state.seen.insert(checkpoint.domains.begin(), checkpoint.domains.end());
+      spill_over_budget(state);
+   }
+
+   static void track_new_keys(State& state) noexcept {
+      state.tracking = true;
+   }
+
+   static std::vector<uint64_t> take_new_keys(State& state) {
+      return std::exchange(state.fresh, {});
+   }
+
+   // Spilled keys included, they all go to the leader at once anyway
+   static std::vector<uint64_t> keys(const State& state) {
+      if (state.spilled.empty()) {
+         return {state.seen.begin(), state.seen.end()};
+      }
+
+      std::vector<uint64_t> all{};
+      state.spilled.for_each_partition(state.seen, [&](auto const& hashes) { all.insert(all.end(), hashes.begin(), hashes.end()); });
+      return all;
+   }
+};
+
+using DistinctHosts = Distinct<utils::TaskKind::DISTINCT_HOSTS>;
+using DistinctRegistrableDomains = Distinct<utils::TaskKind::DISTINCT_REGISTRABLE_DOMAINS>;
+
+// The most frequent hosts of the chunks, summarized (see HeavyHitters), with the number of rows.
+// A summary can't be handed over half done, so chunks start over on another worker.
+struct TopDomains {
+   static const constexpr utils::TaskKind KIND = utils::TaskKind::TOP_DOMAINS;
+   static const constexpr bool COUNT_ONLY = false;
+
+   struct State {
+      HeavyHitters summary{};
+      uint64_t rows = 0;
+   };
+
+   struct Result {
+      uint64_t rows = 0;
+      HeavyHitters summary{};
+   };
+
+   static std::string_view key(std::string_view url, KeyBuffer&) noexcept {
+      return host_key(url);
+   }
+
+   static void map(State& state, std::string_view key) {
+      state.summary.add(key);
+      state.rows++;
+   }
+
+   static void combine(State&) noexcept {}
+
+   static void absorb(State& state, State&& other) {
+      state.summary.merge(other.summary);
+      state.rows += other.rows;
+   }
+
+   static void reduce(State&& state, Result& result) {
+      result.summary.merge(state.summary);
+      result.rows += state.rows;
+   }
+
+   static void merge(Result& result, Result&& other) {
+      result.summary.merge(other.summary);
+      result.rows += other.rows;
+   }
+
+   static std::size_t count(const Result& result) noexcept {
+      return static_cast<std::size_t>(result.rows);
+   }
+
+   static std::string serialize(const Result& result) {
+      return result.summary.serialize();
+   }
+
+   static std::optional<Result> parse(std::size_t count, std::string_view text) {
+      auto summary{HeavyHitters::parse(text)};
+      if (!summary.has_value()) {
+         return {};
+      }
+
+      return Result{count, std::move(*summary)};
+   }
+
+   static void print(const Result& result, std::ostream& out, std::size_t limit) {
+      out << result.rows << '\n';
+      result.summary.print(out, limit);
+   }
+};
+
+// The tasks there are, dispatched on at compile time
+template <Task... Ts>
+class Registry {
+   public:
+   // A result of any of the tasks, by the position of its task
+   using Results = std::variant<typename Ts::Result...>;
+
+   // Calls f with the task of the kind, f(T{}), and returns what it returns
+   template <typename F>
+   static decltype(auto) dispatch(utils::TaskKind kind, F&& f) {
+      return dispatch_from<Ts...>(kind, f);
+   }
+
+   template <Task T>
+   static constexpr std::size_t index_of() noexcept {
+      std::size_t index = 0;
+      ((std::is_same_v<T, Ts> ? false : (++index, true)) && ...);
+      return index;
+   }
+
+   private:
+   // Every kind is registered, so the last task is the only one left for its kind
+   template <Task T, Task... Rest, typename F>
+   static decltype(auto) dispatch_from(utils::TaskKind kind, F& f) {
+      if constexpr (sizeof...(Rest) == 0) {
+         return f(T{});
+      } else {
+         if (kind == T::KIND) {
+            return f(T{});
+         }
+
+         return dispatch_from<Rest...>(kind, f);
+      }
+   }
+};
+
+using Tasks = Registry<DistinctHosts, DistinctRegistrableDomains, TopDomains>;
+
+bool count_only(utils::TaskKind kind);
+bool resumable(utils::TaskKind kind);
+
+// The result of a task only known at run time, for the coordinator and clients.
+// It starts out as the result of no chunks at all.
+class AnyResult {
+   public:
+   explicit AnyResult(utils::TaskKind kind = utils::TaskKind::DISTINCT_HOSTS);
+
+   utils::TaskKind kind() const noexcept {
+      return task;
+   }
+
+   // Merges in a result as it travels, returns false if it is malformed
+   bool merge(std::size_t count, std::string_view serialized);
+   std::size_t count() const;
+   std::string serialize() const;
+   void print(std::ostream& out, std::size_t limit) const;
+
+   private:
+   utils::TaskKind task;
+   Tasks::Results value;
+};
+}
+
+#endif //EPOLL_WORK_QUEUE_TASKS_H
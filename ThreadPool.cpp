@@ -0,0 +1,52 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(std::size_t threads) : threads{}, tasks{}, mutex{}, wakeup{}, stopping(false) {
+   for (std::size_t i = 0; i < std::max(threads, std::size_t{1}); i++) {
+      this->threads.emplace_back([this] { run(); });
+   }
+}
+
+ThreadPool::~ThreadPool() {
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+      stopping = true;
+   }
+
+   wakeup.notify_all();
+   for (auto& thread : threads) {
+      thread.join();
+   }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+      tasks.push_back(std::move(task));
+   }
+
+   wakeup.notify_one();
+}
+
+void ThreadPool::run() {
+   while (true) {
+      std::function<void()> task;
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         wakeup.wait(lock, [this] { return stopping || !tasks.empty(); });
+         if (tasks.empty()) {
+            return;
+         }
+
+         task = std::move(tasks.front());
+         tasks.pop_front();
+      }
+
+      task();
+   }
+}
@@ -0,0 +1,43 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_THREAD_POOL_H
+#define EPOLL_WORK_QUEUE_THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed number of threads running queued tasks in FIFO order.
+// The destructor finishes the queued tasks before joining the threads.
+class ThreadPool {
+   public:
+   ThreadPool(std::size_t threads);
+   ~ThreadPool();
+
+   ThreadPool(const ThreadPool&) = delete;
+   ThreadPool& operator=(const ThreadPool&) = delete;
+
+   // Queues the task to run on one of the threads
+   void submit(std::function<void()> task);
+
+   std::size_t size() const noexcept {
+      return threads.size();
+   }
+
+   private:
+   std::vector<std::thread> threads;
+   std::deque<std::function<void()>> tasks;
+   std::mutex mutex;
+   std::condition_variable wakeup;
+   bool stopping;
+
+   void run();
+};
+
+#endif //EPOLL_WORK_QUEUE_THREAD_POOL_H
@@ -0,0 +1,178 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "Tracer.h"
+
+#include <fstream>
+#include <iomanip>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+// All events belong to the coordinator, each worker gets its own track in it
+const constexpr auto PID = 1;
+
+std::string escape_json(std::string_view s) {
+   std::ostringstream out;
+   for (auto c : s) {
+      if (c == '"' || c == '\\') {
+         out << '\\' << c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+         out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+      } else {
+         out << c;
+      }
+   }
+
+   return out.str();
+}
+
+// Chrome traces count in microseconds
+std::string micros(uint64_t ns) {
+   std::ostringstream out;
+   out << ns / 1000 << '.' << std::setw(3) << std::setfill('0') << ns % 1000;
+   return out.str();
+}
+}
+
+Tracer::Tracer(std::size_t capacity)
+   : events(capacity),
+     next(0),
+     wrapped(false),
+     start(std::chrono::steady_clock::now()) {
+}
+
+void Tracer::push(TraceEventKind kind, unsigned int worker_id, TaskId task, utils::Timings timings) {
+   auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+   events[next] = {static_cast<uint64_t>(now.count()), timings.fetch_ns, timings.parse_ns, timings.dedup_ns, task, worker_id, kind};
+   if (++next == events.size()) {
+      next = 0;
+      wrapped = true;
+   }
+}
+
+void Tracer::save(const std::string& path, const TaskTable& tasks) const {
+   std::ofstream out{path};
+   if (!out) {
+      throw std::runtime_error("can't write trace to " + path);
+   }
+
+   // Work handed to a worker and not yet returned
+   struct Running {
+      uint64_t since_ns;
+      std::vector<TaskId> tasks;
+   };
+
+   std::unordered_map<TaskId, uint64_t> queued_since{};
+   std::unordered_map<unsigned int, Running> running{};
+   std::set<unsigned int> tracks{};
+   auto separator = "\n";
+
+   auto emit = [&](const std::string& event) {
+      out << separator << event;
+      separator = ",\n";
+   };
+
+   // The span of a worker's work, ending now
+   auto finish_work = [&](const Event& e, const char* name, std::optional<utils::Timings> timings) {
+      auto work = running.find(e.worker_id);
+      if (work == running.end()) {
+         return;
+      }
+
+      auto const& [since_ns, work_tasks] = work->second;
+      std::ostringstream args;
+      args << "\"items\":" << work_tasks.size() << ",\"first\":\"" << escape_json(tasks.url(work_tasks.front())) << '"';
+      if (timings.has_value()) {
+         // Whatever the worker didn't account for went to dispatch and returning the result
+         auto total_ns = e.timestamp_ns - since_ns;
+         auto worker_ns = timings->fetch_ns + timings->parse_ns + timings->dedup_ns;
+         args << ",\"fetch_us\":" << micros(timings->fetch_ns)
+              << ",\"parse_us\":" << micros(timings->parse_ns)
+              << ",\"dedup_us\":" << micros(timings->dedup_ns)
+              << ",\"transport_us\":" << micros(total_ns > worker_ns ? total_ns - worker_ns : 0);
+      }
+
+      std::ostringstream event;
+      event << "{\"name\":\"" << name << "\",\"cat\":\"task\",\"ph\":\"X\",\"pid\":" << PID << ",\"tid\":" << e.worker_id
+            << ",\"ts\":" << micros(since_ns) << ",\"dur\":" << micros(e.timestamp_ns - since_ns)
+            << ",\"args\":{" << args.str() << "}}";
+      emit(event.str());
+      running.erase(work);
+   };
+
+   auto instant = [&](const Event& e, const char* name) {
+      std::ostringstream event;
+      event << "{\"name\":\"" << name << "\",\"cat\":\"worker\",\"ph\":\"i\",\"s\":\"t\",\"pid\":" << PID << ",\"tid\":" << e.worker_id
+            << ",\"ts\":" << micros(e.timestamp_ns);
+      if (e.task != NO_TASK) {
+         event << ",\"args\":{\"item\":\"" << escape_json(tasks.url(e.task)) << "\"}";
+      }
+      event << '}';
+      emit(event.str());
+   };
+
+   out << "{\"traceEvents\":[";
+
+   auto count = wrapped ? events.size() : next;
+   for (std::size_t i = 0; i < count; i++) {
+      auto const& e = events[wrapped ? (next + i) % events.size() : i];
+      if (e.kind != TraceEventKind::ENQUEUE) {
+         tracks.insert(e.worker_id);
+      }
+
+      switch (e.kind) {
+         case TraceEventKind::ENQUEUE:
+            queued_since.insert_or_assign(e.task, e.timestamp_ns);
+            break;
+         case TraceEventKind::ASSIGN: {
+            // Queue waits overlap, so they are async spans with one track per item
+            if (auto queued = queued_since.find(e.task); queued != queued_since.end()) {
+               for (auto [phase, ts] : {std::pair{'b', queued->second}, std::pair{'e', e.timestamp_ns}}) {
+                  std::ostringstream event;
+                  event << "{\"name\":\"queued\",\"cat\":\"queue\",\"ph\":\"" << phase << "\",\"id\":" << e.task
+                        << ",\"pid\":" << PID << ",\"tid\":0,\"ts\":" << micros(ts);
+                  if (phase == 'b') {
+                     event << ",\"args\":{\"item\":\"" << escape_json(tasks.url(e.task)) << "\"}";
+                  }
+                  event << '}';
+                  emit(event.str());
+               }
+               queued_since.erase(queued);
+            }
+
+            auto& work = running.try_emplace(e.worker_id, Running{e.timestamp_ns, {}}).first->second;
+            work.tasks.push_back(e.task);
+            break;
+         }
+         case TraceEventKind::RESULT:
+            finish_work(e, "work", utils::Timings{e.fetch_ns, e.parse_ns, e.dedup_ns});
+            break;
+         case TraceEventKind::REASSIGN:
+            instant(e, "reassign");
+            break;
+         case TraceEventKind::CONNECT:
+            instant(e, "connect");
+            break;
+         case TraceEventKind::DISCONNECT:
+            finish_work(e, "lost work", {});
+            instant(e, "disconnect");
+            break;
+      }
+   }
+
+   for (auto worker_id : tracks) {
+      std::ostringstream event;
+      event << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << PID << ",\"tid\":" << worker_id
+            << ",\"args\":{\"name\":\"client " << worker_id << "\"}}";
+      emit(event.str());
+   }
+
+   out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
@@ -0,0 +1,82 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_TRACER_H
+#define EPOLL_WORK_QUEUE_TRACER_H
+
+#include "TaskTable.h"
+#include "utils.h"
+
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+// The moments in the life of a task, or of the worker doing it
+enum class TraceEventKind : uint8_t { ENQUEUE,
+                                      ASSIGN,
+                                      RESULT,
+                                      REASSIGN,
+                                      CONNECT,
+                                      DISCONNECT };
+
+// Records what happens to tasks into a fixed size ring of compact events and
+// exports them in the Chrome trace event format, for chrome://tracing or
+// ui.perfetto.dev. Once the ring is full the oldest events are overwritten.
+// A default constructed tracer is disabled and records nothing.
+class Tracer {
+   public:
+   Tracer() : events{}, next(0), wrapped(false), start{} {}
+   Tracer(std::size_t capacity);
+
+   bool enabled() const noexcept {
+      return !events.empty();
+   }
+
+   // Marks worker events, which are about no task in particular
+   static const constexpr TaskId NO_TASK = std::numeric_limits<TaskId>::max();
+
+   // Records an event of a worker, about a task unless it's a worker event
+   void record(TraceEventKind kind, unsigned int worker_id, TaskId task = NO_TASK) {
+      if (enabled()) {
+         push(kind, worker_id, task, {});
+      }
+   }
+
+   // Records the result of a worker's work, with the time it says it spent on it
+   void record_result(unsigned int worker_id, utils::Timings timings) {
+      if (enabled()) {
+         push(TraceEventKind::RESULT, worker_id, NO_TASK, timings);
+      }
+   }
+
+   // Writes the recorded events to the file, naming tasks by their URL in the table.
+   // Throws if it can't be written.
+   void save(const std::string& path, const TaskTable& tasks) const;
+
+   private:
+   struct Event {
+      // Nanoseconds since the tracer was created
+      uint64_t timestamp_ns;
+      // Nanoseconds the worker spent in each phase, for RESULT events
+      uint64_t fetch_ns;
+      uint64_t parse_ns;
+      uint64_t dedup_ns;
+      TaskId task;
+      uint32_t worker_id;
+      TraceEventKind kind;
+   };
+
+   // The ring of events, next is the slot to write next
+   std::vector<Event> events;
+   std::size_t next;
+   // Has the ring been filled once, so next is also the oldest event?
+   bool wrapped;
+   std::chrono::steady_clock::time_point start;
+
+   void push(TraceEventKind kind, unsigned int worker_id, TaskId task, utils::Timings timings);
+};
+
+#endif //EPOLL_WORK_QUEUE_TRACER_H
@@ -0,0 +1,195 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <spawn.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace {
+// The descriptor children find their end of the socketpair on
+const constexpr auto CHILD_FD = 3;
+
+// glibc's wrappers lack C linkage in some versions, like IoUring we go straight to the kernel
+int pidfd_open(pid_t pid) {
+   return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+}
+
+void pidfd_terminate(int pidfd) {
+   syscall(SYS_pidfd_send_signal, pidfd, SIGTERM, nullptr, 0);
+}
+}
+
+WorkerPool::WorkerPool(std::string binary, unsigned int max_size, std::vector<std::string> flags)
+   : binary(binary),
+     flags(std::move(flags)),
+     max_size(max_size),
+     children{},
+     sampled_at(std::chrono::steady_clock::now()) {
+   if (access(binary.c_str(), X_OK) != 0) {
+      throw std::runtime_error("can't execute worker binary " + binary);
+   }
+}
+
+WorkerPool::~WorkerPool() {
+   for (auto const& [watch_id, child] : children) {
+      pidfd_terminate(child.pidfd);
+      waitpid(child.pid, nullptr, 0);
+      close(child.pidfd);
+   }
+}
+
+bool WorkerPool::enabled() const noexcept {
+   return max_size > 0;
+}
+
+unsigned int WorkerPool::capacity() const noexcept {
+   return max_size;
+}
+
+std::size_t WorkerPool::size() const noexcept {
+   return static_cast<std::size_t>(std::count_if(children.begin(), children.end(), [](auto const& child) { return child.second.connected; }));
+}
+
+std::vector<unsigned int> WorkerPool::clients() const {
+   std::vector<unsigned int> ids{};
+   for (auto const& [watch_id, child] : children) {
+      if (child.connected) {
+         ids.push_back(child.client_id);
+      }
+   }
+
+   return ids;
+}
+
+void WorkerPool::lost(unsigned int client_id) {
+   for (auto& [watch_id, child] : children) {
+      if (child.client_id == client_id) {
+         child.connected = false;
+      }
+   }
+}
+
+unsigned int WorkerPool::spawn(Server& server) {
+   int fds[2];
+   if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) {
+      throw std::runtime_error("socketpair failed");
+   }
+
+   // The child keeps its end of the socketpair and nothing else of ours
+   posix_spawn_file_actions_t actions;
+   posix_spawn_file_actions_init(&actions);
+   posix_spawn_file_actions_adddup2(&actions, fds[1], CHILD_FD);
+   posix_spawn_file_actions_addclosefrom_np(&actions, CHILD_FD + 1);
+
+   std::string address{"fd:" + std::to_string(CHILD_FD)};
+   std::vector<char*> argv{binary.data(), address.data()};
+   for (auto& flag : flags) {
+      argv.push_back(flag.data());
+   }
+   argv.push_back(nullptr);
+
+   pid_t pid;
+   auto spawned = posix_spawn(&pid, binary.c_str(), &actions, nullptr, argv.data(), environ);
+   posix_spawn_file_actions_destroy(&actions);
+   close(fds[1]);
+
+   if (spawned != 0) {
+      close(fds[0]);
+      throw std::runtime_error("posix_spawn of " + binary + " failed");
+   }
+
+   auto pidfd = pidfd_open(pid);
+   if (pidfd == -1) {
+      close(fds[0]);
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+      throw std::runtime_error("pidfd_open failed");
+   }
+
+   auto client_id = server.adopt(fds[0]);
+   // A new process has used no CPU time yet
+   children[server.watch(pidfd)] = {pid, pidfd, client_id, true, 0};
+
+   return client_id;
+}
+
+bool WorkerPool::reap(unsigned int watch_id) {
+   auto child = children.find(watch_id);
+   if (child == children.end()) {
+      return false;
+   }
+
+   int status{};
+   waitpid(child->second.pid, &status, 0);
+   close(child->second.pidfd);
+
+   if (WIFSIGNALED(status)) {
+      std::cerr << "pooled worker " << child->second.pid << " killed by signal " << WTERMSIG(status) << std::endl;
+   } else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+      std::cerr << "pooled worker " << child->second.pid << " exited with status " << WEXITSTATUS(status) << std::endl;
+   }
+
+   children.erase(child);
+   return true;
+}
+
+std::optional<double> WorkerPool::cpu_per_worker(const std::function<bool(unsigned int)>& busy) {
+   auto now = std::chrono::steady_clock::now();
+   auto elapsed = std::chrono::duration<double>(now - sampled_at).count();
+   sampled_at = now;
+
+   unsigned long busy_ticks{};
+   auto busy_children{0u};
+   for (auto& [watch_id, child] : children) {
+      auto ticks = cpu_ticks_of(child.pid);
+      if (child.connected && busy(child.client_id) && ticks >= child.cpu_ticks) {
+         busy_ticks += ticks - child.cpu_ticks;
+         busy_children++;
+      }
+
+      child.cpu_ticks = ticks;
+   }
+
+   if (busy_children == 0 || elapsed <= 0) {
+      return {};
+   }
+
+   return static_cast<double>(busy_ticks) / static_cast<double>(sysconf(_SC_CLK_TCK)) / elapsed / busy_children;
+}
+
+unsigned long WorkerPool::cpu_ticks_of(pid_t pid) {
+   std::ifstream stat{"/proc/" + std::to_string(pid) + "/stat"};
+   std::string line{std::istreambuf_iterator<char>(stat), std::istreambuf_iterator<char>()};
+
+   // The command name may contain anything, the fields after it don't
+   auto pos = line.rfind(')');
+   if (pos == std::string::npos) {
+      return 0;
+   }
+
+   // utime and stime are the 14th and 15th field, the 12th and 13th after the name
+   std::istringstream fields{line.substr(pos + 2)};
+   std::string field;
+   for (auto i = 0; i < 11; i++) {
+      fields >> field;
+   }
+
+   unsigned long utime{}, stime{};
+   fields >> utime >> stime;
+
+   return utime + stime;
+}
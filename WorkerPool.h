@@ -0,0 +1,75 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#ifndef EPOLL_WORK_QUEUE_WORKER_POOL_H
+#define EPOLL_WORK_QUEUE_WORKER_POOL_H
+
+#include "Server.h"
+
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+// Worker processes on this host, started and reaped by the coordinator.
+// Each child gets one end of a socketpair as "fd:3" and the server adopts
+// the other end, so the pool knows which client is which process. Exits are
+// noticed through pidfds watched by the server.
+class WorkerPool {
+   public:
+   WorkerPool() : binary{}, flags{}, max_size(0), children{}, sampled_at{} {}
+   // The flags go on each worker's command line after its address
+   WorkerPool(std::string binary, unsigned int max_size, std::vector<std::string> flags = {});
+   // Kills and reaps the children still running
+   ~WorkerPool();
+
+   WorkerPool(WorkerPool&&) = default;
+   WorkerPool& operator=(WorkerPool&&) = default;
+
+   bool enabled() const noexcept;
+   // The most workers the pool may run at once
+   unsigned int capacity() const noexcept;
+   // Workers that are still connected
+   std::size_t size() const noexcept;
+   // Client IDs of the connected workers
+   std::vector<unsigned int> clients() const;
+   // Lets the pool know the client's connection is gone, e.g. because it was retired
+   void lost(unsigned int client_id);
+
+   // Starts another worker talking to the server, returns its client ID
+   unsigned int spawn(Server& server);
+   // Reaps the child whose pidfd watch fired. Returns false if it isn't ours.
+   bool reap(unsigned int watch_id);
+   // CPU time the busy children used since the previous call, per child and
+   // second of wall time. Close to 1 for CPU bound workers, close to 0 when they
+   // mostly wait for I/O. Nothing if no child is busy.
+   std::optional<double> cpu_per_worker(const std::function<bool(unsigned int)>& busy);
+
+   private:
+   struct Child {
+      pid_t pid;
+      int pidfd;
+      unsigned int client_id;
+      // Is its connection still up? Children are only reaped once they exit.
+      bool connected;
+      // user and system CPU time, in clock ticks, at the previous sample
+      unsigned long cpu_ticks;
+   };
+
+   // The worker executable
+   std::string binary;
+   std::vector<std::string> flags;
+   unsigned int max_size;
+   // Mapping of pidfd watch ID to child
+   std::unordered_map<unsigned int, Child> children;
+   std::chrono::steady_clock::time_point sampled_at;
+
+   // Total CPU time of the process so far, in clock ticks
+   static unsigned long cpu_ticks_of(pid_t pid);
+};
+
+#endif //EPOLL_WORK_QUEUE_WORKER_POOL_H
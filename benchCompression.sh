@@ -0,0 +1,41 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+if [ "$#" -ne 1 ]; then
+  echo "Usage: $(basename "$0") <path/to/file.csv>"
+  exit 1
+fi
+test -f "$1" || (echo "\"$1\": No such file or directory" && exit 1)
+
+file_path="$(dirname "$(realpath "$1")")"
+
+# Runs the whole job once over the prepared chunks and prints the wall time in ms
+run_job() {
+  local start end
+  start=$(date +%s%N)
+
+  build/coordinator "file://$file_path/filelist.csv" 4242 > /dev/null &
+  for _ in {1..8}; do
+    build/worker "localhost" "4242" &
+  done
+  wait
+
+  end=$(date +%s%N)
+  echo $(((end - start) / 1000000))
+}
+
+printf "%-8s %14s %10s\n" "level" "bytes" "ms"
+for level in none 1 6 9; do
+  if [ "$level" = "none" ]; then
+    data/splitCSV.sh "$1"
+  else
+    data/splitCSV.sh "--gzip=$level" "$1"
+  fi
+
+  # Every chunk is transferred exactly once
+  bytes=$(sed 's|^file://||' "$file_path/filelist.csv" | xargs du -cb | tail -n 1 | cut -f 1)
+  printf "%-8s %14s %10s\n" "$level" "$bytes" "$(run_job)"
+done
+
+# Leave plain chunks behind for runTest.sh
+data/splitCSV.sh "$1"
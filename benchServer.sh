@@ -0,0 +1,44 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+if [ "$#" -lt 1 ] || [ "$#" -gt 2 ]; then
+  echo "Usage: $(basename "$0") <path/to/file.csv> [workers]"
+  exit 1
+fi
+test -f "$1" || (echo "\"$1\": No such file or directory" && exit 1)
+
+file_path="$(dirname "$(realpath "$1")")"
+workers="${2:-8}"
+socket_path="$(mktemp -u /tmp/epoll-work-queue.XXXXXX.sock)"
+
+# Prepare the data
+data/splitCSV.sh "$1"
+
+# Runs the whole job once, listening on the given address with the given
+# coordinator flags, printing the event loop counters and the wall time in ms
+run_job() {
+  local listen="$1" connect="$2" start end
+  shift 2
+  start=$(date +%s%N)
+
+  build/coordinator "file://$file_path/filelist.csv" "$listen" --stats "$@" 2>&1 > /dev/null | grep server_stats &
+  for _ in $(seq "$workers"); do
+    # shellcheck disable=SC2086
+    build/worker $connect &
+  done
+  wait
+
+  end=$(date +%s%N)
+  echo "wall_ms=$(((end - start) / 1000000))"
+}
+
+echo "epoll, tcp loopback:"
+run_job 4242 "localhost 4242"
+echo "epoll, unix socket:"
+run_job "unix:$socket_path" "unix:$socket_path"
+echo "epoll, shared memory:"
+run_job "shm:$socket_path" "shm:$socket_path"
+echo "io_uring, tcp loopback:"
+run_job 4242 "localhost 4242" --io-uring
+echo "io_uring, unix socket:"
+run_job "unix:$socket_path" "unix:$socket_path" --io-uring
@@ -0,0 +1,146 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "ChunkFormat.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+
+namespace {
+const constexpr std::size_t DEFAULT_CHUNK_SIZE = 4 << 20;
+
+// Writes the rows it is given into numbered chunks of about the chunk size
+class ChunkWriter {
+   public:
+   ChunkWriter(std::filesystem::path base, std::size_t chunk_size) : base(std::move(base)), chunk_size(chunk_size), payload{}, rows(0), chunks{} {
+      payload.reserve(chunk_size + 2 + chunk_format::MAX_COLUMN_SIZE);
+   }
+
+   void add(std::string_view column) {
+      payload += static_cast<char>(column.size() >> 8);
+      payload += static_cast<char>(column.size() & 0xff);
+      payload += column;
+      rows++;
+
+      if (payload.size() >= chunk_size) {
+         flush();
+      }
+   }
+
+   // Writes what is left, returning every chunk written with its size
+   std::vector<std::pair<std::filesystem::path, std::size_t>> finish() {
+      flush();
+      return chunks;
+   }
+
+   private:
+   std::filesystem::path base;
+   std::size_t chunk_size;
+   std::string payload;
+   uint64_t rows;
+   std::vector<std::pair<std::filesystem::path, std::size_t>> chunks;
+
+   void flush() {
+      if (rows == 0) {
+         return;
+      }
+
+      auto checksum = crc32(0, reinterpret_cast<const Bytef*>(payload.data()), static_cast<uInt>(payload.size()));
+      auto header = chunk_format::encode_header({rows, payload.size(), static_cast<uint32_t>(checksum)});
+
+      auto number{std::to_string(chunks.size())};
+      auto path{base};
+      path += '.' + std::string(4 - std::min<std::size_t>(number.size(), 4), '0') + number + std::string(chunk_format::EXTENSION);
+
+      std::ofstream out{path, std::ios::binary | std::ios::trunc};
+      out.write(header.data(), static_cast<std::streamsize>(header.size()));
+      out.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+      if (!out) {
+         throw std::runtime_error("can't write " + path.string());
+      }
+
+      chunks.emplace_back(path, header.size() + payload.size());
+      payload.clear();
+      rows = 0;
+   }
+};
+}
+
+/// Splits a CSV of URLs into binary chunks of about a given size (4 MiB by default)
+/// next to it, see ChunkFormat.h, replacing those of a previous run. Workers read the
+/// URL column straight out of them instead of scanning rows. The manifest it writes
+/// is a list for the coordinator, giving the size of each chunk after its URL, so the
+/// coordinator hands out the biggest chunks first.
+/// Example:
+///    ./chunker data/urldata.csv --chunk-size 1m
+///    ./coordinator file://$PWD/data/urldata.manifest.csv 4242
+int main(int argc, char* argv[]) {
+   std::optional<std::size_t> chunk_size{DEFAULT_CHUNK_SIZE};
+   if (argc == 4 && std::string{argv[2]} == "--chunk-size") {
+      chunk_size = utils::parse_size(argv[3]);
+   }
+
+   if ((argc != 2 && argc != 4) || !chunk_size.has_value()) {
+      std::cerr << "Usage: " << argv[0] << " <path/to/file.csv> [--chunk-size <bytes>[k|m|g]]" << std::endl;
+      return 1;
+   }
+
+   std::ifstream in{argv[1]};
+   if (!in) {
+      std::cerr << "can't read " << argv[1] << std::endl;
+      return 1;
+   }
+
+   auto input{std::filesystem::absolute(argv[1])};
+   auto base{input.parent_path() / input.stem()};
+
+   // Drop chunks of a previous run
+   for (auto const& entry : std::filesystem::directory_iterator(input.parent_path())) {
+      auto name{entry.path().filename().string()};
+      if (name.starts_with(base.filename().string() + '.') && name.ends_with(chunk_format::EXTENSION)) {
+         std::filesystem::remove(entry.path());
+      }
+   }
+
+   // Rows without a URL column count for nothing, so they are left out
+   ChunkWriter writer{base, *chunk_size};
+   std::vector<std::pair<std::filesystem::path, std::size_t>> chunks{};
+   try {
+      for (std::string row; std::getline(in, row);) {
+         if (auto pos = row.find(','); pos != std::string::npos) {
+            writer.add(chunk_format::key_column(std::string_view(row).substr(0, pos)));
+         }
+      }
+
+      chunks = writer.finish();
+   } catch (const std::runtime_error& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+   }
+
+   auto manifest_path{base};
+   manifest_path += ".manifest.csv";
+   std::ofstream manifest{manifest_path, std::ios::trunc};
+   for (auto const& [path, size] : chunks) {
+      manifest << "file://" << path.string() << ' ' << size << '\n';
+   }
+
+   if (!manifest) {
+      std::cerr << "can't write " << manifest_path << std::endl;
+      return 1;
+   }
+
+   std::cerr << chunks.size() << " chunks, listed in " << manifest_path.string() << std::endl;
+
+   return 0;
+}
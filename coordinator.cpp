@@ -5,47 +5,226 @@
 #include "coordinator.h"
 
 namespace {
+// Hashes of a shared item appended before the first time they are made unique
+const constexpr std::size_t MIN_UNSORTED_KEYS = 64 << 10;
+
 std::function<void(int)> shutdown_handler;
 void signal_handler(int signal) { shutdown_handler(signal); }
+
+// Sorts the hashes appended to a shared item into the others, dropping duplicates
+void sort_keys(SharedItem& shared) {
+   auto middle = shared.keys.begin() + static_cast<std::ptrdiff_t>(shared.sorted);
+   std::sort(middle, shared.keys.end());
+   std::inplace_merge(shared.keys.begin(), middle, shared.keys.end());
+   shared.keys.erase(std::unique(shared.keys.begin(), shared.keys.end()), shared.keys.end());
+   shared.sorted = shared.keys.size();
+}
+
+void add_keys(SharedItem& shared, const std::vector<uint64_t>& keys) {
+   shared.keys.insert(shared.keys.end(), keys.begin(), keys.end());
+   if (shared.keys.size() - shared.sorted >= std::max(shared.sorted, MIN_UNSORTED_KEYS)) {
+      sort_keys(shared);
+   }
+}
 }
 
 /// Leader process that coordinates workers. Workers connect on the specified port
 /// and the coordinator distributes the work of the CSV file list.
 /// Example:
-///    ./coordinator http://example.org/filelist.csv 4242
-Coordinator::Coordinator(std::string file_location, std::string port)
-   : server{},
+///    ./coordinator http://example.org/filelist.csv 4242 --cache results.tsv
+/// With --upstream the coordinator instead relays work from another coordinator
+/// to its own workers, pulling it in batches and returning one combined result per batch:
+///    ./coordinator --upstream leader.example.org:4242 4343 --credit 32
+/// With --serve it keeps running, taking jobs from ./submit and sharing its workers between them:
+///    ./coordinator --serve 4242
+/// With --keepalive the kernel probes worker connections instead of workers heartbeating
+/// while they work, and the workers need the flag too:
+///    ./coordinator http://example.org/filelist.csv 4242 --keepalive
+///    ./worker coordinator.example.org 4242 --keepalive
+/// With --steal workers left without work take half of what a busy worker has left of its chunk:
+///    ./coordinator http://example.org/filelist.csv 4242 --steal
+Coordinator::Coordinator(std::string file_location, std::string port, CoordinatorOptions options)
+   : curl_setup{},
+     curl_handles{},
+     server{},
      port{port},
+     options{options},
      assigned_work{},
      heartbeats{},
-     work_left{},
-     aggregate{} {
-   // Split the work into small chunks and fill the open_work vector with it
-   CurlGlobalSetup globalCurl{};
+     tasks{},
+     jobs{},
+     submitters{},
+     cache{},
+     validators{},
+     credits{},
+     upstream_id{},
+     retries{},
+     deadlines{},
+     resume_points{},
+     tracer{},
+     pool{},
+     pool_timer{},
+     cpu_per_worker(1.0),
+     merged_fd(-1),
+     merge_watch{},
+     merges_running(0),
+     merged_jobs{},
+     merged_mutex{},
+     loaded_fd(-1),
+     load_watch{},
+     loaded_jobs{},
+     loaded_mutex{},
+     merge_pool{},
+     load_pool{} {
+   merged_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   loaded_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (merged_fd == -1 || loaded_fd == -1) {
+      throw std::runtime_error("can't create the eventfds of the merge and load threads");
+   }
+
+   if (options.replay_path.empty()) {
+      merge_pool = std::make_unique<ThreadPool>(MERGE_THREADS);
+      load_pool = std::make_unique<ThreadPool>(LOAD_THREADS);
+   }
+
+   if (!options.trace_path.empty()) {
+      tracer = Tracer(TRACE_CAPACITY);
+   }
+
+   // Pooled workers are the worker executable next to ours. A replay has
+   // the pool's decisions in its log already, and no processes to manage.
+   if (options.pool_size > 0 && options.replay_path.empty()) {
+      auto self{std::filesystem::read_symlink("/proc/self/exe")};
+      std::vector<std::string> flags{};
+      if (options.keepalive) {
+         flags.emplace_back("--keepalive");
+      }
+      if (options.counters) {
+         flags.emplace_back("--counters");
+      }
+      pool = WorkerPool(self.replace_filename("worker").string(), options.pool_size, std::move(flags));
+   }
+
+   if (!options.cache_path.empty()) {
+      cache = ResultCache(options.cache_path);
+   }
+
+   // A service waits for jobs from clients
+   if (serving()) {
+      return;
+   }
+
+   // A relay gets its work from upstream, in batches it handles as a job each
+   auto job = jobs.emplace(0, Job{}).first;
+   if (relay()) {
+      return;
+   }
+
+   job->second.list_location = file_location;
+   job->second.task = options.task;
+   job->second.result = tasks::AnyResult{options.task};
+   queue_job(job, fetch_list(job->second));
+}
 
-   CurlRequest curl{curl_easy_init()};
-   curl.set_url(file_location);
+JobList Coordinator::fetch_list(const Job& job) {
+   // Split the work into small chunks
+   auto curl{curl_handles.acquire()};
+   curl.set_url(job.list_location);
    curl.set_timeout(30);
 
-   auto fileList = curl.execute();
+   // One task per line. A manifest of the chunker has the size of each chunk after its URL.
+   std::string partial_line{};
+   std::vector<std::pair<uint64_t, std::string>> sizes{};
+   auto add_line = [&](std::string_view line) {
+      if (line.empty()) {
+         return;
+      }
+
+      uint64_t size{};
+      if (auto pos = line.find(' '); pos != std::string_view::npos) {
+         std::from_chars(line.data() + pos + 1, line.data() + line.size(), size);
+         line = line.substr(0, pos);
+      }
+      sizes.emplace_back(size, line);
+   };
+   curl.execute([&](std::string_view data) {
+      for (auto pos = data.find('\n'); pos != std::string_view::npos; pos = data.find('\n')) {
+         if (partial_line.empty()) {
+            add_line(data.substr(0, pos));
+         } else {
+            partial_line.append(data.substr(0, pos));
+            add_line(partial_line);
+            partial_line.clear();
+         }
+
+         data.remove_prefix(pos + 1);
+      }
+
+      partial_line.append(data);
+   });
+   add_line(partial_line);
+
+   // The biggest chunks go first, so no big one is left for the end
+   std::stable_sort(sizes.begin(), sizes.end(), [](auto const& a, auto const& b) { return a.first > b.first; });
+
+   // The cache only holds counts
+   JobList list{};
+   auto validate = cache.enabled() && tasks::count_only(job.task);
+   for (auto& [size, url] : sizes) {
+      std::string validator{};
+      if (validate) {
+         validator = ResultCache::validator_for(url, curl_handles);
+         // A result only holds for what was counted
+         if (auto name{utils::task_name(job.task)}; !validator.empty() && !name.empty()) {
+            validator = std::string{name} + ":" + validator;
+         }
+      }
 
-   // Iterate over all files
-   for (std::string url; std::getline(fileList, url, '\n');) {
-      work_left.push_back(url);
+      list.urls.push_back(std::move(url));
+      list.validators.push_back(std::move(validator));
+   }
+
+   return list;
+}
+
+void Coordinator::queue_job(std::map<TaskId, Job>::iterator job, const JobList& list) {
+   unsigned int cached{};
+   for (std::size_t i = 0; i < list.urls.size(); i++) {
+      auto id{tasks.add(list.urls[i])};
+      if (auto const& validator{list.validators[i]}; !validator.empty()) {
+         // Unchanged chunks contribute their previous result without a worker
+         if (auto result{cache.lookup(list.urls[i], validator)}; result.has_value()) {
+            job->second.result.merge(*result, {});
+            tasks.set_state(id, TaskState::DONE);
+            cached++;
+            continue;
+         }
+
+         validators.insert_or_assign(id, validator);
+      }
+
+      tracer.record(TraceEventKind::ENQUEUE, 0, id);
+      job->second.work_left.push_back(id);
+   }
+
+   if (cache.enabled()) {
+      std::cerr << "result cache: " << cached << " cached, " << job->second.work_left.size() << " to compute" << std::endl;
    }
 }
 
 Server Coordinator::create_server() {
    // hand over a callback function that returns a WorkerAction depending on the ClientEvent received
-   auto callbackFunction = [this](ClientEvent event) {
+   auto handle = [this](ClientEvent event) {
       // if all work has finished, exit
-      if (work_finished()) {
+      // a relay keeps going until its upstream is done, a service until it's stopped
+      if (exiting()) {
          return WorkerAction(WorkerActionKind::EXIT);
       }
 
       switch (event.kind) {
          // start sending messages when a new client connects, leave the message empty in this case
          case ClientEventKind::CONNECTED: {
+            tracer.record(TraceEventKind::CONNECT, event.worker_id);
             // Do nothing
             return WorkerAction();
          }
@@ -54,59 +233,195 @@ Server Coordinator::create_server() {
             if (auto proto{utils::unmarshal_proto(event.message)}; proto.has_value()) {
                switch (proto->kind) {
                   case utils::ProtocolEventKind::WORK: {
-                     // Do nothing
+                     // A relay queues the batch it got from upstream for its own workers
+                     if (event.worker_id == upstream_id) {
+                        jobs.begin()->second.task = proto->task;
+                        jobs.begin()->second.result = tasks::AnyResult{proto->task};
+                        for (auto const& item : proto->work_items()) {
+                           add_work(item);
+                        }
+                        // Idle workers shouldn't wait for their next heartbeat
+                        dispatch_to_idle_workers();
+                     }
                      return WorkerAction();
                   }
                   case utils::ProtocolEventKind::RESULT: {
-                     // Increment the counter
-                     aggregate += static_cast<unsigned int>(proto->result);
-                     // Remove this work item successfully
-                     finish_work(event.worker_id);
-                     // If all work has finished, exit
-                     if (work_finished()) {
-                        return WorkerAction(WorkerActionKind::EXIT);
+                     tracer.record_result(event.worker_id, proto->timings);
+                     // Remove this work item successfully, adding the result to its job
+                     // If all work of the job has finished, exit, hand the batch upstream or the result to the submitter
+                     if (auto job{finish_work(event.worker_id, *proto)}; job != jobs.end() && job_finished(job->second)) {
+                        return complete_job(job);
                      }
                      // if work is available, send it over
                      if (auto work{assign_work(event.worker_id)}; work.has_value()) {
-                        return WorkerAction(WorkerActionKind::SEND_MESSAGE, utils::ProtocolEvent(*work).marshal());
+                        return WorkerAction(WorkerActionKind::SEND_MESSAGE, std::move(*work));
                      }
                      // If none of the above, do nothing
                      return WorkerAction();
                   }
                   case utils::ProtocolEventKind::HEARTBEAT: {
+                     // Submitters only keep their connection alive
+                     if (submitters.contains(event.worker_id)) {
+                        return WorkerAction();
+                     }
                      // Just increment the worker heartbeat counter
                      increment_heartbeat(event.worker_id);
+                     // Remember how many items the worker takes at once
+                     credits.insert_or_assign(event.worker_id, proto->credit);
                      // On the second heatbeat actually distribute work
                      if (get_heartbeat(event.worker_id) > 1) {
                         // if work is available, send it over
                         if (auto work{assign_work(event.worker_id)}; work.has_value()) {
-                           return WorkerAction(WorkerActionKind::SEND_MESSAGE, utils::ProtocolEvent(*work).marshal());
+                           return WorkerAction(WorkerActionKind::SEND_MESSAGE, std::move(*work));
                         }
                      }
                      // If none of the above, do nothing
                      return WorkerAction();
                   }
+                  case utils::ProtocolEventKind::PROGRESS: {
+                     // Keep the checkpoint in case the worker dies before finishing
+                     record_progress(event.worker_id, std::move(proto->checkpoint));
+                     return WorkerAction();
+                  }
+                  case utils::ProtocolEventKind::JOB: {
+                     // Only a service takes jobs
+                     if (!serving()) {
+                        return WorkerAction();
+                     }
+                     return submit_job(event.worker_id, std::move(proto->work), proto->task);
+                  }
+                  case utils::ProtocolEventKind::HELLO: {
+                     // A worker that reconnects says who it is, and which of its work it still has
+                     return greet(event.worker_id, *proto);
+                  }
+                  case utils::ProtocolEventKind::STEAL: {
+                     // A relay's batch is spread over its workers already, it has nothing to share
+                     if (event.worker_id == upstream_id) {
+                        utils::ProtocolEvent refusal{};
+                        refusal.kind = utils::ProtocolEventKind::STEAL;
+                        return WorkerAction(WorkerActionKind::SEND_MESSAGE, refusal.marshal());
+                     }
+                     // A worker gave rows away, or said it can't
+                     steals.erase(event.worker_id);
+                     if (proto->checkpoint.end > 0) {
+                        share_work(event.worker_id, proto->checkpoint);
+                     } else if (auto work{assigned_work.find(event.worker_id)}; work != assigned_work.end()) {
+                        work->second.unshareable = true;
+                     }
+                     return WorkerAction();
+                  }
+                  case utils::ProtocolEventKind::KEYS: {
+                     // Hashes of a worker's shared rows, too many to go with its result
+                     add_range_keys(event.worker_id, proto->checkpoint.domains);
+                     return WorkerAction();
+                  }
+                  // Only workers are told goodbye
+                  case utils::ProtocolEventKind::BYE: return WorkerAction();
                }
             }
             return WorkerAction();
          }
          // when we receive a disconnect event, we need to remove the client from our known workers and reassign the work
          case ClientEventKind::DISCONNECTED: {
-            // lookup lost work in the map and re-add it to the vector
-            remove_worker(event.worker_id);
+            // a relay is done once its upstream is gone
+            if (event.worker_id == upstream_id) {
+               return WorkerAction(WorkerActionKind::EXIT);
+            }
+            // nobody waits for the results of a submitter that went away
+            if (submitters.erase(event.worker_id) > 0) {
+               return cancel_jobs(event.worker_id);
+            }
+            tracer.record(TraceEventKind::DISCONNECT, event.worker_id);
+            pool.lost(event.worker_id);
+            // a worker that reconnects gets a while to come back for its work
+            if (detach_worker(event.worker_id)) {
+               return WorkerAction();
+            }
+            // lookup lost work in the map and schedule it for a retry,
+            // giving up on it may have been all that was left to do
+            if (auto job{remove_worker(event.worker_id)}; job != jobs.end() && job_finished(job->second)) {
+               return complete_job(job);
+            }
             // return a NOOP response since the client already disconnected
             return WorkerAction();
          }
+         // a relay heartbeats upstream, announcing its credit window
+         case ClientEventKind::TIMER: {
+            if (event.worker_id == upstream_id) {
+               // unless it is busy with a batch and upstream relies on keepalive
+               if (options.keepalive && !job_finished(jobs.begin()->second)) {
+                  return WorkerAction();
+               }
+               utils::ProtocolEvent heartbeat{};
+               heartbeat.credit = options.credit;
+               return WorkerAction(WorkerActionKind::SEND_MESSAGE, heartbeat.marshal());
+            }
+            // otherwise it's a retry or deadline we scheduled
+            return handle_timer(event.worker_id);
+         }
+         // a pooled worker exited
+         case ClientEventKind::READABLE: {
+            // or the merge threads got through some summaries
+            if (event.worker_id == merge_watch) {
+               return collect_merges();
+            }
+            // or the load thread fetched the list of a submitted job
+            if (event.worker_id == load_watch) {
+               return collect_loads();
+            }
+            pool.reap(event.worker_id);
+            return WorkerAction();
+         }
          // in any other case return a NOOP WorkerAction
          default: return WorkerAction();
       }
    };
 
-   return Server(callbackFunction);
+   auto callbackFunction = [this, handle](ClientEvent event) {
+      auto action{handle(std::move(event))};
+      if (action.kind == WorkerActionKind::EXIT) {
+         farewell();
+      }
+      return action;
+   };
+
+   Server server{callbackFunction, options.backend};
+   if (options.keepalive) {
+      server.set_liveness(ServerLiveness::KEEPALIVE);
+   }
+   server.set_suspicion_threshold(options.suspicion_threshold);
+
+   return server;
 }
 
 bool Coordinator::work_finished() const noexcept {
-   return work_left.empty() && assigned_work.empty();
+   return queued_work() == 0 && assigned_work.empty() && retries.empty() && merges_running == 0;
+}
+
+bool Coordinator::exiting() const noexcept {
+   return !relay() && !serving() && work_finished();
+}
+
+std::size_t Coordinator::queued_work() const noexcept {
+   std::size_t queued{};
+   for (auto const& [first, job] : jobs) {
+      queued += job.work_left.size();
+   }
+
+   return queued;
+}
+
+std::map<TaskId, Job>::iterator Coordinator::job_of(TaskId item) {
+   // Ranges are added to the table whenever they are given away, after the items of later jobs
+   if (auto range{ranges.find(item)}; range != ranges.end()) {
+      item = range->second;
+   }
+
+   return std::prev(jobs.upper_bound(item));
+}
+
+bool Coordinator::job_finished(const Job& job) const noexcept {
+   return job.work_left.empty() && job.in_flight == 0 && job.retrying == 0 && !job.merging;
 }
 
 bool Coordinator::worker_busy(unsigned int worker_id) const noexcept {
@@ -129,52 +444,827 @@ void Coordinator::increment_heartbeat(unsigned int worker_id) noexcept {
    }
 }
 
-// Returns a new work unit and assigns it to the worker
-std::optional<std::string> Coordinator::assign_work(unsigned int worker_id) {
-   if (work_left.empty()) {
+bool Coordinator::relay() const noexcept {
+   return !options.upstream_host.empty();
+}
+
+bool Coordinator::serving() const noexcept {
+   return options.serve;
+}
+
+void Coordinator::add_work(std::string_view url) {
+   auto id = tasks.add(url);
+   tracer.record(TraceEventKind::ENQUEUE, 0, id);
+   jobs.begin()->second.work_left.push_back(id);
+}
+
+// Returns new work units, as many as the worker's credit allows, and assigns them to the worker
+std::optional<std::vector<char>> Coordinator::assign_work(unsigned int worker_id) {
+   if (worker_busy(worker_id)) {
       return {};
    }
 
-   if (worker_busy(worker_id)) {
+   // Jobs share the workers: the one with the fewest work items out goes first, the oldest on a tie
+   auto job = jobs.end();
+   for (auto it = jobs.begin(); it != jobs.end(); it++) {
+      if (!it->second.work_left.empty() && (job == jobs.end() || it->second.in_flight < job->second.in_flight)) {
+         job = it;
+      }
+   }
+
+   if (job == jobs.end()) {
+      if (options.steal) {
+         request_steal(worker_id);
+      }
       return {};
    }
 
-   // Pop the top of the work queue
-   auto w{work_left.front()};
-   work_left.pop_front();
+   auto& work_left = job->second.work_left;
+
+   auto credit{1u};
+   if (auto it{credits.find(worker_id)}; it != credits.end()) {
+      credit = it->second;
+   }
+
+   // Pop the top of the work queue. Items that failed before go out on their own,
+   // so a poison item can't take the rest of a batch down with it again. So do ranges
+   // of shared items, a checkpoint being about a single item.
+   auto alone = [&](TaskId id) {
+      return tasks.attempts(id) > 0 || resume_points.contains(id);
+   };
+   std::vector<TaskId> w{};
+   while (!work_left.empty() && w.size() < credit) {
+      if (!w.empty() && alone(work_left.front())) {
+         break;
+      }
+
+      w.push_back(work_left.front());
+      work_left.pop_front();
+
+      if (alone(w.back())) {
+         break;
+      }
+   }
+
+   // Assign it to worker. A partially done item resumes from its checkpoint,
+   // which also seeds the progress the worker reports on top of it.
+   std::vector<char> message{};
+   Assignment assignment{w, {}, false};
+   if (auto resume{resume_points.extract(w.front())}; resume) {
+      assignment.progress = resume.mapped();
+      utils::ProtocolEvent resumed{std::string(tasks.url(w.front())), std::move(resume.mapped())};
+      resumed.task = job->second.task;
+      resumed.task_ids = w;
+      message = resumed.marshal();
+   } else {
+      std::vector<std::string_view> urls{};
+      urls.reserve(w.size());
+      for (auto id : w) {
+         urls.push_back(tasks.url(id));
+      }
+
+      message = utils::marshal_work(urls, job->second.task, w);
+   }
+
+   for (auto id : w) {
+      tasks.set_state(id, TaskState::ASSIGNED);
+      tracer.record(TraceEventKind::ASSIGN, worker_id, id);
+   }
+   job->second.in_flight += w.size();
+
+   assigned_work.insert_or_assign(worker_id, std::move(assignment));
+
+   // A worker hanging on its work is dropped once the deadline passes
+   if (options.task_timeout.count() > 0) {
+      deadlines.insert_or_assign(worker_id, server.schedule(options.task_timeout));
+   }
+
+   return message;
+}
+
+void Coordinator::request_steal(unsigned int thief_id) {
+   for (auto const& [victim_id, waiting_id] : steals) {
+      if (waiting_id == thief_id) {
+         return;
+      }
+   }
+
+   // Only the rows of the last item can be shared, which the worker's checkpoints tell it is on.
+   // Workers that lost their connection have no heartbeats.
+   auto victim = assigned_work.end();
+   for (auto it = assigned_work.begin(); it != assigned_work.end(); it++) {
+      auto const& [items, progress, unshareable] = it->second;
+      if (unshareable || steals.contains(it->first) || progress.items_done + 1 != items.size() || !heartbeats.contains(it->first)) {
+         continue;
+      }
+
+      auto job = job_of(items.back());
+      if (job->second.cancelled || !tasks::resumable(job->second.task)) {
+         continue;
+      }
+
+      if (victim == assigned_work.end() || progress.offset < victim->second.progress.offset) {
+         victim = it;
+      }
+   }
+
+   if (victim == assigned_work.end()) {
+      return;
+   }
+
+   utils::ProtocolEvent steal{};
+   steal.kind = utils::ProtocolEventKind::STEAL;
+   server.send(victim->first, steal.marshal());
+   steals.insert_or_assign(victim->first, thief_id);
+}
+
+void Coordinator::share_work(unsigned int worker_id, const utils::Checkpoint& range) {
+   // The worker's work was retried meanwhile, its rows and all
+   auto work{assigned_work.find(worker_id)};
+   if (work == assigned_work.end()) {
+      return;
+   }
+
+   auto item = work->second.items.back();
+   auto job = job_of(item);
+   if (job->second.cancelled) {
+      return;
+   }
+
+   // The worker keeps the rows before the range, should it die they are retried up to there
+   work->second.progress.end = range.offset;
+   auto first{item};
+   if (auto it{ranges.find(item)}; it != ranges.end()) {
+      first = it->second;
+   }
+   shared_items[first].ranges_left++;
 
-   // Assign it to worker
-   assigned_work.insert_or_assign(worker_id, w);
+   std::string url{tasks.url(item)};
+   auto id = tasks.add(url);
+   ranges.insert_or_assign(id, first);
+   resume_points.insert_or_assign(id, utils::Checkpoint{0, 0, range.offset, {}, range.end});
+   tracer.record(TraceEventKind::ENQUEUE, 0, id);
+   job->second.work_left.push_back(id);
 
-   return w;
+   // The worker waiting for it shouldn't wait for its next heartbeat
+   dispatch_to_idle_workers();
 }
 
-void Coordinator::finish_work(unsigned int worker_id) {
-   assigned_work.erase(worker_id);
+void Coordinator::finish_range(Job& job, TaskId item, const std::vector<uint64_t>* keys) {
+   auto first{item};
+   if (auto it{ranges.find(item)}; it != ranges.end()) {
+      first = it->second;
+   }
+
+   auto& shared = shared_items[first];
+   if (keys != nullptr) {
+      add_keys(shared, *keys);
+   } else {
+      shared.incomplete = true;
+   }
+
+   if (item != first && keys != nullptr) {
+      tasks.set_state(item, TaskState::DONE);
+      tasks.clear_attempts(item);
+   }
+
+   if (--shared.ranges_left > 0) {
+      return;
+   }
+
+   sort_keys(shared);
+   job.result.merge(shared.keys.size(), {});
+   if (!shared.incomplete) {
+      tasks.set_state(first, TaskState::DONE);
+      tasks.clear_attempts(first);
+      if (auto it{validators.find(first)}; it != validators.end()) {
+         cache.store(std::string(tasks.url(first)), it->second, shared.keys.size());
+      }
+   }
+   shared_items.erase(first);
 }
 
-// Removes a worker and re-adds its associated work unit
-void Coordinator::remove_worker(unsigned int worker_id) {
+void Coordinator::add_range_keys(unsigned int worker_id, const std::vector<uint64_t>& keys) {
+   auto work{assigned_work.find(worker_id)};
+   if (work == assigned_work.end()) {
+      return;
+   }
+
+   auto first{work->second.items.back()};
+   if (auto it{ranges.find(first)}; it != ranges.end()) {
+      first = it->second;
+   }
+
+   if (auto shared{shared_items.find(first)}; shared != shared_items.end()) {
+      add_keys(shared->second, keys);
+   }
+}
+
+void Coordinator::record_progress(unsigned int worker_id, utils::Checkpoint progress) {
+   auto it{assigned_work.find(worker_id)};
+   if (it == assigned_work.end()) {
+      return;
+   }
+
+   // The domains of an item accumulate until the worker moves on to the next one
+   auto& latest = it->second.progress;
+   if (progress.items_done != latest.items_done) {
+      latest.domains.clear();
+   }
+
+   latest.items_done = progress.items_done;
+   latest.result = progress.result;
+   latest.offset = progress.offset;
+   latest.domains.insert(latest.domains.end(), progress.domains.begin(), progress.domains.end());
+}
+
+std::map<TaskId, Job>::iterator Coordinator::finish_work(unsigned int worker_id, const utils::ProtocolEvent& proto) {
+   deadlines.erase(worker_id);
+   steals.erase(worker_id);
+
+   auto work{assigned_work.extract(worker_id)};
+   if (!work) {
+      return jobs.end();
+   }
+
+   // Increment the counter
+   auto const& items = work.mapped().items;
+   auto job = job_of(items.front());
+   job->second.in_flight -= items.size();
+   job->second.spent += proto.timings;
+   if (!tasks::count_only(job->second.task)) {
+      job->second.unmerged.emplace_back(proto.result, proto.summary);
+      start_merge(job);
+   } else if (!job->second.result.merge(proto.result, proto.summary)) {
+      std::cerr << "malformed result from worker " << worker_id << ", the result is incomplete" << std::endl;
+   }
+
+   // The rows of the last item the worker shared count once those of the other workers are in
+   auto shared = proto.checkpoint.end > 0;
+   for (std::size_t i = 0; i < items.size() - (shared ? 1 : 0); i++) {
+      tasks.set_state(items[i], TaskState::DONE);
+      tasks.clear_attempts(items[i]);
+   }
+
+   if (shared) {
+      finish_range(job->second, items.back(), &proto.checkpoint.domains);
+      return job;
+   }
+
+   // Remember the result for the next run, if the chunk could be validated.
+   // Combined results of several chunks can't be attributed to any one of them.
+   if (items.size() != 1) {
+      return job;
+   }
+
+   if (auto it{validators.find(items.front())}; it != validators.end()) {
+      cache.store(std::string(tasks.url(it->first)), it->second, proto.result);
+   }
+
+   return job;
+}
+
+void Coordinator::dispatch_to_idle_workers() {
+   for (auto const& [worker_id, count] : heartbeats) {
+      if (count < 2 || worker_busy(worker_id)) {
+         continue;
+      }
+
+      if (auto work{assign_work(worker_id)}; work.has_value()) {
+         server.send(worker_id, std::move(*work));
+      }
+   }
+}
+
+// Removes a worker and schedules its associated work units for a retry
+std::map<TaskId, Job>::iterator Coordinator::remove_worker(unsigned int worker_id) {
+   heartbeats.erase(worker_id);
+   credits.erase(worker_id);
+   deadlines.erase(worker_id);
+   steals.erase(worker_id);
    // in in this case we need to remove the worker from our map of worker_ids and retrieve the unfinished work
    auto work{assigned_work.extract(worker_id)};
-   // if the work was found, remove it from the map
-   if (work) {
-      work_left.push_back(work.mapped());
+   if (!work) {
+      return jobs.end();
+   }
+
+   // Items the worker reported as finished keep their result
+   auto& [items, progress, unshareable] = work.mapped();
+   auto job = job_of(items.front());
+   auto done = std::min(progress.items_done, items.size());
+   // Only resumable tasks report progress, and their results are counts
+   if (progress.result > 0) {
+      job->second.result.merge(progress.result, {});
+   }
+   job->second.in_flight -= items.size();
+   for (std::size_t i = 0; i < done; i++) {
+      tasks.set_state(items[i], TaskState::DONE);
+      tasks.clear_attempts(items[i]);
+   }
+
+   // Nobody wants the rest of a cancelled job
+   if (job->second.cancelled) {
+      return job;
+   }
+
+   // The item in progress resumes where the worker left it, the last one only goes as far as
+   // the rows the worker kept of it
+   auto last_end = [&](std::size_t i) {
+      return i + 1 == items.size() ? progress.end : 0;
+   };
+   if (done < items.size() && (progress.offset > 0 || last_end(done) > 0)) {
+      resume_points.insert_or_assign(items[done], utils::Checkpoint{0, 0, progress.offset, std::move(progress.domains), last_end(done)});
+   }
+   if (done + 1 < items.size() && progress.end > 0) {
+      resume_points.insert_or_assign(items.back(), utils::Checkpoint{0, 0, 0, {}, progress.end});
+   }
+
+   for (auto i = done; i < items.size(); i++) {
+      tracer.record(TraceEventKind::REASSIGN, worker_id, items[i]);
+      schedule_retry(job->second, items[i]);
+   }
+
+   return job;
+}
+
+WorkerAction Coordinator::greet(unsigned int worker_id, const utils::ProtocolEvent& hello) {
+   tokens.insert_or_assign(worker_id, hello.token);
+
+   // The worker may have given up on a connection that hasn't ended on our side yet
+   std::optional<unsigned int> previous{};
+   std::optional<unsigned int> stale{};
+   if (auto detached_worker{detached.extract(hello.token)}; detached_worker) {
+      previous = detached_worker.mapped();
+      // Its reclaim timer must not retry the work should the worker detach again
+      std::erase_if(reclaims, [&](auto const& reclaim) { return reclaim.second == hello.token; });
+   } else {
+      for (auto const& [id, token] : tokens) {
+         if (token == hello.token && id != worker_id) {
+            previous = stale = id;
+            break;
+         }
+      }
+   }
+
+   if (stale.has_value()) {
+      tokens.erase(*stale);
+      heartbeats.erase(*stale);
+      credits.erase(*stale);
+      deadlines.erase(*stale);
+      steals.erase(*stale);
+   }
+
+   auto action{WorkerAction()};
+   if (auto work{previous.has_value() ? assigned_work.find(*previous) : assigned_work.end()}; work != assigned_work.end()) {
+      if (work->second.items == hello.task_ids) {
+         // Its result, or its progress until then, counts as if it never left
+         auto node{assigned_work.extract(work)};
+         node.key() = worker_id;
+         for (auto id : node.mapped().items) {
+            tracer.record(TraceEventKind::ASSIGN, worker_id, id);
+         }
+         assigned_work.insert(std::move(node));
+
+         if (options.task_timeout.count() > 0) {
+            deadlines.insert_or_assign(worker_id, server.schedule(options.task_timeout));
+         }
+      } else if (auto job{remove_worker(*previous)}; job != jobs.end() && job_finished(job->second)) {
+         // The worker doesn't have what it was given, say the work never reached it
+         action = complete_job(job);
+      }
+   }
+
+   // Its work is taken care of, whatever becomes of the old connection
+   if (stale.has_value()) {
+      server.disconnect(*stale);
+   }
+
+   return action;
+}
+
+bool Coordinator::detach_worker(unsigned int worker_id) {
+   auto token{tokens.extract(worker_id)};
+   if (!token || !worker_busy(worker_id)) {
+      return false;
+   }
+
+   heartbeats.erase(worker_id);
+   credits.erase(worker_id);
+   deadlines.erase(worker_id);
+   // A steal it was asked for went out on the lost connection, one it answers anyway comes from its next
+   steals.erase(worker_id);
+   detached.insert_or_assign(token.mapped(), worker_id);
+   reclaims.insert_or_assign(server.schedule(RECLAIM_WINDOW), token.mapped());
+
+   return true;
+}
+
+void Coordinator::farewell() {
+   utils::ProtocolEvent bye{};
+   bye.kind = utils::ProtocolEventKind::BYE;
+   auto message{bye.marshal()};
+   for (auto const& [worker_id, token] : tokens) {
+      server.send(worker_id, message);
+   }
+}
+
+void Coordinator::schedule_retry(Job& job, TaskId item) {
+   auto failures = tasks.add_attempt(item);
+   if (failures >= options.max_attempts) {
+      std::cerr << "giving up on " << tasks.url(item) << " after " << failures << " failed attempts" << std::endl;
+      tasks.set_state(item, TaskState::FAILED);
+      resume_points.erase(item);
+      job.failed++;
+      // What the other ranges of a shared item found still counts
+      if (ranges.contains(item) || shared_items.contains(item)) {
+         finish_range(job, item, nullptr);
+      }
+      return;
+   }
+
+   // 1s, 2s, 4s, ... between attempts, so a struggling fleet isn't hammered
+   auto delay = std::min(RETRY_BACKOFF * (1u << std::min(failures - 1, 5u)), MAX_RETRY_BACKOFF);
+   tasks.set_state(item, TaskState::RETRYING);
+   retries.insert_or_assign(server.schedule(delay), item);
+   job.retrying++;
+}
+
+WorkerAction Coordinator::handle_timer(unsigned int timer_id) {
+   if (timer_id == pool_timer) {
+      scale_pool();
+      pool_timer = server.schedule(POOL_INTERVAL);
+      return WorkerAction();
+   }
+
+   if (auto reclaim{reclaims.extract(timer_id)}; reclaim) {
+      // the worker didn't come back for its work in time, others retry it
+      if (auto worker{detached.extract(reclaim.mapped())}; worker) {
+         if (auto job{remove_worker(worker.mapped())}; job != jobs.end() && job_finished(job->second)) {
+            return complete_job(job);
+         }
+      }
+      return WorkerAction();
+   }
+
+   if (auto retry{retries.extract(timer_id)}; retry) {
+      auto job = job_of(retry.mapped());
+      job->second.retrying--;
+      // The last retry of a cancelled job may be all that kept it around
+      if (job->second.cancelled) {
+         return job_finished(job->second) ? complete_job(job) : WorkerAction();
+      }
+      tasks.set_state(retry.mapped(), TaskState::PENDING);
+      tracer.record(TraceEventKind::ENQUEUE, 0, retry.mapped());
+      job->second.work_left.push_back(retry.mapped());
+      // Idle workers shouldn't wait for their next heartbeat
+      dispatch_to_idle_workers();
+      return WorkerAction();
+   }
+
+   auto expired = std::find_if(deadlines.begin(), deadlines.end(), [&](auto const& deadline) {
+      return deadline.second == timer_id;
+   });
+   if (expired == deadlines.end()) {
+      // the work was finished in time
+      return WorkerAction();
+   }
+
+   auto worker_id = expired->first;
+   std::cerr << "worker " << worker_id << " exceeded the task timeout" << std::endl;
+   // counts as a failure of its work, just like a crash. Without its token the work isn't
+   // kept for the worker to reconnect to, it is retried elsewhere.
+   tokens.erase(worker_id);
+   server.disconnect(worker_id);
+
+   if (exiting()) {
+      return WorkerAction(WorkerActionKind::EXIT);
+   }
+
+   return WorkerAction();
+}
+
+WorkerAction Coordinator::complete_job(std::map<TaskId, Job>::iterator job) {
+   // A relay hands the combined result of the batch upstream
+   if (relay()) {
+      auto result{std::exchange(job->second.result, tasks::AnyResult{job->second.task})};
+      utils::ProtocolEvent batch{result.count(), std::exchange(job->second.spent, {})};
+      batch.summary = result.serialize();
+      server.send(*upstream_id, batch.marshal());
+      // The next batch is a job of its own as far as the tasks go
+      forget_tasks();
+      return WorkerAction();
+   }
+
+   if (!serving()) {
+      return WorkerAction(WorkerActionKind::EXIT);
+   }
+
+   auto const& done = job->second;
+   auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - done.submitted).count();
+   if (done.cancelled) {
+      std::cerr << "job " << done.list_location << " cancelled after " << elapsed << "s" << std::endl;
+   } else {
+      std::cerr << "job " << done.list_location << " done in " << elapsed << "s: " << done.result.count();
+      if (done.failed > 0) {
+         std::cerr << ", gave up on " << done.failed << " work items";
+      }
+      std::cerr << std::endl;
+      if (done.spent.counted()) {
+         std::cerr << done.spent;
+      }
+      utils::ProtocolEvent result{done.result.count()};
+      result.summary = done.result.serialize();
+      server.send(*done.submitter, result.marshal());
+   }
+
+   jobs.erase(job);
+   cache.save();
+
+   // Without jobs no task is referred to anymore
+   if (jobs.empty()) {
+      forget_tasks();
+   }
+
+   return WorkerAction();
+}
+
+void Coordinator::forget_tasks() {
+   // The trace refers to tasks by ID
+   if (tracer.enabled()) {
+      return;
+   }
+
+   tasks = TaskTable{};
+   validators.clear();
+   resume_points.clear();
+   shared_items.clear();
+   ranges.clear();
+}
+
+WorkerAction Coordinator::submit_job(unsigned int submitter, std::string list_location, utils::TaskKind task) {
+   submitters.insert(submitter);
+
+   // Fetching the list and validating its chunks takes round trips, which would hold up
+   // the heartbeats of every worker on the loop
+   LoadingJob loading{};
+   loading.job.submitter = submitter;
+   loading.job.list_location = std::move(list_location);
+   loading.job.task = task;
+   loading.job.result = tasks::AnyResult{task};
+   auto load = [this, loading = std::move(loading)]() mutable {
+      try {
+         loading.list = fetch_list(loading.job);
+      } catch (const std::runtime_error& e) {
+         loading.error = e.what();
+      }
+
+      {
+         std::unique_lock<std::mutex> lock(loaded_mutex);
+         loaded_jobs.push_back(std::move(loading));
+      }
+      eventfd_write(loaded_fd, 1);
+   };
+
+   if (load_pool) {
+      load_pool->submit(std::move(load));
+   } else {
+      load();
+   }
+
+   return WorkerAction();
+}
+
+WorkerAction Coordinator::collect_loads() {
+   eventfd_t ignored;
+   eventfd_read(loaded_fd, &ignored);
+   load_watch = server.watch(loaded_fd);
+
+   std::vector<LoadingJob> loaded{};
+   {
+      std::unique_lock<std::mutex> lock(loaded_mutex);
+      loaded.swap(loaded_jobs);
+   }
+
+   for (auto& [loaded_job, list, error] : loaded) {
+      // Nobody waits for the result of a submitter that went away meanwhile
+      auto submitter = *loaded_job.submitter;
+      if (!submitters.contains(submitter)) {
+         continue;
+      }
+
+      // A job's items are the ones added from here on, which mustn't be another job's
+      auto first = static_cast<TaskId>(tasks.size());
+      if (error.empty() && jobs.contains(first)) {
+         error = "another job starts at the same work item";
+      }
+
+      if (!error.empty()) {
+         // The submitter learns of it by being dropped
+         std::cerr << "job " << loaded_job.list_location << " rejected: " << error << std::endl;
+         submitters.erase(submitter);
+         server.disconnect(submitter);
+         continue;
+      }
+
+      auto job = jobs.emplace(first, std::move(loaded_job)).first;
+      queue_job(job, list);
+      std::cerr << "job " << job->second.list_location << " queued: " << job->second.work_left.size() << " work items, " << jobs.size() << " jobs active" << std::endl;
+
+      // Everything may have been served from the cache
+      if (job_finished(job->second)) {
+         complete_job(job);
+      }
+   }
+
+   // Idle workers shouldn't wait for their next heartbeat
+   dispatch_to_idle_workers();
+
+   return WorkerAction();
+}
+
+WorkerAction Coordinator::cancel_jobs(unsigned int submitter) {
+   for (auto job = jobs.begin(); job != jobs.end();) {
+      auto next = std::next(job);
+      if (job->second.submitter == submitter) {
+         job->second.cancelled = true;
+         job->second.work_left = TaskQueue{};
+         if (job_finished(job->second)) {
+            complete_job(job);
+         }
+      }
+      job = next;
+   }
+
+   return WorkerAction();
+}
+
+void Coordinator::scale_pool() {
+   auto cores = utils::available_cores();
+   if (auto cpu{pool.cpu_per_worker([this](unsigned int id) { return worker_busy(id); })}; cpu.has_value()) {
+      cpu_per_worker = *cpu;
+   }
+
+   // Workers mostly waiting for I/O leave room for more of them than there are cores.
+   // Each worker takes one item at a time, more workers than items would idle.
+   auto saturating = static_cast<std::size_t>(std::ceil(cores / std::max(cpu_per_worker, MIN_CPU_PER_WORKER)));
+   auto demand = queued_work() + assigned_work.size();
+   auto target = std::min({static_cast<std::size_t>(pool.capacity()), saturating, demand});
+
+   if (pool.size() < target) {
+      // Grow by doubling at most, so a target based on a stale measurement isn't overshot by much
+      auto start = std::min(target - pool.size(), std::max(pool.size(), std::size_t{1}));
+      for (std::size_t i = 0; i < start; i++) {
+         tracer.record(TraceEventKind::CONNECT, pool.spawn(server));
+      }
+   } else if (pool.size() > target) {
+      // In the tail, retire idle workers rather than paying for them. Busy ones finish first.
+      auto excess = pool.size() - target;
+      for (auto id : pool.clients()) {
+         if (excess > 0 && !worker_busy(id)) {
+            server.disconnect(id);
+            excess--;
+         }
+      }
+   }
+}
+
+std::size_t Coordinator::failed_work() const noexcept {
+   return tasks.count(TaskState::FAILED);
+}
+
+void Coordinator::start_merge(std::map<TaskId, Job>::iterator job) {
+   if (job->second.merging || job->second.unmerged.empty()) {
+      return;
+   }
+
+   // The job stays put until its merge is collected, it isn't finished before
+   job->second.merging = true;
+   merges_running++;
+   auto merge = [this, first = job->first, result = &job->second.result, unmerged = std::exchange(job->second.unmerged, {})] {
+      for (auto const& [count, serialized] : unmerged) {
+         if (!result->merge(count, serialized)) {
+            std::cerr << "malformed result from a worker, the result is incomplete" << std::endl;
+         }
+      }
+
+      {
+         std::unique_lock<std::mutex> lock(merged_mutex);
+         merged_jobs.push_back(first);
+      }
+      eventfd_write(merged_fd, 1);
+   };
+
+   if (merge_pool) {
+      merge_pool->submit(std::move(merge));
+   } else {
+      merge();
    }
 }
 
-Coordinator::~Coordinator() {}
+WorkerAction Coordinator::collect_merges() {
+   eventfd_t ignored;
+   eventfd_read(merged_fd, &ignored);
+   merge_watch = server.watch(merged_fd);
+
+   std::vector<TaskId> merged{};
+   {
+      std::unique_lock<std::mutex> lock(merged_mutex);
+      merged.swap(merged_jobs);
+   }
+
+   for (auto first : merged) {
+      merges_running--;
+      auto job = jobs.find(first);
+      job->second.merging = false;
+      // Summaries that arrived meanwhile go next
+      start_merge(job);
+      if (job_finished(job->second)) {
+         if (auto action{complete_job(job)}; action.kind == WorkerActionKind::EXIT) {
+            return action;
+         }
+      }
+   }
+
+   return WorkerAction();
+}
+
+Coordinator::~Coordinator() {
+   merge_pool.reset();
+   load_pool.reset();
+   close(merged_fd);
+   close(loaded_fd);
+}
 
 void Coordinator::start() {
-   // Create the server and handle Client connections
-   server = create_server();
-   server.start(port);
+   // Everything may have been served from the cache
+   if (relay() || serving() || !work_finished()) {
+      // Create the server and handle Client connections
+      server = create_server();
+      if (!options.record_path.empty()) {
+         server.record(options.record_path);
+      } else if (!options.replay_path.empty()) {
+         server.replay(options.replay_path);
+         allocation_counter::enable();
+      }
+      server.start(port);
+      merge_watch = server.watch(merged_fd);
+      load_watch = server.watch(loaded_fd);
+
+      if (relay()) {
+         upstream_id = server.connect(options.upstream_host, options.upstream_port);
+      }
+
+      if (pool.enabled()) {
+         scale_pool();
+         pool_timer = server.schedule(POOL_INTERVAL);
+      }
 
-   if (!server.run()) {
-      std::cerr << "Server failed to run" << std::endl;
+      auto allocations = allocation_counter::count();
+      auto started = std::chrono::steady_clock::now();
+      if (!server.run()) {
+         std::cerr << "Server failed to run" << std::endl;
+      }
+
+      // Scheduling changes are compared by how fast, and with how many allocations, they replay a log
+      if (!options.replay_path.empty()) {
+         auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+         auto events = server.get_stats().loop_iterations;
+         allocations = allocation_counter::count() - allocations;
+         std::cerr << "replayed " << events << " events recorded over "
+                   << std::chrono::duration<double>(server.replayed_time()).count() << "s in "
+                   << elapsed * 1000 << "ms: " << static_cast<unsigned long>(static_cast<double>(events) / elapsed)
+                   << " events/s, " << allocations << " allocations ("
+                   << static_cast<double>(allocations) / static_cast<double>(std::max(events, 1ul)) << " per event)" << std::endl;
+      }
+
+      if (options.print_stats) {
+         std::cerr << server.get_stats() << std::endl;
+      }
    }
 
-   std::cout << aggregate << std::endl;
+   cache.save();
+
+   if (tracer.enabled()) {
+      tracer.save(options.trace_path, tasks);
+   }
+
+   if (auto failed = failed_work(); failed > 0) {
+      std::cerr << "gave up on " << failed << " work items, the result is incomplete:" << std::endl;
+      for (TaskId id = 0; id < tasks.size(); id++) {
+         if (tasks.state(id) == TaskState::FAILED) {
+            std::cerr << "   " << tasks.url(id) << std::endl;
+         }
+      }
+   }
+
+   // A relay's results have all been passed upstream, a service's to the submitters
+   if (!relay() && !serving()) {
+      auto const& job = jobs.begin()->second;
+      if (job.spent.counted()) {
+         std::cerr << "where the workers' time went:" << std::endl << job.spent;
+      }
+      job.result.print(std::cout, options.top_k);
+   }
 }
 
 void Coordinator::stop() {
@@ -183,14 +1273,97 @@ void Coordinator::stop() {
 
 // The main function creating a Coordinator object
 int main(int argc, char* argv[]) {
-   if (argc != 3) {
-      std::cerr << "Usage: " << argv[0] << " <URL to csv list> <listen port>" << std::endl;
+   auto usage = [&]() {
+      std::cerr << "Usage: " << argv[0] << " <URL to csv list> <listen port | unix:<path> | shm:<path>> [--registrable-domains | --top <k>] [--cache <file>] [--max-attempts <n>] [--task-timeout <seconds>] [--trace <file>] [--pool <n>] [--record <file> | --replay <file>] [--io-uring] [--keepalive | --phi-threshold <phi>] [--counters] [--steal] [--stats]" << std::endl;
+      std::cerr << "       " << argv[0] << " --upstream <host>:<port> <listen port | unix:<path> | shm:<path>> [--credit <n>] [--max-attempts <n>] [--task-timeout <seconds>] [--trace <file>] [--pool <n>] [--record <file> | --replay <file>] [--io-uring] [--keepalive | --phi-threshold <phi>] [--counters] [--steal] [--stats]" << std::endl;
+      std::cerr << "       " << argv[0] << " --serve <listen port | unix:<path> | shm:<path>> [--cache <file>] [--max-attempts <n>] [--task-timeout <seconds>] [--trace <file>] [--pool <n>] [--record <file> | --replay <file>] [--io-uring] [--keepalive | --phi-threshold <phi>] [--counters] [--steal] [--stats]" << std::endl;
       return 1;
+   };
+
+   CoordinatorOptions options{};
+   std::vector<std::string> positional{};
+   for (auto i = 1; i < argc; i++) {
+      std::string arg{argv[i]};
+      if (arg == "--cache" && i + 1 < argc) {
+         options.cache_path = argv[++i];
+      } else if (arg == "--io-uring") {
+         options.backend = ServerBackend::IO_URING;
+      } else if (arg == "--phi-threshold" && i + 1 < argc) {
+         options.suspicion_threshold = std::clamp(std::atof(argv[++i]), 0.5, 100.0);
+      } else if (arg == "--keepalive") {
+         options.keepalive = true;
+      } else if (arg == "--counters") {
+         options.counters = true;
+      } else if (arg == "--steal") {
+         options.steal = true;
+      } else if (arg == "--stats") {
+         options.print_stats = true;
+      } else if (arg == "--serve") {
+         options.serve = true;
+      } else if (arg == "--registrable-domains") {
+         options.task = utils::TaskKind::DISTINCT_REGISTRABLE_DOMAINS;
+      } else if (arg == "--top" && i + 1 < argc) {
+         options.task = utils::TaskKind::TOP_DOMAINS;
+         options.top_k = static_cast<std::size_t>(std::max(1, std::atoi(argv[++i])));
+      } else if (arg == "--upstream" && i + 1 < argc) {
+         std::string upstream{argv[++i]};
+         auto pos = upstream.rfind(':');
+         if (utils::address_kind(upstream) != utils::AddressKind::TCP) {
+            options.upstream_host = upstream;
+         } else if (pos != std::string::npos) {
+            options.upstream_host = upstream.substr(0, pos);
+            options.upstream_port = upstream.substr(pos + 1);
+         } else {
+            return usage();
+         }
+      } else if (arg == "--credit" && i + 1 < argc) {
+         options.credit = static_cast<unsigned int>(std::max(1, std::atoi(argv[++i])));
+      } else if (arg == "--max-attempts" && i + 1 < argc) {
+         // Attempts are counted in a byte per task
+         options.max_attempts = static_cast<unsigned int>(std::clamp(std::atoi(argv[++i]), 1, 255));
+      } else if (arg == "--task-timeout" && i + 1 < argc) {
+         options.task_timeout = std::chrono::seconds(std::max(0, std::atoi(argv[++i])));
+      } else if (arg == "--pool" && i + 1 < argc) {
+         options.pool_size = static_cast<unsigned int>(std::max(0, std::atoi(argv[++i])));
+      } else if (arg == "--trace" && i + 1 < argc) {
+         options.trace_path = argv[++i];
+      } else if (arg == "--record" && i + 1 < argc) {
+         options.record_path = argv[++i];
+      } else if (arg == "--replay" && i + 1 < argc) {
+         options.replay_path = argv[++i];
+      } else if (arg.starts_with("--")) {
+         return usage();
+      } else {
+         positional.push_back(arg);
+      }
+   }
+
+   // A replay mustn't touch the cache, the recorded run already did
+   if (!options.replay_path.empty() && (!options.record_path.empty() || !options.cache_path.empty())) {
+      return usage();
+   }
+
+   auto relay = !options.upstream_host.empty();
+   if (relay) {
+      if (positional.size() != 1 || !options.cache_path.empty() || options.serve) {
+         return usage();
+      }
+
+      positional.insert(positional.begin(), std::string{});
+   } else if (options.serve) {
+      // Lists come with the jobs
+      if (positional.size() != 1) {
+         return usage();
+      }
+
+      positional.insert(positional.begin(), std::string{});
+   } else if (positional.size() != 2) {
+      return usage();
    }
 
    std::signal(SIGTERM, signal_handler);
 
-   Coordinator coordinator{std::string(argv[1]), std::string(argv[2])};
+   Coordinator coordinator{positional[0], positional[1], options};
 
    shutdown_handler = [&](int) {
       coordinator.stop();
@@ -198,5 +1371,6 @@ int main(int argc, char* argv[]) {
 
    coordinator.start();
 
-   return 0;
+   // Work that was given up on makes the result incomplete
+   return coordinator.failed_work() > 0 ? 3 : 0;
 }
@@ -5,59 +5,333 @@
 #ifndef EPOLL_WORK_QUEUE_COORDINATOR_H
 #define EPOLL_WORK_QUEUE_COORDINATOR_H
 
+#include "AllocationCounter.h"
 #include "CurlRequest.h"
+#include "ResultCache.h"
 #include "Server.h"
+#include "TaskTable.h"
+#include "Tasks.h"
+#include "ThreadPool.h"
+#include "Tracer.h"
+#include "WorkerPool.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <charconv>
 #include <chrono>
+#include <cmath>
 #include <csignal>
-#include <deque>
+#include <filesystem>
 #include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Optional behaviour of the coordinator, set from the command line
+struct CoordinatorOptions {
+   // Location of the persistent per-chunk result cache, empty to disable
+   std::string cache_path;
+   // The event loop backend of the server
+   ServerBackend backend = ServerBackend::EPOLL;
+   // Print event loop counters on exit
+   bool print_stats = false;
+   // Coordinator to relay work from, empty unless relaying
+   std::string upstream_host;
+   std::string upstream_port;
+   // How many work items a relay takes from upstream at once
+   unsigned int credit = 16;
+   // How many times a work item may fail before it is given up on
+   unsigned int max_attempts = 3;
+   // How long a worker may hold its work before it is dropped, 0 to wait forever
+   std::chrono::seconds task_timeout{0};
+   // Where to write a trace of the tasks on exit, empty to not trace
+   std::string trace_path;
+   // How many workers to run on this host at most, 0 to leave starting workers to the user
+   unsigned int pool_size = 0;
+   // Where to record the events of the server, empty to not record them
+   std::string record_path;
+   // Recorded events to replay instead of listening for workers, empty to listen
+   std::string replay_path;
+   // Keep running, taking jobs from clients, instead of doing the list from the command line
+   bool serve = false;
+   // What the command line's job counts
+   utils::TaskKind task = utils::TaskKind::DISTINCT_HOSTS;
+   // How many of the most frequent domains the command line's job prints
+   std::size_t top_k = 10;
+   // Leave noticing dead workers to TCP keepalive instead of heartbeats, see ServerLiveness.
+   // Workers then only heartbeat while idle and must be started with --keepalive too.
+   bool keepalive = false;
+   // The phi at which workers that went silent are dropped, see Server::set_suspicion_threshold
+   double suspicion_threshold = Server::DEFAULT_SUSPICION_THRESHOLD;
+   // Have pooled workers measure the phases of their work, see PerfCounters.h
+   bool counters = false;
+   // Have busy workers share the rows they have left with idle ones once no work is queued.
+   // Every worker must know the STEAL message then.
+   bool steal = false;
+};
+
+// A list of work items whose results add up, from the command line or submitted by a client
+struct Job {
+   // The client that submitted the job and gets its result, none for the command line's
+   std::optional<unsigned int> submitter;
+   // Where the list came from
+   std::string list_location;
+   // What the workers count
+   utils::TaskKind task = utils::TaskKind::DISTINCT_HOSTS;
+   // The work that is still to be done
+   TaskQueue work_left;
+   // Work items with workers
+   std::size_t in_flight = 0;
+   // Work items waiting to be retried
+   std::size_t retrying = 0;
+   // Work items given up on
+   std::size_t failed = 0;
+   // The results of the workers merged, of the job's task
+   tasks::AnyResult result{};
+   // Where the workers' time went, added up over their results
+   utils::Timings spent{};
+   // Results too costly to merge on the event loop, as they travelled, waiting for a merge thread
+   std::vector<std::pair<std::size_t, std::string>> unmerged{};
+   bool merging = false;
+   // Did the submitter go away, so nobody is waiting for the result?
+   bool cancelled = false;
+   std::chrono::steady_clock::time_point submitted = std::chrono::steady_clock::now();
+};
+
+// The list of a job as fetched: its URLs, biggest chunk first, and the validator of each
+// of them, empty if the URL's result can't be cached
+struct JobList {
+   std::vector<std::string> urls{};
+   std::vector<std::string> validators{};
+};
+
+// A submitted job whose list is being fetched, and the list once fetched. What went wrong
+// if it couldn't be.
+struct LoadingJob {
+   Job job{};
+   JobList list{};
+   std::string error{};
+};
+
+// Work handed to a worker, and how far the worker got with it
+struct Assignment {
+   std::vector<TaskId> items;
+   // The latest checkpoint reported by the worker, and where the rows of its last item end
+   // once it shares them
+   utils::Checkpoint progress;
+   // Did the worker say it can't share what it has left?
+   bool unshareable = false;
+};
+
+// A work item whose rows are shared between workers, each taking a range of them. It counts
+// once all of its ranges are done, as the distinct hashes of the keys they found.
+struct SharedItem {
+   // The hashes found so far. Those before `sorted` are sorted and unique, those after are
+   // appended as they come until they are as many, so a key takes 8 to 16 bytes.
+   std::vector<uint64_t> keys{};
+   std::size_t sorted = 0;
+   // Ranges not done yet, the one the item was split from included
+   std::size_t ranges_left = 1;
+   // Was a range given up on? What the others found still counts, but isn't cached.
+   bool incomplete = false;
+};
 
 class Coordinator {
    public:
-   Coordinator(std::string file_location, std::string port);
+   Coordinator(std::string file_location, std::string port, CoordinatorOptions options);
    ~Coordinator();
 
    void start();
    void stop();
+   // Number of work items given up on after failing too often
+   std::size_t failed_work() const noexcept;
 
    private:
+   // Delay before the first retry of a failed work item, doubled on each further failure
+   static const constexpr auto RETRY_BACKOFF = std::chrono::seconds(1);
+   static const constexpr auto MAX_RETRY_BACKOFF = std::chrono::seconds(32);
+   // Events kept for the trace, older ones are dropped
+   static const constexpr std::size_t TRACE_CAPACITY = 1 << 18;
+   // How often the worker pool is resized
+   static const constexpr auto POOL_INTERVAL = std::chrono::seconds(1);
+   // Lower bound of the share of a core a worker is assumed to use, bounding the pool at 20 workers per core
+   static const constexpr auto MIN_CPU_PER_WORKER = 0.05;
+   // Threads merging the results of tasks that are more than a count, off the event loop
+   static const constexpr std::size_t MERGE_THREADS = 2;
+   // Threads fetching the lists of submitted jobs off the event loop. One, as the handles stay on one thread.
+   static const constexpr std::size_t LOAD_THREADS = 1;
+   // How long the work of a worker that lost its connection waits for the worker to reconnect
+   static const constexpr auto RECLAIM_WINDOW = std::chrono::seconds(5);
+
+   // Lists and HEAD requests of all jobs go through the same handles, reusing connections.
+   // Only the load thread uses them once the command line's job is loaded.
+   CurlGlobalSetup curl_setup;
+   CurlHandlePool curl_handles;
    // The Server created by the coordinator
    Server server;
    // The server port
    std::string port;
+   // Optional behaviour
+   CoordinatorOptions options;
    // A mapping of worker id to its current workload
-   std::unordered_map<unsigned int, std::string> assigned_work;
+   std::unordered_map<unsigned int, Assignment> assigned_work;
    // A mapping of worker id to its number of heatbeats
    std::unordered_map<unsigned int, unsigned int> heartbeats;
-   // The work that is still to be done
-   std::deque<std::string> work_left;
-   // the total result adding together all subresults from the workers
-   unsigned int aggregate;
+   // Every work item of the jobs
+   TaskTable tasks;
+   // A mapping of the first work item of each job to the job, its items run up to the next job's first
+   std::map<TaskId, Job> jobs;
+   // Clients that submitted jobs, they don't take work
+   std::unordered_set<unsigned int> submitters;
+   // Results of chunks computed by previous runs
+   ResultCache cache;
+   // A mapping of work item to its validator, for items that can be cached
+   std::unordered_map<TaskId, std::string> validators;
+   // A mapping of worker id to how many work items it takes at once
+   std::unordered_map<unsigned int, unsigned int> credits;
+   // Client ID of the connection to the upstream coordinator, when relaying
+   std::optional<unsigned int> upstream_id;
+   // A mapping of timer ID to the failed work item waiting for it before being retried
+   std::unordered_map<unsigned int, TaskId> retries;
+   // A mapping of worker id to the timer ID of the deadline of its current work
+   std::unordered_map<unsigned int, unsigned int> deadlines;
+   // A mapping of worker id to the token it introduced itself with, for workers that reconnect
+   std::unordered_map<unsigned int, uint64_t> tokens;
+   // A mapping of the token of a worker that lost its connection to the worker id its work is still assigned to
+   std::unordered_map<uint64_t, unsigned int> detached;
+   // A mapping of timer ID to the token of the worker whose work waits for it until then
+   std::unordered_map<unsigned int, uint64_t> reclaims;
+   // A mapping of partially done work item to where its next worker resumes it
+   std::unordered_map<TaskId, utils::Checkpoint> resume_points;
+   // A mapping of work item to how its shared rows are doing, see SharedItem
+   std::unordered_map<TaskId, SharedItem> shared_items;
+   // A mapping of the work item of a range of rows a worker gave away to the item it is a range of
+   std::unordered_map<TaskId, TaskId> ranges;
+   // A mapping of busy worker id to the idle worker id it was asked to share its work for
+   std::unordered_map<unsigned int, unsigned int> steals;
+   // Lifecycle events of the tasks, when tracing
+   Tracer tracer;
+   // Workers we started ourselves
+   WorkerPool pool;
+   // Timer ID of the next resize of the pool
+   std::optional<unsigned int> pool_timer;
+   // Share of a core a busy pooled worker used lately, until measured assume all of it
+   double cpu_per_worker;
+   // Signalled by the merge threads whenever they finish merging for a job
+   int merged_fd;
+   // Watch ID of merged_fd
+   std::optional<unsigned int> merge_watch;
+   // Merges handed to the merge threads and not yet collected
+   std::size_t merges_running;
+   // The first work items of the jobs the merge threads are done with, guarded by merged_mutex
+   std::vector<TaskId> merged_jobs;
+   std::mutex merged_mutex;
+   // Signalled by the load thread whenever it is done with the list of a submitted job
+   int loaded_fd;
+   // Watch ID of loaded_fd
+   std::optional<unsigned int> load_watch;
+   // Submitted jobs the load thread is done with, guarded by loaded_mutex
+   std::vector<LoadingJob> loaded_jobs;
+   std::mutex loaded_mutex;
+   // Declared last, so the threads are gone before what they merge into. None when replaying,
+   // which merges and loads right away instead so the replay doesn't depend on thread timing.
+   std::unique_ptr<ThreadPool> merge_pool;
+   std::unique_ptr<ThreadPool> load_pool;
 
    // Creates a new server with an appropriate callback for our purposes
    Server create_server();
    // Checks if all works has finished
    bool work_finished() const noexcept;
-   // Assigns the work item to a worker, when possible
-   std::optional<std::string> assign_work(unsigned int worker_id);
+   // Is the job from the command line done, so we should exit?
+   bool exiting() const noexcept;
+   // Are we relaying work from an upstream coordinator?
+   bool relay() const noexcept;
+   // Are we taking jobs from clients?
+   bool serving() const noexcept;
+   // Work items queued across all jobs
+   std::size_t queued_work() const noexcept;
+   // The job the work item belongs to
+   std::map<TaskId, Job>::iterator job_of(TaskId item);
+   // Checks if nothing of the job is left to do
+   bool job_finished(const Job& job) const noexcept;
+   // Fetches the job's list, and the validators of its chunks when caching, on the calling
+   // thread. Touches nothing but curl_handles. Throws if the list can't be fetched.
+   JobList fetch_list(const Job& job);
+   // Adds the items of the job's list to the task table and queues those that aren't cached
+   void queue_job(std::map<TaskId, Job>::iterator job, const JobList& list);
+   // Has the load thread fetch the list of a job from a client, who gets its result once it's done
+   WorkerAction submit_job(unsigned int submitter, std::string list_location, utils::TaskKind task);
+   // Queues the submitted jobs whose lists the load thread is done with, dropping the
+   // submitters of lists that couldn't be fetched
+   WorkerAction collect_loads();
+   // Drops the queued work of the client's jobs, what is with workers runs out
+   WorkerAction cancel_jobs(unsigned int submitter);
+   // Assigns work items to a worker, when possible, returning the message handing them over.
+   // Once none are queued, with --steal, a busy worker is asked to share its work instead.
+   std::optional<std::vector<char>> assign_work(unsigned int worker_id);
+   // Asks the busy worker with the least done of its last item to give half of the rest
+   // of its rows to an idle worker, unless one was asked for the idle worker already
+   void request_steal(unsigned int thief_id);
+   // Queues the range of rows a worker gave away as a work item of its own
+   void share_work(unsigned int worker_id, const utils::Checkpoint& range);
+   // Adds the keys found in a range of a shared item, counting the item once all of its
+   // ranges are done. No keys for a range that was given up on.
+   void finish_range(Job& job, TaskId item, const std::vector<uint64_t>* keys);
+   // Adds keys a worker found in its range of a shared item ahead of its result. They are
+   // keys of the item whatever becomes of the range.
+   void add_range_keys(unsigned int worker_id, const std::vector<uint64_t>& keys);
+   // Adds a work item to the table and queues it
+   void add_work(std::string_view url);
+   // Remembers how far a worker got with its work
+   void record_progress(unsigned int worker_id, utils::Checkpoint progress);
    // Get the heartbeat counter for a worker
    unsigned int get_heartbeat(unsigned int worker_id) const noexcept;
    // Increments the heatbeat counter for this worker
    void increment_heartbeat(unsigned int worker_id) noexcept;
    // Check if this worker is currently processing work
    bool worker_busy(unsigned int worker_id) const noexcept;
-   // Mark work of this worker as finished, remove it from the workload map
-   void finish_work(unsigned int worker_id);
-   // removes the worker from the workload map and adds the associated work back to the queue
-   void remove_worker(unsigned int worker_id);
+   // Sends work to every worker that is ready for it but has none
+   void dispatch_to_idle_workers();
+   // Mark work of this worker as finished, remove it from the workload map.
+   // Returns the job of the work, or the end of the jobs if the worker had none.
+   std::map<TaskId, Job>::iterator finish_work(unsigned int worker_id, const utils::ProtocolEvent& result);
+   // removes the worker from the workload map and schedules the associated work for a retry.
+   // Returns the job of the work, or the end of the jobs if the worker had none.
+   std::map<TaskId, Job>::iterator remove_worker(unsigned int worker_id);
+   // Takes note of the token a worker introduced itself with. A worker that reconnected
+   // gets back the work it still has, other work it had is retried.
+   WorkerAction greet(unsigned int worker_id, const utils::ProtocolEvent& hello);
+   // Keeps the work of a worker that lost its connection for RECLAIM_WINDOW, in case it
+   // reconnects. Returns false if the worker won't reconnect or had no work.
+   bool detach_worker(unsigned int worker_id);
+   // Tells the workers that would reconnect otherwise that we're done
+   void farewell();
+   // Handles a timer set by schedule_retry(), assign_work() or detach_worker()
+   WorkerAction handle_timer(unsigned int timer_id);
+   // Queues the work item of the job again after a delay growing with its failures, or gives up on it
+   void schedule_retry(Job& job, TaskId item);
+   // Lets the upstream coordinator, the submitter or the caller know that the job has been handled
+   WorkerAction complete_job(std::map<TaskId, Job>::iterator job);
+   // Starts the task table over, once no work refers to its tasks: no job is left, or
+   // a relay handed its batch upstream
+   void forget_tasks();
+   // Starts or retires pooled workers to match the work left and how CPU bound the workers are
+   void scale_pool();
+   // Hands the job's unmerged results to a merge thread, unless one is merging for the job already
+   void start_merge(std::map<TaskId, Job>::iterator job);
+   // Collects the merges the threads are done with, completing jobs they held up
+   WorkerAction collect_merges();
 };
 
 #endif //EPOLL_WORK_QUEUE_COORDINATOR_H
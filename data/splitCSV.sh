@@ -1,19 +1,43 @@
 #!/usr/bin/env bash
 set -euo pipefail
 
-if [ "$#" -ne 1 ]; then
-  echo "Usage: $(basename "$0") <path/to/file.csv>"
+usage() {
+  echo "Usage: $(basename "$0") [--gzip[=level]] <path/to/file.csv>"
   exit 1
+}
+
+gzip_level=""
+if [ "$#" -eq 2 ]; then
+  case "$1" in
+    --gzip) gzip_level=6 ;;
+    --gzip=[1-9]) gzip_level="${1#--gzip=}" ;;
+    *) usage ;;
+  esac
+  shift
+fi
+
+if [ "$#" -ne 1 ]; then
+  usage
 fi
 
 file_base=${1%.*}
 file_ext="${1##*.}"
 file_path="$(dirname "$(realpath "$1")")"
 
+# Drop chunks of a previous run, compressed or not
+find "$file_path" -name "$(basename "$file_base.*.$file_ext")*" -delete
+
 # Split the csv into 100 equal chunks
 split --number=r/100 --numeric-suffixes "$file_base.$file_ext" "$file_base." --additional-suffix=".$file_ext"
 
+# Optionally compress the chunks, workers decompress them while streaming
+chunk_ext="$file_ext"
+if [ -n "$gzip_level" ]; then
+  find "$file_path" -name "$(basename "$file_base.*.$file_ext")" -exec gzip -f "-$gzip_level" {} +
+  chunk_ext="$file_ext.gz"
+fi
+
 # And generate a curl compatible file list
-find "$file_path" -name "$(basename "$file_base.*.$file_ext")" > "$file_path/filelist.csv"
+find "$file_path" -name "$(basename "$file_base.*.$chunk_ext")" > "$file_path/filelist.csv"
 sed -i 's|^|file://|' "$file_path/filelist.csv"
 sort -o "$file_path/filelist.csv" "$file_path/filelist.csv"
@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+if [ "$#" -ne 1 ]; then
+  echo "Usage: $(basename "$0") <path/to/file.csv>"
+  exit 1
+fi
+test -f "$1" || (echo "\"$1\": No such file or directory" && exit 1)
+
+# Prepare the data
+data/splitCSV.sh "$1"
+
+# Spawn the root coordinator process
+build/coordinator "file://$(dirname "$(realpath "$1")")/filelist.csv" 4242 &
+sleep 0.5
+
+# Spawn two relays pulling batches from the root
+build/coordinator --upstream localhost:4242 4243 --credit 8 &
+build/coordinator --upstream localhost:4242 4244 --credit 8 &
+
+# Spawn some workers behind each relay
+for _ in {1..4}; do
+  build/worker "localhost" "4243" &
+  build/worker "localhost" "4244" &
+done
+
+# And wait for completion
+time wait
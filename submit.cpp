@@ -0,0 +1,84 @@
+//
+// Created by marcin on 10/19/26.
+//
+
+#include "LeaderConnection.h"
+#include "Tasks.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+/// Submits a job to a coordinator running with --serve and prints its result
+/// once it is done. The job is cancelled if we go away before that.
+/// With --registrable-domains it counts registrable domains instead of hosts,
+/// with --top <k> it prints the number of rows and the k most frequent hosts.
+/// Example:
+///    ./submit localhost 4242 http://example.org/filelist.csv
+///    ./submit unix:/tmp/ewq.sock http://example.org/filelist.csv --registrable-domains
+///    ./submit localhost 4242 http://example.org/filelist.csv --top 20
+int main(int argc, char* argv[]) {
+   auto task = utils::TaskKind::DISTINCT_HOSTS;
+   std::size_t top_k{};
+   if (argc > 1 && std::string{argv[argc - 1]} == "--registrable-domains") {
+      task = utils::TaskKind::DISTINCT_REGISTRABLE_DOMAINS;
+      argc--;
+   } else if (argc > 2 && std::string{argv[argc - 2]} == "--top") {
+      task = utils::TaskKind::TOP_DOMAINS;
+      top_k = static_cast<std::size_t>(std::max(1, std::atoi(argv[argc - 1])));
+      argc -= 2;
+   }
+
+   auto local = argc == 3 && utils::address_kind(argv[1]) != utils::AddressKind::TCP;
+   if (argc != 4 && !local) {
+      std::cerr << "Usage: " << argv[0] << " <host> <port> <URL to csv list> [--registrable-domains | --top <k>]" << std::endl;
+      std::cerr << "       " << argv[0] << " unix:<path> | shm:<path> <URL to csv list> [--registrable-domains | --top <k>]" << std::endl;
+      return 1;
+   }
+
+   std::string host{argv[1]};
+   std::string port{local ? "" : argv[2]};
+
+   std::unique_ptr<LeaderConnection> coordinator;
+   try {
+      coordinator = std::make_unique<LeaderConnection>(host, port);
+   } catch (const std::runtime_error& e) {
+      std::cerr << "submit: " << e.what() << std::endl;
+      return 2;
+   }
+
+   utils::ProtocolEvent job{argv[local ? 2 : 3]};
+   job.kind = utils::ProtocolEventKind::JOB;
+   job.task = task;
+   coordinator->send(job.marshal());
+
+   // Heartbeats keep the connection from timing out while the job runs
+   while (true) {
+      if (!coordinator->wait(std::chrono::seconds(1))) {
+         coordinator->send(utils::ProtocolEvent().marshal());
+         continue;
+      }
+
+      auto received{coordinator->receive()};
+      if (!received.has_value()) {
+         std::cerr << "submit: the coordinator dropped the job" << std::endl;
+         return 2;
+      }
+
+      if (auto proto{utils::unmarshal_proto(*received)}; proto.has_value() && proto->kind == utils::ProtocolEventKind::RESULT) {
+         tasks::AnyResult result{task};
+         if (!result.merge(proto->result, proto->summary)) {
+            std::cerr << "submit: malformed result " << proto->result << std::endl;
+            return 2;
+         }
+
+         result.print(std::cout, top_k);
+         return 0;
+      }
+   }
+}
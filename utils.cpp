@@ -4,6 +4,21 @@
 
 #include "utils.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cinttypes>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <netinet/tcp.h>
+#include <sched.h>
+
 namespace utils {
 bool make_socket_nonblocking(int fd) {
    auto flags = fcntl(fd, F_GETFL, 0);
@@ -29,6 +44,15 @@ bool add_descriptor_to_epoll(int epoll_fd, int client_fd, unsigned int events) {
    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event) >= 0;
 }
 
+bool modify_descriptor_in_epoll(int epoll_fd, int client_fd, unsigned int events) {
+   struct epoll_event event;
+
+   event.events = events;
+   event.data.fd = client_fd;
+
+   return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client_fd, &event) >= 0;
+}
+
 bool remove_client_from_epoll(int epoll_fd, int client_fd) {
    return epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, NULL) >= 0;
 }
@@ -39,6 +63,49 @@ std::string ip_address_to_string(const struct sockaddr_in& addr) {
    return std::string(s);
 }
 
+std::string peer_address_to_string(const struct sockaddr_storage& addr) {
+   char s[INET6_ADDRSTRLEN];
+
+   switch (addr.ss_family) {
+      case AF_INET:
+         inet_ntop(AF_INET, &reinterpret_cast<const struct sockaddr_in&>(addr).sin_addr, s, sizeof s);
+         return std::string(s);
+      case AF_INET6:
+         inet_ntop(AF_INET6, &reinterpret_cast<const struct sockaddr_in6&>(addr).sin6_addr, s, sizeof s);
+         return std::string(s);
+      case AF_UNIX: return "unix";
+      default: return "unknown";
+   }
+}
+
+unsigned short peer_port(const struct sockaddr_storage& addr) {
+   switch (addr.ss_family) {
+      case AF_INET: return ntohs(reinterpret_cast<const struct sockaddr_in&>(addr).sin_port);
+      case AF_INET6: return ntohs(reinterpret_cast<const struct sockaddr_in6&>(addr).sin6_port);
+      default: return 0;
+   }
+}
+
+AddressKind address_kind(const std::string& address) {
+   if (address.starts_with("unix:")) {
+      return AddressKind::UNIX;
+   }
+
+   if (address.starts_with("shm:")) {
+      return AddressKind::SHM;
+   }
+
+   if (address.starts_with("fd:")) {
+      return AddressKind::FD;
+   }
+
+   return AddressKind::TCP;
+}
+
+std::string address_path(const std::string& address) {
+   return address.substr(address.find(':') + 1);
+}
+
 int create_epoll_fd() {
    auto epoll_fd = epoll_create1(0);
    if (epoll_fd == -1) {
@@ -74,6 +141,10 @@ int create_tcp_fd(const std::string& port) {
          continue;
       }
 
+      // Let back to back runs rebind while old connections sit in TIME_WAIT
+      int reuse = 1;
+      setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
       getaddrinfo_ret = bind(socket_fd, info->ai_addr, info->ai_addrlen);
       if (getaddrinfo_ret == 0) {
          break;
@@ -91,17 +162,134 @@ int create_tcp_fd(const std::string& port) {
    return socket_fd;
 }
 
-int create_timer_fd(std::chrono::seconds expiry) {
+int connect_tcp_fd(const std::string& host, const std::string& port) {
+   struct addrinfo hints, *servinfo, *p;
+
+   memset(&hints, 0, sizeof hints);
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+
+   if (auto rv = getaddrinfo(host.c_str(), port.c_str(), &hints, &servinfo); rv != 0) {
+      throw std::runtime_error("getaddrinfo: " + std::string(gai_strerror(rv)));
+   }
+
+   int socket_fd = -1;
+
+   // loop through all the results and connect to the first we can
+   for (p = servinfo; p != nullptr; p = p->ai_next) {
+      if ((socket_fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
+         perror("client: socket");
+         continue;
+      }
+
+      if (connect(socket_fd, p->ai_addr, p->ai_addrlen) == -1) {
+         close(socket_fd);
+         perror("client: connect");
+         continue;
+      }
+
+      break;
+   }
+
+   freeaddrinfo(servinfo);
+
+   if (p == nullptr) {
+      throw std::runtime_error("failed to connect to " + host + ':' + port);
+   }
+
+   return socket_fd;
+}
+
+namespace {
+struct sockaddr_un unix_address(const std::string& path) {
+   struct sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+
+   if (path.size() >= sizeof(addr.sun_path)) {
+      throw std::runtime_error("unix socket path too long: " + path);
+   }
+
+   memcpy(addr.sun_path, path.c_str(), path.size());
+   return addr;
+}
+}
+
+int create_unix_fd(const std::string& path) {
+   auto addr{unix_address(path)};
+
+   auto socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (socket_fd == -1) {
+      throw std::runtime_error("failed to allocate socket");
+   }
+
+   // a previous run may have left its socket file behind
+   unlink(path.c_str());
+
+   if (bind(socket_fd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+      close(socket_fd);
+      throw std::runtime_error("bind to " + path + " failed: " + std::string(std::strerror(errno)));
+   }
+
+   return socket_fd;
+}
+
+int connect_unix_fd(const std::string& path) {
+   auto addr{unix_address(path)};
+
+   auto socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (socket_fd == -1) {
+      throw std::runtime_error("failed to allocate socket");
+   }
+
+   if (connect(socket_fd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+      close(socket_fd);
+      throw std::runtime_error("failed to connect to " + path + ": " + std::string(std::strerror(errno)));
+   }
+
+   return socket_fd;
+}
+
+bool enable_keepalive(int fd, std::chrono::seconds timeout) {
+   int domain{};
+   socklen_t size = sizeof(domain);
+   if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &size) == -1) {
+      return false;
+   }
+
+   if (domain != AF_INET && domain != AF_INET6) {
+      return true;
+   }
+
+   // Probes start after a third of the timeout without traffic and go out every second,
+   // TCP_USER_TIMEOUT then cuts the connection off at the timeout
+   int enable = 1;
+   int idle = static_cast<int>(std::max<std::chrono::seconds::rep>(timeout.count() / 3, 1));
+   int interval = 1;
+   int probes = static_cast<int>(std::max<std::chrono::seconds::rep>(timeout.count() - idle, 1));
+   auto user_timeout = static_cast<unsigned int>(std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count());
+
+   return setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable)) == 0 &&
+          setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) == 0 &&
+          setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) == 0 &&
+          setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes)) == 0 &&
+          setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout)) == 0;
+}
+
+static struct timespec to_timespec(std::chrono::nanoseconds duration) {
+   auto seconds = std::chrono::duration_cast<std::chrono::seconds>(duration);
+   return {seconds.count(), (duration - seconds).count()};
+}
+
+int create_timer_fd(std::chrono::nanoseconds expiry, std::chrono::nanoseconds interval) {
    auto timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
    if (timer_fd == -1) {
       throw std::runtime_error("timerfd_create failed");
    }
 
    struct itimerspec ts;
-   ts.it_interval.tv_sec = 0;
-   ts.it_interval.tv_nsec = 0;
-   ts.it_value.tv_sec = expiry.count();
-   ts.it_value.tv_nsec = 0;
+   ts.it_interval = to_timespec(interval);
+   ts.it_value = to_timespec(expiry);
 
    if (timerfd_settime(timer_fd, 0, &ts, NULL) < 0) {
       throw std::runtime_error("timerfd_settime failed");
@@ -110,24 +298,96 @@ int create_timer_fd(std::chrono::seconds expiry) {
    return timer_fd;
 }
 
-void update_timer_fd(int timer_fd, std::chrono::seconds expiry) {
+void update_timer_fd(int timer_fd, std::chrono::nanoseconds expiry) {
    struct itimerspec ts;
    ts.it_interval.tv_sec = 0;
    ts.it_interval.tv_nsec = 0;
-   ts.it_value.tv_sec = expiry.count();
-   ts.it_value.tv_nsec = 0;
+   ts.it_value = to_timespec(expiry);
 
    if (timerfd_settime(timer_fd, 0, &ts, NULL) < 0) {
       throw std::runtime_error("timerfd_settime failed");
    }
 }
 
+std::vector<char> frame(const std::vector<char>& message) {
+   auto size = htonl(static_cast<uint32_t>(message.size()));
+
+   std::vector<char> data(sizeof(size) + message.size());
+   memcpy(data.data(), &size, sizeof(size));
+   std::copy(message.begin(), message.end(), data.begin() + sizeof(size));
+
+   return data;
+}
+
+void FrameBuffer::append(const char* data, std::size_t size) {
+   // Drop consumed frames before growing the buffer
+   if (offset > 0 && offset == buffer.size()) {
+      buffer.clear();
+      offset = 0;
+   } else if (offset > buffer.size() / 2) {
+      buffer.erase(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(offset));
+      offset = 0;
+   }
+
+   buffer.insert(buffer.end(), data, data + size);
+
+   // Fail fast on a peer that isn't speaking our framing
+   if (auto next_size{frame_size()}; next_size.has_value() && *next_size > MAX_FRAME_SIZE) {
+      corrupt = true;
+   }
+}
+
+std::optional<std::size_t> FrameBuffer::frame_size() const {
+   uint32_t size;
+   if (buffer.size() - offset < sizeof(size)) {
+      return {};
+   }
+
+   memcpy(&size, buffer.data() + offset, sizeof(size));
+   return ntohl(size);
+}
+
+bool FrameBuffer::ready() const {
+   if (auto size{frame_size()}; size.has_value()) {
+      return buffer.size() - offset - sizeof(uint32_t) >= *size;
+   }
+
+   return false;
+}
+
+std::optional<std::vector<char>> FrameBuffer::next() {
+   auto size{frame_size()};
+   if (!size.has_value()) {
+      return {};
+   }
+
+   if (*size > MAX_FRAME_SIZE) {
+      corrupt = true;
+      return {};
+   }
+
+   if (!ready()) {
+      return {};
+   }
+
+   auto begin = buffer.begin() + static_cast<std::ptrdiff_t>(offset + sizeof(uint32_t));
+   std::vector<char> message(begin, begin + static_cast<std::ptrdiff_t>(*size));
+   offset += sizeof(uint32_t) + *size;
+
+   return message;
+}
+
+bool FrameBuffer::is_corrupt() const noexcept {
+   return corrupt;
+}
+
 bool send_to_socket(int socket_fd, std::vector<char> message) {
+   auto data{frame(message)};
    size_t total_sent{};
-   auto message_size{message.size()};
+   auto data_size{data.size()};
 
-   while (total_sent < message_size) {
-      auto write_ret = write(socket_fd, &message[total_sent], (message_size - total_sent));
+   while (total_sent < data_size) {
+      auto write_ret = send(socket_fd, &data[total_sent], (data_size - total_sent), MSG_NOSIGNAL);
       if (write_ret < 0) {
          return false;
       }
@@ -138,39 +398,413 @@ bool send_to_socket(int socket_fd, std::vector<char> message) {
    return true;
 }
 
-std::optional<std::vector<char>> read_from_socket(int socket_fd) {
+std::optional<std::vector<char>> read_from_socket(int socket_fd, FrameBuffer& frames) {
    char buffer[512];
-   std::vector<char> message{};
 
-   while (true) {
+   while (!frames.ready()) {
+      if (frames.is_corrupt()) {
+         return {};
+      }
+
       auto recv_ret = recv(socket_fd, buffer, sizeof(buffer), 0);
-      if (recv_ret == sizeof(buffer)) {
-         std::copy(buffer, buffer + recv_ret, std::back_inserter(message));
-      } else if (recv_ret > 0 && recv_ret < static_cast<ssize_t>(sizeof(buffer))) {
-         std::copy(buffer, buffer + recv_ret, std::back_inserter(message));
-         return message;
-      } else if (recv_ret <= 0) {
+      if (recv_ret <= 0) {
          return {};
-      } else {
-         throw std::runtime_error("recv_ret < 0 and" + std::string(std::strerror(errno)));
+      }
+
+      frames.append(buffer, static_cast<std::size_t>(recv_ret));
+   }
+
+   return frames.next();
+}
+
+uint64_t stable_hash(std::string_view data) {
+   // FNV-1a, then the splitmix64 finalizer to spread the bits
+   uint64_t h{0xcbf29ce484222325};
+   for (auto c : data) {
+      h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+   }
+
+   h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9;
+   h = (h ^ (h >> 27)) * 0x94d049bb133111eb;
+   return h ^ (h >> 31);
+}
+
+std::optional<std::size_t> parse_size(const std::string& text) {
+   // strtoull would take a sign, and wrap a negative number around
+   if (text.empty() || !std::isdigit(static_cast<unsigned char>(text.front()))) {
+      return {};
+   }
+
+   char* end{};
+   errno = 0;
+   auto size = std::strtoull(text.c_str(), &end, 10);
+   if (errno == ERANGE) {
+      return {};
+   }
+
+   auto shift = 0u;
+   switch (*end) {
+      case 'k': shift = 10; end++; break;
+      case 'm': shift = 20; end++; break;
+      case 'g': shift = 30; end++; break;
+      default: break;
+   }
+
+   if (*end != '\0' || size == 0 || size > (std::numeric_limits<std::size_t>::max() >> shift)) {
+      return {};
+   }
+
+   return static_cast<std::size_t>(size) << shift;
+}
+
+unsigned int available_cores() {
+   cpu_set_t set;
+   auto cores = sched_getaffinity(0, sizeof(set), &set) == 0 ? static_cast<unsigned int>(CPU_COUNT(&set)) : std::thread::hardware_concurrency();
+
+   // cgroup v2 gives the quota and its period in microseconds, or "max" for none. Only
+   // whole cores count, a share of one more would just have the threads wait for it.
+   std::ifstream max{"/sys/fs/cgroup/cpu.max"};
+   std::string quota{};
+   uint64_t period{};
+   if (max >> quota >> period && quota != "max" && period > 0) {
+      auto whole = std::strtoull(quota.c_str(), nullptr, 10) / period;
+      cores = static_cast<unsigned int>(std::min<uint64_t>(cores, whole));
+   }
+
+   return std::max(cores, 1u);
+}
+
+namespace {
+// Domain hashes travel as 8 byte big endian numbers after a text header line
+void append_domains(std::string& r, const std::vector<uint64_t>& domains) {
+   r += '\n';
+   for (auto domain : domains) {
+      for (auto shift = 56; shift >= 0; shift -= 8) {
+         r += static_cast<char>((domain >> shift) & 0xff);
+      }
+   }
+}
+
+std::optional<std::vector<uint64_t>> parse_domains(std::string_view data) {
+   if (data.size() % sizeof(uint64_t) != 0) {
+      return {};
+   }
+
+   std::vector<uint64_t> domains(data.size() / sizeof(uint64_t));
+   for (std::size_t i = 0; i < domains.size(); i++) {
+      for (std::size_t j = 0; j < sizeof(uint64_t); j++) {
+         domains[i] = (domains[i] << 8) | static_cast<unsigned char>(data[i * sizeof(uint64_t) + j]);
+      }
+   }
+
+   return domains;
+}
+}
+
+std::string_view task_name(TaskKind task) {
+   switch (task) {
+      case TaskKind::DISTINCT_HOSTS: return "";
+      case TaskKind::DISTINCT_REGISTRABLE_DOMAINS: return "registrable";
+      case TaskKind::TOP_DOMAINS: return "top";
+   }
+
+   return "";
+}
+
+std::optional<TaskKind> task_from_name(std::string_view name) {
+   for (auto task : {TaskKind::DISTINCT_HOSTS, TaskKind::DISTINCT_REGISTRABLE_DOMAINS, TaskKind::TOP_DOMAINS}) {
+      if (task_name(task) == name) {
+         return task;
       }
    }
 
    return {};
 }
 
+PhaseCounters& PhaseCounters::operator+=(const PhaseCounters& other) noexcept {
+   cpu_ns += other.cpu_ns;
+   cycles += other.cycles;
+   instructions += other.instructions;
+   cache_misses += other.cache_misses;
+   branch_misses += other.branch_misses;
+
+   return *this;
+}
+
+PhaseCounters PhaseCounters::operator-(const PhaseCounters& other) const noexcept {
+   // Counters only go up, but a thread's CPU clock may lag behind by a tick
+   auto minus = [](uint64_t a, uint64_t b) { return a > b ? a - b : 0; };
+   return {minus(cpu_ns, other.cpu_ns), minus(cycles, other.cycles), minus(instructions, other.instructions),
+           minus(cache_misses, other.cache_misses), minus(branch_misses, other.branch_misses)};
+}
+
+uint64_t& Timings::ns(WorkPhase phase) noexcept {
+   switch (phase) {
+      case WorkPhase::FETCH: return fetch_ns;
+      case WorkPhase::PARSE: return parse_ns;
+      case WorkPhase::DEDUP: return dedup_ns;
+   }
+
+   return fetch_ns;
+}
+
+PhaseCounters& Timings::counters(WorkPhase phase) noexcept {
+   switch (phase) {
+      case WorkPhase::FETCH: return fetch;
+      case WorkPhase::PARSE: return parse;
+      case WorkPhase::DEDUP: return dedup;
+   }
+
+   return fetch;
+}
+
+bool Timings::counted() const noexcept {
+   return fetch.cpu_ns > 0 || parse.cpu_ns > 0 || dedup.cpu_ns > 0;
+}
+
+Timings& Timings::operator+=(const Timings& other) noexcept {
+   fetch_ns += other.fetch_ns;
+   parse_ns += other.parse_ns;
+   dedup_ns += other.dedup_ns;
+   fetch += other.fetch;
+   parse += other.parse;
+   dedup += other.dedup;
+
+   return *this;
+}
+
+std::ostream& operator<<(std::ostream& out, const Timings& timings) {
+   auto seconds = [](uint64_t ns) { return static_cast<double>(ns) / 1e9; };
+   auto millions = [](uint64_t count) { return static_cast<double>(count) / 1e6; };
+
+   auto flags{out.flags()};
+   auto precision{out.precision()};
+   out << std::fixed << std::setprecision(3);
+   for (auto [name, ns, counters] : {std::tuple{"fetch", timings.fetch_ns, timings.fetch},
+                                     std::tuple{"parse", timings.parse_ns, timings.parse},
+                                     std::tuple{"dedup", timings.dedup_ns, timings.dedup}}) {
+      out << "   " << name << ": " << seconds(ns) << "s, " << seconds(counters.cpu_ns) << "s CPU";
+      if (counters.cycles > 0) {
+         out << ", " << millions(counters.cycles) << "M cycles, "
+             << static_cast<double>(counters.instructions) / static_cast<double>(counters.cycles) << " instructions per cycle, "
+             << millions(counters.cache_misses) << "M cache misses, "
+             << millions(counters.branch_misses) << "M branch misses";
+      }
+      out << '\n';
+   }
+   out.flags(flags);
+   out.precision(precision);
+
+   return out;
+}
+
+namespace {
+// Counters of results go after a '|', each phase "<cpu_ns>,<cycles>,<instructions>,<cache_misses>,<branch_misses>", separated by ';'
+std::string counter_list(Timings timings) {
+   std::string list{};
+   for (auto phase : {WorkPhase::FETCH, WorkPhase::PARSE, WorkPhase::DEDUP}) {
+      auto const& c = timings.counters(phase);
+      if (!list.empty()) {
+         list += ';';
+      }
+
+      list += std::to_string(c.cpu_ns) + ',' + std::to_string(c.cycles) + ',' + std::to_string(c.instructions) + ',' +
+              std::to_string(c.cache_misses) + ',' + std::to_string(c.branch_misses);
+   }
+
+   return list;
+}
+
+bool parse_counter_list(std::string_view list, Timings& timings) {
+   for (auto phase : {WorkPhase::FETCH, WorkPhase::PARSE, WorkPhase::DEDUP}) {
+      auto& c = timings.counters(phase);
+      for (auto field : {&c.cpu_ns, &c.cycles, &c.instructions, &c.cache_misses, &c.branch_misses}) {
+         auto [ptr, ec] = std::from_chars(list.data(), list.data() + list.size(), *field);
+         if (ec != std::errc{}) {
+            return false;
+         }
+
+         list.remove_prefix(static_cast<std::size_t>(ptr - list.data()));
+         auto last = phase == WorkPhase::DEDUP && field == &c.branch_misses;
+         if (!last && (list.empty() || (list.front() != ',' && list.front() != ';'))) {
+            return false;
+         }
+
+         list.remove_prefix(last ? 0 : 1);
+      }
+   }
+
+   return list.empty();
+}
+}
+
+namespace {
+// Work and jobs of another kind than the default name it in a first line "@<name>"
+std::string task_line(TaskKind task) {
+   if (task == TaskKind::DISTINCT_HOSTS) {
+      return "";
+   }
+
+   return '@' + std::string(task_name(task)) + '\n';
+}
+
+// Takes the task line off the front of the message, if there is one
+std::optional<TaskKind> take_task_line(std::string& rest) {
+   if (!rest.starts_with('@')) {
+      return TaskKind::DISTINCT_HOSTS;
+   }
+
+   auto end = std::min(rest.find('\n'), rest.size());
+   auto task = task_from_name(std::string_view(rest).substr(1, end - 1));
+   rest.erase(0, std::min(end + 1, rest.size()));
+
+   return task;
+}
+
+// Task IDs go comma separated
+std::string id_list(const std::vector<uint32_t>& ids) {
+   std::string list{};
+   for (auto id : ids) {
+      if (!list.empty()) {
+         list += ',';
+      }
+
+      list += std::to_string(id);
+   }
+
+   return list;
+}
+
+std::optional<std::vector<uint32_t>> parse_id_list(std::string_view list) {
+   std::vector<uint32_t> ids{};
+   while (!list.empty()) {
+      uint32_t id{};
+      auto [ptr, ec] = std::from_chars(list.data(), list.data() + list.size(), id);
+      auto end = static_cast<std::size_t>(ptr - list.data());
+      if (ec != std::errc{} || (end < list.size() && *ptr != ',')) {
+         return {};
+      }
+
+      ids.push_back(id);
+      list.remove_prefix(std::min(end + 1, list.size()));
+   }
+
+   return ids;
+}
+
+// Work naming the IDs of its items has them in a line "#<id>,<id>..." after the task line
+std::string id_line(const std::vector<uint32_t>& ids) {
+   if (ids.empty()) {
+      return "";
+   }
+
+   return '#' + id_list(ids) + '\n';
+}
+
+// Takes the ID line off the front of the message, if there is one
+std::optional<std::vector<uint32_t>> take_id_line(std::string& rest) {
+   if (!rest.starts_with('#')) {
+      return std::vector<uint32_t>{};
+   }
+
+   auto end = std::min(rest.find('\n'), rest.size());
+   auto ids = parse_id_list(std::string_view(rest).substr(1, end - 1));
+   rest.erase(0, std::min(end + 1, rest.size()));
+
+   return ids;
+}
+}
+
+ProtocolEvent::ProtocolEvent(const std::vector<std::string>& work) : kind(ProtocolEventKind::WORK), result{}, work{}, credit(1), checkpoint{}, timings{}, task{}, summary{}, token(0), task_ids{} {
+   for (auto const& item : work) {
+      if (!this->work.empty()) {
+         this->work += '\n';
+      }
+
+      this->work += item;
+   }
+}
+
+std::vector<std::string> ProtocolEvent::work_items() const {
+   std::vector<std::string> items{};
+   std::istringstream lines{work};
+
+   for (std::string item; std::getline(lines, item, '\n');) {
+      if (!item.empty()) {
+         items.push_back(item);
+      }
+   }
+
+   return items;
+}
+
 std::vector<char> ProtocolEvent::marshal() const {
    std::string r;
 
    switch (kind) {
       case ProtocolEventKind::WORK:
-         r = "W:" + work;
+         if (checkpoint.offset == 0 && checkpoint.end == 0) {
+            r = "W:" + task_line(task) + id_line(task_ids) + work;
+         } else {
+            // The range, task and ID go in the header line, the hashes follow it
+            r = "C:" + std::to_string(checkpoint.offset);
+            if (checkpoint.end > 0) {
+               r += '-' + std::to_string(checkpoint.end);
+            }
+            if (task != TaskKind::DISTINCT_HOSTS) {
+               r += '@' + std::string(task_name(task));
+            }
+            if (!task_ids.empty()) {
+               r += '#' + std::to_string(task_ids.front());
+            }
+            r += ':' + work;
+            append_domains(r, checkpoint.domains);
+         }
          break;
       case ProtocolEventKind::RESULT:
          r = "R:" + std::to_string(result);
+         if (timings.fetch_ns > 0 || timings.parse_ns > 0 || timings.dedup_ns > 0) {
+            r += ':' + std::to_string(timings.fetch_ns) + ':' + std::to_string(timings.parse_ns) + ':' + std::to_string(timings.dedup_ns);
+         }
+         if (timings.counted()) {
+            r += '|' + counter_list(timings);
+         }
+         // Shared rows are counted by their hashes, results of the tasks doing so have no summary
+         if (checkpoint.end > 0) {
+            r += '/' + std::to_string(checkpoint.end);
+            append_domains(r, checkpoint.domains);
+         } else if (!summary.empty()) {
+            r += '\n' + summary;
+         }
          break;
       case ProtocolEventKind::HEARTBEAT:
-         r = "H:";
+         r = credit > 1 ? "H:" + std::to_string(credit) : "H:";
+         break;
+      case ProtocolEventKind::PROGRESS:
+         r = "P:" + std::to_string(checkpoint.items_done) + ':' + std::to_string(checkpoint.result) + ':' + std::to_string(checkpoint.offset);
+         append_domains(r, checkpoint.domains);
+         break;
+      case ProtocolEventKind::JOB:
+         r = "J:" + task_line(task) + work;
+         break;
+      case ProtocolEventKind::HELLO:
+         r = "I:" + std::to_string(token);
+         if (!task_ids.empty()) {
+            r += ':' + id_list(task_ids);
+         }
+         break;
+      case ProtocolEventKind::BYE:
+         r = "B:";
+         break;
+      case ProtocolEventKind::STEAL:
+         r = "S:";
+         if (checkpoint.end > 0) {
+            r += std::to_string(checkpoint.offset) + ':' + std::to_string(checkpoint.end);
+         }
+         break;
+      case ProtocolEventKind::KEYS:
+         r = "K:";
+         append_domains(r, checkpoint.domains);
          break;
    }
 
@@ -179,6 +813,27 @@ std::vector<char> ProtocolEvent::marshal() const {
    return data;
 }
 
+std::vector<char> marshal_work(const std::vector<std::string_view>& items, TaskKind task, const std::vector<uint32_t>& task_ids) {
+   auto header{"W:" + task_line(task) + id_line(task_ids)};
+   auto size{header.size()};
+   for (auto item : items) {
+      size += item.size() + 1;
+   }
+
+   std::vector<char> data{};
+   data.reserve(size);
+   data.insert(data.end(), header.begin(), header.end());
+   for (auto item : items) {
+      if (data.size() > header.size()) {
+         data.push_back('\n');
+      }
+
+      data.insert(data.end(), item.begin(), item.end());
+   }
+
+   return data;
+}
+
 std::optional<ProtocolEvent> unmarshal_proto(std::vector<char> raw_data) {
    std::string data(raw_data.begin(), raw_data.end());
 
@@ -189,21 +844,159 @@ std::optional<ProtocolEvent> unmarshal_proto(std::vector<char> raw_data) {
    auto prefix{data.substr(0, 2)};
    auto rest{data.erase(0, 2)};
 
-   if (prefix == "W:") {
-      return {ProtocolEvent(rest)};
+   if (prefix == "W:" || prefix == "J:") {
+      auto task{take_task_line(rest)};
+      auto ids{take_id_line(rest)};
+      if (!task.has_value() || !ids.has_value() || (prefix == "J:" && rest.empty())) {
+         return {};
+      }
+
+      ProtocolEvent work{rest};
+      work.kind = prefix == "W:" ? ProtocolEventKind::WORK : ProtocolEventKind::JOB;
+      work.task = *task;
+      work.task_ids = std::move(*ids);
+      return {work};
+   }
+
+   if (prefix == "I:") {
+      ProtocolEvent hello{};
+      hello.kind = ProtocolEventKind::HELLO;
+      auto end = std::min(rest.find(':'), rest.size());
+      auto [ptr, ec] = std::from_chars(rest.data(), rest.data() + end, hello.token);
+      if (ec != std::errc{} || ptr != rest.data() + end) {
+         return {};
+      }
+
+      auto ids{parse_id_list(std::string_view(rest).substr(std::min(end + 1, rest.size())))};
+      if (!ids.has_value()) {
+         return {};
+      }
+
+      hello.task_ids = std::move(*ids);
+      return {hello};
+   }
+
+   if (prefix == "B:") {
+      ProtocolEvent bye{};
+      bye.kind = ProtocolEventKind::BYE;
+      return {bye};
+   }
+
+   if (prefix == "S:") {
+      ProtocolEvent steal{};
+      steal.kind = ProtocolEventKind::STEAL;
+      if (!rest.empty() && (std::sscanf(rest.c_str(), "%zu:%zu", &steal.checkpoint.offset, &steal.checkpoint.end) != 2 || steal.checkpoint.offset >= steal.checkpoint.end)) {
+         return {};
+      }
+      return {steal};
    }
 
    if (prefix == "R:") {
+      // Results of older workers have no time spent deduplicating, parsing includes it
       std::size_t result;
-      if (std::sscanf(rest.c_str(), "%zu", &result)) {
-         return {ProtocolEvent(result)};
+      Timings timings{};
+      auto fields = std::sscanf(rest.c_str(), "%zu:%" SCNu64 ":%" SCNu64 ":%" SCNu64, &result, &timings.fetch_ns, &timings.parse_ns, &timings.dedup_ns);
+      if (fields != 1 && fields != 3 && fields != 4) {
+         return {};
       }
 
-      return {};
+      auto header = std::string_view(rest).substr(0, rest.find('\n'));
+      auto slash = header.find('/');
+      if (auto bar = header.find('|'); bar < slash && !parse_counter_list(header.substr(bar + 1, slash - bar - 1), timings)) {
+         return {};
+      }
+
+      ProtocolEvent event{result, timings};
+      auto pos = rest.find('\n');
+      if (slash != std::string_view::npos) {
+         // The hashes of the shared rows follow the header instead of a summary
+         auto shared = header.substr(slash + 1);
+         auto [ptr, ec] = std::from_chars(shared.data(), shared.data() + shared.size(), event.checkpoint.end);
+         auto domains{parse_domains(pos != std::string::npos ? std::string_view(rest).substr(pos + 1) : std::string_view{})};
+         if (ec != std::errc{} || ptr != shared.data() + shared.size() || event.checkpoint.end == 0 || !domains.has_value()) {
+            return {};
+         }
+
+         event.checkpoint.domains = std::move(*domains);
+      } else if (pos != std::string::npos) {
+         event.summary = rest.substr(pos + 1);
+      }
+      return {event};
    }
 
    if (prefix == "H:") {
-      return {ProtocolEvent()};
+      ProtocolEvent heartbeat{};
+      if (!rest.empty() && std::sscanf(rest.c_str(), "%u", &heartbeat.credit) != 1) {
+         return {};
+      }
+
+      heartbeat.credit = std::max(heartbeat.credit, 1u);
+      return {heartbeat};
+   }
+
+   // The binary domain hashes follow the first line
+   auto header_end = rest.find('\n');
+   if (header_end == std::string::npos) {
+      return {};
+   }
+
+   auto domains{parse_domains(std::string_view(rest).substr(header_end + 1))};
+   if (!domains.has_value()) {
+      return {};
+   }
+
+   if (prefix == "C:") {
+      Checkpoint checkpoint{};
+      auto pos = rest.find(':');
+      auto [ptr, ec] = std::from_chars(rest.data(), rest.data() + std::min(pos, rest.size()), checkpoint.offset);
+      if (pos > header_end || ec != std::errc{}) {
+         return {};
+      }
+
+      // The end of a range after the offset
+      if (*ptr == '-') {
+         auto [end_ptr, end_ec] = std::from_chars(ptr + 1, rest.data() + pos, checkpoint.end);
+         if (end_ec != std::errc{} || checkpoint.end <= checkpoint.offset) {
+            return {};
+         }
+      }
+
+      // A task named after the range, and the item's ID after that
+      std::optional<TaskKind> task{TaskKind::DISTINCT_HOSTS};
+      auto hash = std::min(rest.find('#'), pos);
+      if (auto at = rest.find('@'); at < hash) {
+         task = task_from_name(std::string_view(rest).substr(at + 1, hash - at - 1));
+      }
+      std::optional<std::vector<uint32_t>> ids{std::vector<uint32_t>{}};
+      if (hash < pos) {
+         ids = parse_id_list(std::string_view(rest).substr(hash + 1, pos - hash - 1));
+      }
+      if (!task.has_value() || !ids.has_value() || ids->size() > 1) {
+         return {};
+      }
+
+      checkpoint.domains = std::move(*domains);
+      ProtocolEvent work{rest.substr(pos + 1, header_end - pos - 1), std::move(checkpoint)};
+      work.task = *task;
+      work.task_ids = std::move(*ids);
+      return {work};
+   }
+
+   if (prefix == "P:") {
+      Checkpoint progress{};
+      if (std::sscanf(rest.c_str(), "%zu:%zu:%zu", &progress.items_done, &progress.result, &progress.offset) != 3) {
+         return {};
+      }
+
+      progress.domains = std::move(*domains);
+      return {ProtocolEvent(std::move(progress))};
+   }
+
+   if (prefix == "K:") {
+      ProtocolEvent keys{};
+      keys.kind = ProtocolEventKind::KEYS;
+      keys.checkpoint.domains = std::move(*domains);
+      return {keys};
    }
 
    return {};
@@ -6,10 +6,12 @@
 #define EPOLL_WORK_QUEUE_UTILS_H
 
 #include <chrono>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <arpa/inet.h>
 #include <fcntl.h>
@@ -17,6 +19,7 @@
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/timerfd.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 namespace utils {
@@ -24,40 +27,226 @@ bool make_socket_nonblocking(int fd);
 
 bool add_descriptor_to_epoll(int epoll_fd, int client_fd, unsigned int events);
 
+bool modify_descriptor_in_epoll(int epoll_fd, int client_fd, unsigned int events);
+
 bool remove_client_from_epoll(int epoll_fd, int client_fd);
 
 std::string ip_address_to_string(const struct sockaddr_in& addr);
 
+// Address and port of a peer of any family, Unix domain peers have no port
+std::string peer_address_to_string(const struct sockaddr_storage& addr);
+unsigned short peer_port(const struct sockaddr_storage& addr);
+
+// Addresses are either a TCP port (or host and port), "unix:<path>" for a
+// Unix domain socket, "shm:<path>" for a Unix domain socket whose messages
+// travel through a shared memory channel instead, or "fd:<number>" for a
+// connected socket inherited from the parent process
+enum class AddressKind { TCP,
+                         UNIX,
+                         SHM,
+                         FD };
+
+AddressKind address_kind(const std::string& address);
+
+// The socket path of a "unix:" or "shm:" address, or the descriptor number of an "fd:" one
+std::string address_path(const std::string& address);
+
 int create_epoll_fd();
 
 int create_tcp_fd(const std::string& port);
 
-int create_timer_fd(std::chrono::seconds expiry);
+// Connects to the first address of host:port that accepts us, returns the socket
+int connect_tcp_fd(const std::string& host, const std::string& port);
+
+// Binds a Unix domain socket to the path, replacing a stale socket file
+int create_unix_fd(const std::string& path);
+
+int connect_unix_fd(const std::string& path);
+
+// Has the kernel probe an idle TCP connection and give up on one whose peer
+// acknowledges neither probes nor data for the timeout, which the socket then
+// reports as an error. Other sockets have nothing to probe and are left alone.
+bool enable_keepalive(int fd, std::chrono::seconds timeout);
+
+// A non-zero interval makes the timer fire periodically after the first expiry
+int create_timer_fd(std::chrono::nanoseconds expiry, std::chrono::nanoseconds interval = std::chrono::nanoseconds(0));
+
+void update_timer_fd(int timer_fd, std::chrono::nanoseconds expiry);
+
+// Messages travel as frames: a 4 byte big endian length followed by the message
+std::vector<char> frame(const std::vector<char>& message);
+
+// Reassembles frames out of the bytes arriving on a stream socket
+class FrameBuffer {
+   public:
+   FrameBuffer() : buffer{}, offset(0), corrupt(false) {}
+
+   static const constexpr std::size_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
+   void append(const char* data, std::size_t size);
+   // Is a complete frame available?
+   bool ready() const;
+   // Takes the next complete frame, if any
+   std::optional<std::vector<char>> next();
+   // Did the peer announce a frame we refuse to buffer?
+   bool is_corrupt() const noexcept;
 
-void update_timer_fd(int timer_fd, std::chrono::seconds expiry);
+   private:
+   std::vector<char> buffer;
+   std::size_t offset;
+   bool corrupt;
 
+   std::optional<std::size_t> frame_size() const;
+};
+
+// Frames the message and writes all of it to a blocking socket
 bool send_to_socket(int socket_fd, std::vector<char> message);
 
-std::optional<std::vector<char>> read_from_socket(int socket_fd);
+// Returns the next message from a blocking socket, or nothing once it's closed
+std::optional<std::vector<char>> read_from_socket(int socket_fd, FrameBuffer& frames);
+
+// A hash of a string that is the same on every host, unlike std::hash
+uint64_t stable_hash(std::string_view data);
+
+// A size in bytes, optionally in k, m or g, nothing if malformed, 0 or too big
+std::optional<std::size_t> parse_size(const std::string& text);
+
+// The cores this process may run on: those of its CPU affinity, capped by the cgroup's
+// CPU quota if it has one, and at least 1
+unsigned int available_cores();
+
+// What workers compute from the rows of their work items
+enum class TaskKind { DISTINCT_HOSTS,
+                      DISTINCT_REGISTRABLE_DOMAINS,
+                      // The most frequent hosts, the result being the number of rows
+                      TOP_DOMAINS };
+
+// How a task kind is named in messages, after an '@'. Distinct hosts, the default, go unnamed.
+std::string_view task_name(TaskKind task);
+std::optional<TaskKind> task_from_name(std::string_view name);
 
 enum class ProtocolEventKind { WORK,
                                RESULT,
-                               HEARTBEAT };
+                               HEARTBEAT,
+                               PROGRESS,
+                               JOB,
+                               // A worker introducing itself on connecting, see ProtocolEvent::token
+                               HELLO,
+                               // The leader is done, its workers needn't reconnect
+                               BYE,
+                               // The leader asking a busy worker to share the rows it has left, or the worker's answer
+                               STEAL,
+                               // Hashes of the keys in a worker's rows of a shared item, ahead of its result
+                               KEYS };
+
+// The phases of a worker's work, in the order they are reported in
+enum class WorkPhase { FETCH,
+                       PARSE,
+                       DEDUP };
+
+// What the threads of a worker did during a phase, for workers started with --counters
+struct PhaseCounters {
+   // CPU time, user and kernel
+   uint64_t cpu_ns = 0;
+   // Hardware counters of user space, zero where perf_event_open isn't permitted
+   uint64_t cycles = 0;
+   uint64_t instructions = 0;
+   uint64_t cache_misses = 0;
+   uint64_t branch_misses = 0;
+
+   PhaseCounters& operator+=(const PhaseCounters& other) noexcept;
+   PhaseCounters operator-(const PhaseCounters& other) const noexcept;
+};
+
+// Where a worker's time went, reported along with its result
+struct Timings {
+   // Transferring and decoding the chunks
+   uint64_t fetch_ns = 0;
+   // Finding the domains in their rows
+   uint64_t parse_ns = 0;
+   // Adding those to the domains seen, or to the summary of top domains
+   uint64_t dedup_ns = 0;
+   PhaseCounters fetch{};
+   PhaseCounters parse{};
+   PhaseCounters dedup{};
+
+   uint64_t& ns(WorkPhase phase) noexcept;
+   PhaseCounters& counters(WorkPhase phase) noexcept;
+   // Did the worker measure its phases' counters?
+   bool counted() const noexcept;
+   Timings& operator+=(const Timings& other) noexcept;
+};
+
+// Prints a line per phase, with the time spent and what the counters say about it
+std::ostream& operator<<(std::ostream& out, const Timings& timings);
+
+// How far a worker got with its work, so another worker can pick it up from there
+struct Checkpoint {
+   // Work items of the WORK message that are finished
+   std::size_t items_done = 0;
+   // Their combined result
+   std::size_t result = 0;
+   // Bytes of the item in progress that are accounted for, always at a row boundary
+   std::size_t offset = 0;
+   // Hashes of the domains seen in those bytes. PROGRESS messages only carry
+   // those that are new since the previous one about the same item.
+   std::vector<uint64_t> domains;
+   // Where the rows of the last item end when they are shared with other workers, 0 for the
+   // end of the item. A row is part of the range its first byte is in, so the offset of a
+   // range given away may be anywhere in a row.
+   std::size_t end = 0;
+};
+
+// Hashes of keys a message carries at most, so it stays well within FrameBuffer::MAX_FRAME_SIZE
+const constexpr std::size_t MAX_MESSAGE_HASHES = FrameBuffer::MAX_FRAME_SIZE / 2 / sizeof(uint64_t);
 
 class ProtocolEvent {
    public:
-   ProtocolEvent() : kind(ProtocolEventKind::HEARTBEAT), result{}, work{} {}
-   ProtocolEvent(std::string work) : kind(ProtocolEventKind::WORK), result{}, work(work) {}
-   ProtocolEvent(std::size_t result) : kind(ProtocolEventKind::RESULT), result(result), work{} {}
+   ProtocolEvent() : kind(ProtocolEventKind::HEARTBEAT), result{}, work{}, credit(1), checkpoint{}, timings{}, task{}, summary{}, token(0), task_ids{} {}
+   ProtocolEvent(std::string work) : kind(ProtocolEventKind::WORK), result{}, work(work), credit(1), checkpoint{}, timings{}, task{}, summary{}, token(0), task_ids{} {}
+   ProtocolEvent(const std::vector<std::string>& work);
+   ProtocolEvent(std::size_t result, Timings timings = {}) : kind(ProtocolEventKind::RESULT), result(result), work{}, credit(1), checkpoint{}, timings(timings), task{}, summary{}, token(0), task_ids{} {}
+   // Work resuming a single item from where a previous worker left it
+   ProtocolEvent(std::string work, Checkpoint checkpoint) : kind(ProtocolEventKind::WORK), result{}, work(work), credit(1), checkpoint(std::move(checkpoint)), timings{}, task{}, summary{}, token(0), task_ids{} {}
+   ProtocolEvent(Checkpoint progress) : kind(ProtocolEventKind::PROGRESS), result{}, work{}, credit(1), checkpoint(std::move(progress)), timings{}, task{}, summary{}, token(0), task_ids{} {}
 
    ProtocolEventKind kind;
+   // For results, the result of all work items of the last WORK message
    std::size_t result;
+   // For work, one or more newline separated work items. For jobs, the list of the work items.
    std::string work;
-
+   // For heartbeats, how many work items the sender takes at once
+   unsigned int credit;
+   // For progress, how far the worker got. For work, where to resume its only item and
+   // where it ends. For a worker's answer to a steal, the range of rows it gave away, none
+   // if it can't share. For results of work whose last item was shared, where the worker's
+   // rows of it ended and the hashes of all of their domains, the result counting only
+   // the other items. Hashes past MAX_MESSAGE_HASHES go ahead of such a result, in KEYS
+   // messages carrying only hashes.
+   Checkpoint checkpoint;
+   // For results, where the worker's time went, if it says so. For results of a relay,
+   // the time its workers spent on the batch.
+   Timings timings;
+   // For work and jobs, what to compute
+   TaskKind task;
+   // For results of top domains, the summary of the rows (see HeavyHitters) on the lines after the header
+   std::string summary;
+   // For hellos, a number the worker picked at random when it started and keeps across
+   // reconnects, so the leader can tell it is the same worker on a new connection
+   uint64_t token;
+   // For work, the IDs the leader knows its items by, if it says. For hellos,
+   // those of the work the worker still has, to be done or its result to be sent.
+   std::vector<uint32_t> task_ids;
+
+   // Splits the work into its items
+   std::vector<std::string> work_items() const;
    std::vector<char> marshal() const;
 };
 
 std::optional<ProtocolEvent> unmarshal_proto(std::vector<char> data);
+
+// Builds the same WORK message as ProtocolEvent, straight from the items
+std::vector<char> marshal_work(const std::vector<std::string_view>& items, TaskKind task = TaskKind::DISTINCT_HOSTS, const std::vector<uint32_t>& task_ids = {});
 }
 
 #endif //EPOLL_WORK_QUEUE_UTILS_H
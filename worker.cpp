@@ -4,18 +4,36 @@
 
 using namespace std;
 
+#include "ChunkFormat.h"
 #include "Client.h"
 #include "CurlRequest.h"
+#include "GzipStream.h"
+#include "KeySpill.h"
+#include "LeaderConnection.h"
+#include "PerfCounters.h"
+#include "Tasks.h"
+#include "ThreadPool.h"
 #include "utils.h"
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <cstring>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <latch>
 #include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
 #include <sstream>
 #include <string>
 #include <string_view>
 #include <thread>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netdb.h>
@@ -23,156 +41,882 @@ using namespace std;
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-auto fetch_url_list(std::string fileLink) {
-   CurlRequest curl{curl_easy_init()};
-   curl.set_url(fileLink);
-   curl.set_timeout(30);
+// How often a worker tells the leader how far it got
+static const constexpr auto PROGRESS_INTERVAL = 1s;
+// How long the leader's host may stay silent with --keepalive
+static const constexpr auto LEADER_TIMEOUT = 5s;
+// Delay before the first attempt to reconnect to the leader, doubled after each failed one
+static const constexpr auto RECONNECT_BACKOFF = 100ms;
+static const constexpr auto MAX_RECONNECT_BACKOFF = 5s;
+// How long the leader may stay unreachable before the worker gives up and exits
+static const constexpr auto RECONNECT_WINDOW = 60s;
+// Local chunks from this size on are counted by all threads of the pool at once
+static const constexpr std::size_t PARALLEL_MIN_BYTES = 8 << 20;
+// Rows a thread maps between combining them, when mapping in parallel
+static const constexpr std::size_t PARALLEL_COMBINE_ROWS = 4096;
+// A worker keeps the rest of its chunk to itself when less than this is left, see ChunkReader::split()
+static const constexpr std::size_t STEAL_MIN_BYTES = 1 << 20;
+static const constexpr auto FILE_SCHEME = "file://"sv;
+
+// Maps the rows of a chunk that arrives in arbitrary pieces for a task, see Tasks.h.
+// Rows split across pieces are stitched back together. Binary chunks (see ChunkFormat.h)
+// are checked against their header once read in full. The rows of each piece are mapped
+// first and combined after, so the clock can tell parsing and deduplicating apart.
+// Only the rows starting in the reader's range of the chunk are mapped, which is all of
+// them unless the chunk is shared with other workers.
+template <tasks::Task T>
+class ChunkReader {
+   public:
+   explicit ChunkReader(PhaseClock& clock) : clock(&clock) {}
+   // Continues where a checkpoint of another worker left off, up to its end. A range
+   // may start in the middle of a row, so it streams in from the byte before, which
+   // tells whether a row starts at the range's first byte.
+   ChunkReader(PhaseClock& clock, const utils::Checkpoint& from)
+      requires tasks::Resumable<T>
+      : clock(&clock), consumed(from.end > 0 && from.offset > 0 ? from.offset - 1 : from.offset), begin(from.offset), end(from.end), shared(from.end > 0) {
+      T::resume(state, from);
+   }
 
-   return curl.execute();
-}
+   // Where the chunk streams in from, until the reader is fed
+   std::size_t stream_offset() const noexcept {
+      return consumed;
+   }
+
+   // Streams the chunk in from its start instead, skipping the rows before the range
+   void rewind() noexcept {
+      consumed = 0;
+   }
+
+   // The chunk has the length, so rows up to it can be given away
+   void bound(std::size_t length) noexcept {
+      if (end == 0) {
+         end = length;
+      }
+   }
+
+   bool bounded() const noexcept {
+      return end > 0;
+   }
+
+   std::size_t range_end() const noexcept {
+      return end;
+   }
+
+   // Are the rows in the range mapped, so the rest of the chunk isn't wanted?
+   bool done() const noexcept {
+      return end > 0 && consumed >= end;
+   }
+
+   // Are the chunk's rows shared with other workers?
+   bool is_shared() const noexcept {
+      return shared;
+   }
+
+   // Gives away the second half of what is left of the range, if its end is known and at
+   // least min_bytes are left, returning the range given away. Rows starting before it
+   // stay with the reader. Binary chunks can't be split, their records don't tell where
+   // they start.
+   std::optional<utils::Checkpoint> split(std::size_t min_bytes) noexcept {
+      auto position = std::max(consumed + partial_row.size(), begin);
+      if (binary || end == 0 || position >= end || end - position < min_bytes) {
+         return {};
+      }
+
+      utils::Checkpoint given{};
+      given.offset = position + (end - position) / 2;
+      given.end = end;
+      end = given.offset;
+      shared = true;
+      return given;
+   }
+
+   // Reads the chunk as a binary chunk rather than CSV. Unless reading resumes
+   // past its header, the chunk is checked against the header when finished.
+   void read_binary() {
+      binary = true;
+      verifying = consumed == 0;
+   }
+
+   void feed(std::string_view data) {
+      clock->enter(utils::WorkPhase::PARSE);
+      if (binary) {
+         map_records(data);
+      } else {
+         map_rows(data);
+      }
+      combine();
+   }
+
+   // The state of the whole chunk, throws if a binary chunk turns out to be corrupt
+   typename T::State finish() {
+      if (binary) {
+         if (!partial_row.empty() || (verifying && (!header.has_value() || records != header->rows || checksum != header->checksum || consumed != chunk_format::HEADER_SIZE + header->payload_size))) {
+            throw std::runtime_error("corrupt binary chunk");
+         }
+      } else if (!partial_row.empty() && consumed >= begin && (end == 0 || consumed < end)) {
+         clock->enter(utils::WorkPhase::PARSE);
+         consumed += partial_row.size();
+         map_row(partial_row);
+         partial_row.clear();
+         combine();
+      }
+
+      return std::move(state);
+   }
+
+   // Bytes of the chunk whose rows are accounted for, a row still being stitched together is not
+   std::size_t offset() const noexcept {
+      return std::max(consumed, begin);
+   }
+
+   // Where the reader's range starts, 0 unless given a range
+   std::size_t range_begin() const noexcept {
+      return begin;
+   }
+
+   // Keeps the keys first seen from now on, for take_new_keys()
+   void track_new_keys()
+      requires tasks::Resumable<T>
+   {
+      T::track_new_keys(state);
+   }
+
+   // The hashes of the keys first seen since the previous call
+   std::vector<uint64_t> take_new_keys()
+      requires tasks::Resumable<T>
+   {
+      return T::take_new_keys(state);
+   }
+
+   private:
+   PhaseClock* clock;
+   typename T::State state{};
+   bool binary{};
+   // Binary chunks only
+   bool verifying{};
+   std::optional<chunk_format::Header> header{};
+   uint64_t records{};
+   uLong checksum = crc32(0, nullptr, 0);
+   std::string partial_row{};
+   // Where the next row starts, or the bytes before the range that are skipped
+   std::size_t consumed{};
+   // The range of the chunk whose rows are mapped, an end of 0 being the chunk's end
+   std::size_t begin{};
+   std::size_t end{};
+   bool shared{};
+
+   // Combines what the piece's rows mapped to, then goes back to fetching
+   void combine() {
+      clock->enter(utils::WorkPhase::DEDUP);
+      T::combine(state);
+      clock->enter(utils::WorkPhase::FETCH);
+   }
+
+   void map_rows(std::string_view data) {
+      while (!data.empty()) {
+         // Rows from the end on are another worker's
+         if (done()) {
+            partial_row.clear();
+            return;
+         }
+
+         auto pos = data.find('\n');
+         if (pos == std::string_view::npos) {
+            partial_row.append(data);
+            return;
+         }
+
+         auto in_range = consumed >= begin;
+         consumed += partial_row.size() + pos + 1;
+         if (!in_range) {
+            partial_row.clear();
+         } else if (partial_row.empty()) {
+            map_row(data.substr(0, pos));
+         } else {
+            partial_row.append(data.substr(0, pos));
+            map_row(partial_row);
+            partial_row.clear();
+         }
+
+         data.remove_prefix(pos + 1);
+      }
+   }
+
+   // Maps the records of a binary chunk, partial_row holding one split across pieces
+   void map_records(std::string_view data) {
+      while (!data.empty()) {
+         // The header, when reading from the start
+         if (verifying && !header.has_value()) {
+            auto take = std::min(chunk_format::HEADER_SIZE - partial_row.size(), data.size());
+            partial_row.append(data.substr(0, take));
+            data.remove_prefix(take);
+            if (partial_row.size() == chunk_format::HEADER_SIZE) {
+               header = chunk_format::decode_header(partial_row);
+               if (!header.has_value()) {
+                  throw std::runtime_error("not a binary chunk");
+               }
+
+               consumed += chunk_format::HEADER_SIZE;
+               partial_row.clear();
+            }
+            continue;
+         }
+
+         if (!partial_row.empty()) {
+            // First the size field, then the rest of the record
+            auto wanted = partial_row.size() < 2 ? 2 : chunk_format::record_size(partial_row);
+            auto take = std::min(wanted - partial_row.size(), data.size());
+            partial_row.append(data.substr(0, take));
+            data.remove_prefix(take);
+            if (partial_row.size() >= 2 && partial_row.size() == chunk_format::record_size(partial_row)) {
+               map_record(partial_row);
+               partial_row.clear();
+            }
+            continue;
+         }
 
-auto count_unique_domains(std::stringstream fileList) {
-   std::unordered_set<std::string> domains_seen{};
+         if (data.size() < 2 || data.size() < chunk_format::record_size(data)) {
+            partial_row.append(data);
+            return;
+         }
+
+         auto size = chunk_format::record_size(data);
+         map_record(data.substr(0, size));
+         data.remove_prefix(size);
+      }
+   }
+
+   void map_record(std::string_view record) {
+      consumed += record.size();
+      records++;
+      if (verifying) {
+         checksum = crc32(checksum, reinterpret_cast<const Bytef*>(record.data()), static_cast<uInt>(record.size()));
+      }
 
-   for (std::string row; getline(fileList, row, '\n');) {
+      map_column(record.substr(2));
+   }
+
+   void map_row(std::string_view row) {
       if (auto pos = row.find_first_of(","); pos != std::string::npos) {
-         auto url = std::string_view(row).substr(0, pos);
+         map_column(row.substr(0, pos));
+      }
+   }
+
+   void map_column(std::string_view url) {
+      tasks::KeyBuffer buffer;
+      T::map(state, T::key(url, buffer));
+   }
+};
+
+// Maps a local file on every thread of the pool, each thread mapping a line-aligned
+// segment into a state of its own, and returns the file's result. The states are
+// absorbed into one and reduced, unless the task splits them into parts by key: then
+// each thread absorbs and reduces one part across the segments, so no state ever holds
+// every key and nothing is absorbed serially. A checkpoint resumes at its offset.
+// Returns nothing if the file is better fetched as usual: too small, not one we can
+// read, or with a single core available, where the threads would only take turns.
+// Mapping the segments is parsing as far as the clock is concerned, although the
+// segments are combined meanwhile, and absorbing them is deduplicating. The counters of
+// the pool's threads are added to the clock's phases. Under a memory budget files are
+// streamed instead, as the states of every thread hold their keys until split.
+template <tasks::Task T>
+std::optional<typename T::Result> map_file_in_parallel(const std::string& path, const utils::Checkpoint* resume, ThreadPool& pool, PhaseClock& clock) {
+   if (pool.size() < 2 || key_spill::limited()) {
+      return {};
+   }
+
+   auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd == -1) {
+      return {};
+   }
+
+   struct stat st;
+   if (fstat(fd, &st) == -1 || static_cast<std::size_t>(st.st_size) < PARALLEL_MIN_BYTES) {
+      close(fd);
+      return {};
+   }
+
+   auto size = static_cast<std::size_t>(st.st_size);
+   auto mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (mapped == MAP_FAILED) {
+      return {};
+   }
+
+   madvise(mapped, size, MADV_SEQUENTIAL);
+   std::string_view file{static_cast<const char*>(mapped), size};
+   auto start = resume != nullptr ? std::min(resume->offset, size) : 0;
+
+   // Segments start right after a newline, so none splits a row
+   auto threads = pool.size();
+   std::vector<std::size_t> bounds{start};
+   for (std::size_t i = 1; i < threads; i++) {
+      auto newline = file.find('\n', std::max(bounds.back(), start + (size - start) * i / threads));
+      bounds.push_back(newline == std::string_view::npos ? size : newline + 1);
+   }
+   bounds.push_back(size);
+
+   // What each thread of the pool did for the current phase, added to it once done
+   std::vector<utils::PhaseCounters> spent(threads);
+   auto measure = [&](std::size_t slot, auto&& work) {
+      auto from{perf_counters::read()};
+      work();
+      spent[slot] = perf_counters::read() - from;
+   };
+   auto collect = [&](utils::WorkPhase phase) {
+      for (auto& counters : spent) {
+         clock.timings().counters(phase) += std::exchange(counters, {});
+      }
+   };
+
+   // Segments are combined every so many rows, keeping what is mapped in between small.
+   // Those of partitioned tasks are split right away, on their thread.
+   std::vector<typename T::State> segments(threads);
+   std::vector<std::vector<typename T::State>> parts(threads);
+   std::latch mapped_all{static_cast<std::ptrdiff_t>(threads)};
+   clock.enter(utils::WorkPhase::PARSE);
+   for (std::size_t segment = 0; segment < threads; segment++) {
+      pool.submit([&, segment] {
+         measure(segment, [&] {
+            tasks::KeyBuffer buffer;
+            auto rows = file.substr(bounds[segment], bounds[segment + 1] - bounds[segment]);
+            for (std::size_t row = 1; !rows.empty(); row++) {
+               auto pos = std::min(rows.find('\n'), rows.size());
+               if (auto comma = rows.substr(0, pos).find(','); comma != std::string_view::npos) {
+                  T::map(segments[segment], T::key(rows.substr(0, comma), buffer));
+               }
+               rows.remove_prefix(std::min(pos + 1, rows.size()));
 
-         if (auto pos = url.find_first_of("/"); pos != std::string::npos) {
-            domains_seen.emplace(url.substr(0, pos));
+               if (row % PARALLEL_COMBINE_ROWS == 0) {
+                  T::combine(segments[segment]);
+               }
+            }
+            T::combine(segments[segment]);
+            if constexpr (tasks::Partitioned<T>) {
+               parts[segment] = T::split(std::move(segments[segment]), threads);
+            }
+         });
+         mapped_all.count_down();
+      });
+   }
+   mapped_all.wait();
+   collect(utils::WorkPhase::PARSE);
+   munmap(mapped, size);
+
+   typename T::Result result{};
+   clock.enter(utils::WorkPhase::DEDUP);
+
+   // Keys of a checkpoint are as good as another segment's
+   if constexpr (tasks::Resumable<T>) {
+      if (resume != nullptr) {
+         typename T::State resumed{};
+         T::resume(resumed, *resume);
+         if constexpr (tasks::Partitioned<T>) {
+            parts.push_back(T::split(std::move(resumed), threads));
          } else {
-            domains_seen.emplace(url);
+            segments.push_back(std::move(resumed));
          }
       }
    }
 
-   return domains_seen.size();
+   if constexpr (tasks::Partitioned<T>) {
+      std::vector<typename T::Result> results(threads);
+      std::latch absorbed{static_cast<std::ptrdiff_t>(threads)};
+      for (std::size_t part = 0; part < threads; part++) {
+         pool.submit([&, part] {
+            measure(part, [&] {
+               typename T::State state{};
+               for (auto& segment : parts) {
+                  T::absorb(state, std::move(segment[part]));
+               }
+               T::reduce(std::move(state), results[part]);
+            });
+            absorbed.count_down();
+         });
+      }
+      absorbed.wait();
+      collect(utils::WorkPhase::DEDUP);
+
+      for (auto& part : results) {
+         T::merge(result, std::move(part));
+      }
+   } else {
+      for (std::size_t i = 1; i < segments.size(); i++) {
+         T::absorb(segments.front(), std::move(segments[i]));
+      }
+      T::reduce(std::move(segments.front()), result);
+   }
+   clock.enter(utils::WorkPhase::FETCH);
+
+   return result;
 }
 
-/// Client process that receives a list of URLs and reports the result
-/// Example:
-///    ./worker localhost 4242
-/// The worker then contacts the leader process on "localhost" port "4242" for work
-int main(int argc, char* argv[]) {
-   if (argc != 3) {
-      std::cerr << "Usage: " << argv[0] << " <host> <port>" << std::endl;
-      return 1;
+// Fetches the chunk and maps its rows while it streams in, reducing it into the
+// result once done. The reader is handed to progress after each piece, and the clock
+// told which phase the time goes to. A checkpoint of a resumable task resumes at its
+// offset with a ranged fetch. Compressed transfer encodings are decoded by curl,
+// gzipped chunks (".gz", e.g. from "data/splitCSV.sh --gzip") are decoded here.
+// Offsets into those mean nothing once decompressed, so they are always read from the
+// start. Big local chunks are mapped on all threads of the pool instead, without
+// progress. Binary chunks (".ewqc", from the chunker) are read record by record instead
+// of row by row. Chunks are fetched on a handle of the worker's pool, reusing its
+// connections to their host. The rows of a chunk shared with other workers, given a
+// range of it or giving part of it away, are left out of the result: it returns where
+// they ended and the hashes of their keys instead.
+template <tasks::Task T>
+std::optional<utils::Checkpoint> map_chunk(const std::string& fileLink, const utils::Checkpoint* resume, auto&& progress, PhaseClock& clock, ThreadPool& pool, CurlHandlePool& handles, typename T::Result& result) {
+   // Only resumable tasks are handed over half done
+   if constexpr (!tasks::Resumable<T>) {
+      resume = nullptr;
    }
 
-   sleep(1);
+   auto binary = fileLink.ends_with(chunk_format::EXTENSION);
+   if (fileLink.starts_with(FILE_SCHEME) && !fileLink.ends_with(".gz") && !binary && (resume == nullptr || resume->end == 0)) {
+      if (auto mapped{map_file_in_parallel<T>(fileLink.substr(FILE_SCHEME.size()), resume, pool, clock)}; mapped.has_value()) {
+         T::merge(result, std::move(*mapped));
+         return {};
+      }
+   }
 
-   auto curlSetup = CurlGlobalSetup();
+   auto curl{handles.acquire()};
+   curl.set_url(fileLink);
+   curl.set_timeout(30);
 
-   std::mutex sockMutex;
-   std::atomic<bool> running{true};
-   std::string host{argv[1]};
-   std::string port{argv[2]};
+   if (fileLink.ends_with(".gz")) {
+      ChunkReader<T> reader{clock};
+      curl.set_accept_encoding();
+      GzipStream gzip{[&](std::string_view data) { reader.feed(data); }};
+      curl.execute([&](std::string_view data) {
+         gzip.feed(data);
+         progress(static_cast<ChunkReader<T>*>(nullptr));
+      });
+      gzip.finish();
+      T::reduce(reader.finish(), result);
+      return {};
+   }
 
-   int sockfd;
-   struct addrinfo hints, *servinfo, *p;
+   // Once the size of the chunk is known rows can be given away, the transfer stops
+   // once the reader has the rows of its range. Progress takes the keys first seen as
+   // they come, other readers don't keep them, nor do readers under a memory budget.
+   auto stream = [&](ChunkReader<T>& reader) {
+      if constexpr (tasks::Resumable<T>) {
+         if (!key_spill::limited()) {
+            reader.track_new_keys();
+         }
+      }
+      auto from = reader.stream_offset();
+      curl.execute_while([&](std::string_view data) {
+         if (!reader.bounded()) {
+            if (auto length{curl.identity_length()}; length.has_value()) {
+               reader.bound(from + *length);
+            }
+         }
+
+         reader.feed(data);
+         progress(&reader);
+         return !reader.done();
+      });
+   };
+
+   auto finish = [&](ChunkReader<T>& reader) -> std::optional<utils::Checkpoint> {
+      if constexpr (tasks::Resumable<T>) {
+         if (reader.is_shared()) {
+            utils::Checkpoint rows{};
+            rows.end = reader.range_end();
+            rows.domains = T::keys(reader.finish());
+            return rows;
+         }
+      }
 
-   memset(&hints, 0, sizeof hints);
-   hints.ai_family = AF_UNSPEC;
-   hints.ai_socktype = SOCK_STREAM;
+      T::reduce(reader.finish(), result);
+      return {};
+   };
+
+   ChunkReader<T> reader{clock};
+   if constexpr (tasks::Resumable<T>) {
+      if (resume != nullptr) {
+         // Offsets are into the identity encoding, so don't ask for another one
+         ChunkReader<T> resumed{clock, *resume};
+         if (binary) {
+            resumed.read_binary();
+         }
+         curl.set_resume_from(resumed.stream_offset());
+         try {
+            stream(resumed);
+            return finish(resumed);
+         } catch (const std::runtime_error& e) {
+            // e.g. the server ignores ranges. The rows before the checkpoint are skipped.
+            std::cerr << "resuming " << fileLink << " failed, starting over: " << e.what() << std::endl;
+            curl.set_resume_from(0);
+         }
 
-   // This is a real workhorse of a function with a lot of options, but usage is
-   // actually pretty simple. It helps set up the structs you need later on.
-   if (auto rv = getaddrinfo(host.c_str(), port.c_str(), &hints, &servinfo); rv != 0) {
-      fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
-      return 1;
+         // Keys of a checkpoint still count when starting over
+         reader = ChunkReader<T>{clock, *resume};
+         reader.rewind();
+      }
+   }
+
+   if (resume == nullptr) {
+      curl.set_accept_encoding();
+   }
+
+   if (binary) {
+      reader.read_binary();
+   }
+
+   stream(reader);
+   return finish(reader);
+}
+
+// The worker's connection to its leader, made again when it is lost, waiting a random
+// delay of up to 100ms, 200ms, 400ms, ... 5s between attempts. Messages sent while it is
+// down are dropped, except the result of the work, the rows of it given away and the hashes
+// sent ahead of it, which go out in order once it is back. On each connection the worker
+// introduces itself with its token and the IDs of the work it still has, so the leader
+// can let it finish that instead of retrying it elsewhere.
+// Connections inherited as "fd:" can't be made again, the worker exits once they end.
+class Leader {
+   public:
+   Leader(std::string host, std::string port, bool keepalive)
+      : host(std::move(host)),
+        port(std::move(port)),
+        keepalive(keepalive),
+        reconnects(utils::address_kind(this->host) != utils::AddressKind::FD),
+        token(std::random_device{}() | static_cast<uint64_t>(std::random_device{}()) << 32),
+        random(token),
+        mutex{},
+        connection{},
+        held{},
+        undelivered{},
+        finished(false) {}
+
+   // Connects for the first time, throws if that fails
+   void connect() {
+      std::unique_lock<std::mutex> lock(mutex);
+      connection = open();
    }
 
-   // loop through all the results and connect to the first we can
-   for (p = servinfo; p != NULL; p = p->ai_next) {
-      if ((sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
-         perror("client: socket");
-         continue;
+   // Sends a message unless the connection is down, may be called from any thread
+   void send(const std::vector<char>& message) {
+      if (auto c{current()}; c) {
+         c->send(message);
       }
+   }
+
+   // Notes the IDs of the work being taken on
+   void hold(std::vector<uint32_t> task_ids) {
+      std::unique_lock<std::mutex> lock(mutex);
+      held = std::move(task_ids);
+   }
+
+   // Sends the result of the work being held, or keeps it until the connection is back
+   void deliver(std::vector<char> message) {
+      std::unique_lock<std::mutex> lock(mutex);
+      undelivered.push_back(std::move(message));
+      finished = true;
+      flush();
+   }
 
-      if (connect(sockfd, p->ai_addr, p->ai_addrlen) == -1) {
-         close(sockfd);
-         perror("client: connect");
-         continue;
+   // Tells the leader of rows of the work being held given to another worker, or of hashes
+   // too many to go with the result, which it must hear of before the result. Kept until
+   // the connection is back if need be.
+   void give_away(std::vector<char> message) {
+      std::unique_lock<std::mutex> lock(mutex);
+      undelivered.push_back(std::move(message));
+      flush();
+   }
+
+   // Waits for the next message, reconnecting as needed. Nothing once the leader said
+   // goodbye or stayed unreachable for RECONNECT_WINDOW.
+   std::optional<std::vector<char>> receive() {
+      while (true) {
+         auto c{current()};
+         // Timeout - nothing to read
+         if (!c->wait(10s)) {
+            continue;
+         }
+
+         if (auto message{c->receive()}; message.has_value()) {
+            if (auto proto{utils::unmarshal_proto(*message)}; proto.has_value() && proto->kind == utils::ProtocolEventKind::BYE) {
+               return {};
+            }
+
+            return message;
+         }
+
+         if (!reconnects || !reconnect()) {
+            return {};
+         }
       }
+   }
 
-      break;
+   private:
+   std::string host;
+   std::string port;
+   bool keepalive;
+   bool reconnects;
+   uint64_t token;
+   std::mt19937_64 random;
+   // Guards everything below, the connection is only replaced while holding it
+   std::mutex mutex;
+   std::shared_ptr<LeaderConnection> connection;
+   // IDs of the work taken on whose result hasn't been sent yet
+   std::vector<uint32_t> held;
+   // Messages about the work waiting for the connection to be back, the result last
+   std::deque<std::vector<char>> undelivered;
+   // Is the result among them?
+   bool finished;
+
+   std::shared_ptr<LeaderConnection> current() {
+      std::unique_lock<std::mutex> lock(mutex);
+      return connection;
    }
 
-   if (p == NULL) {
-      fprintf(stderr, "client: failed to connect\n");
-      return 2;
+   // Sends what is undelivered, the caller holds the mutex. The work is done with once its result is out.
+   void flush() {
+      while (!undelivered.empty() && connection->send(undelivered.front())) {
+         undelivered.pop_front();
+      }
+
+      if (undelivered.empty() && finished) {
+         held.clear();
+         finished = false;
+      }
+   }
+
+   // Connects and introduces ourselves, the caller holds the mutex
+   std::shared_ptr<LeaderConnection> open() {
+      auto c{std::make_shared<LeaderConnection>(host, port)};
+      if (keepalive && !c->keep_alive(LEADER_TIMEOUT)) {
+         throw std::runtime_error("can't enable keepalive");
+      }
+
+      if (reconnects) {
+         utils::ProtocolEvent hello{};
+         hello.kind = utils::ProtocolEventKind::HELLO;
+         hello.token = token;
+         hello.task_ids = held;
+         c->send(hello.marshal());
+      }
+
+      return c;
+   }
+
+   bool reconnect() {
+      auto lost{std::chrono::steady_clock::now()};
+      std::chrono::nanoseconds backoff{RECONNECT_BACKOFF};
+      while (std::chrono::steady_clock::now() - lost < RECONNECT_WINDOW) {
+         std::this_thread::sleep_for(std::chrono::nanoseconds(std::uniform_int_distribution<int64_t>(0, backoff.count())(random)));
+         backoff = std::min<std::chrono::nanoseconds>(backoff * 2, MAX_RECONNECT_BACKOFF);
+
+         std::unique_lock<std::mutex> lock(mutex);
+         try {
+            connection = open();
+         } catch (const std::runtime_error&) {
+            continue;
+         }
+
+         flush();
+         return true;
+      }
+
+      std::cerr << "client: gave up reconnecting to the leader" << std::endl;
+      return false;
+   }
+};
+
+/// Client process that receives a list of URLs and reports the result
+/// Example:
+///    ./worker localhost 4242
+/// The worker then contacts the leader process on "localhost" port "4242" for work.
+/// Should the connection be lost, the worker reconnects and picks up where it was.
+/// A leader on the same host can also be reached through a Unix domain socket,
+/// optionally passing messages through shared memory:
+///    ./worker unix:/tmp/ewq.sock
+///    ./worker shm:/tmp/ewq.sock
+/// A leader started with --keepalive only wants heartbeats from idle workers, the worker
+/// is then started with --keepalive as well. With --counters the worker reports what its
+/// threads did while fetching, parsing and deduplicating, see PerfCounters.h. With
+/// --memory-budget (64k at least) the distinct keys of a chunk take about that much memory at most,
+/// those past it are spilled to temporary files and deduplicated from there, see KeySpill.h:
+///    ./worker localhost 4242 --memory-budget 256m
+int main(int argc, char* argv[]) {
+   // Flags go last, in any order
+   auto keepalive = false;
+   auto usage = false;
+   for (; argc > 2; argc--) {
+      std::string flag{argv[argc - 1]};
+      if (argc > 3 && std::string{argv[argc - 2]} == "--memory-budget") {
+         auto budget{utils::parse_size(flag)};
+         usage = usage || budget.value_or(0) < key_spill::MIN_BUDGET;
+         key_spill::set_budget(budget.value_or(0));
+         argc--;
+      } else if (flag == "--keepalive") {
+         keepalive = true;
+      } else if (flag == "--counters") {
+         perf_counters::enable();
+      } else {
+         break;
+      }
    }
 
-   freeaddrinfo(servinfo);
+   auto local = argc == 2 && utils::address_kind(argv[1]) != utils::AddressKind::TCP;
+   if ((argc != 3 && !local) || usage) {
+      std::cerr << "Usage: " << argv[0] << " <host> <port> [--keepalive] [--counters] [--memory-budget <bytes>[k|m|g]]" << std::endl;
+      std::cerr << "       " << argv[0] << " unix:<path> | shm:<path> | fd:<n> [--keepalive] [--counters] [--memory-budget <bytes>[k|m|g]]" << std::endl;
+      return 1;
+   }
 
-   // Create a thread that sends a heartbeat every N seconds
+   sleep(1);
+
+   auto curlSetup = CurlGlobalSetup();
+   CurlHandlePool handles{};
+   // A core the host has but we may not use would only slow the threads on the others down
+   ThreadPool pool{utils::available_cores()};
+
+   std::atomic<bool> running{true};
+   // Is a message of the leader being worked on?
+   std::atomic<bool> busy{false};
+   // Did the leader ask us to share the rows we have left with an idle worker?
+   std::atomic<bool> steal_requested{false};
+
+   Leader leader{argv[1], local ? "" : argv[2], keepalive};
+   try {
+      leader.connect();
+   } catch (const std::runtime_error& e) {
+      std::cerr << "client: " << e.what() << std::endl;
+      return 2;
+   }
+
+   // Create a thread that sends a heartbeat every N seconds. With --keepalive the
+   // leader tells we're alive from the kernel's probes and our progress, it only
+   // needs a heartbeat from us to know we're idle and take credit.
    std::thread heartbeatThread([&] {
       while (running) {
          std::this_thread::sleep_for(1s);
 
+         if (keepalive && busy) {
+            continue;
+         }
+
          auto response{utils::ProtocolEvent().marshal()};
-         std::unique_lock<std::mutex> lock(sockMutex);
-         utils::send_to_socket(sockfd, response);
-         lock.unlock();
+         leader.send(response);
       }
    });
 
-   // This is the main loop of the worker. It receives a message from the leader,
-   // does the work, and sends the result back to the leader.
-   // The worker will continue to do this until the leader disconnects.
-   // The worker will then exit.
-   std::thread mainThread([&] {
-      fd_set fdread;
-      struct timeval tv;
-
-      do {
-         tv.tv_sec = 10;
-         tv.tv_usec = 0;
-
-         FD_ZERO(&fdread);
-         FD_SET(sockfd, &fdread);
-
-         auto select_ret = select(sockfd + 1, &fdread, NULL, NULL, &tv);
-         switch (select_ret) {
-            case -1:
-               // Error happened
-               running = false;
-               break;
-            case 0:
-               // Timeout - nothing to read
-               break;
-            default: {
-               if (auto received{utils::read_from_socket(sockfd)}; received.has_value()) {
-                  if (auto proto{utils::unmarshal_proto(*received)}; proto.has_value()) {
-                     if (proto->kind == utils::ProtocolEventKind::WORK) {
-                        auto count{count_unique_domains(fetch_url_list(proto->work))};
-                        auto response{utils::ProtocolEvent(count).marshal()};
-
-                        std::unique_lock<std::mutex> lock(sockMutex);
-                        utils::send_to_socket(sockfd, response);
-                        lock.unlock();
-
-                        break;
-                     }
+   // Does the work of a message from the leader and reports the result
+   auto handle_work = [&](const utils::ProtocolEvent& proto) {
+      tasks::Tasks::dispatch(proto.task, [&]<tasks::Task T>(T) {
+         auto items{proto.work_items()};
+         auto resume = proto.checkpoint.offset > 0 || proto.checkpoint.end > 0 ? &proto.checkpoint : nullptr;
+         leader.hold(proto.task_ids);
+
+         // Gives half of the rows left of the last item away when the leader asks, if
+         // the task counts shared rows (see Tasks.h) and the chunk can be split.
+         // Tells the leader how far we got, at most every PROGRESS_INTERVAL, so
+         // another worker can take over from there should we die. Work of tasks
+         // that can't be handed over half done starts over instead, and so does
+         // work under a memory budget: its keys would have to go to the leader,
+         // which would hold them all. Nor is such work shared, for the same reason.
+         utils::Checkpoint progress{};
+         auto last_progress{std::chrono::steady_clock::now()};
+         auto report = [&](ChunkReader<T>* reader, bool last) {
+            if (steal_requested && steal_requested.exchange(false)) {
+               utils::ProtocolEvent answer{};
+               answer.kind = utils::ProtocolEventKind::STEAL;
+               if constexpr (tasks::Resumable<T>) {
+                  if (auto given{reader != nullptr && last && !key_spill::limited() ? reader->split(STEAL_MIN_BYTES) : std::nullopt}; given.has_value()) {
+                     answer.checkpoint = std::move(*given);
+                     leader.give_away(answer.marshal());
+                     return;
                   }
                }
+               leader.send(answer.marshal());
+            }
 
-               running = false;
+            if constexpr (tasks::Resumable<T>) {
+               if (auto now{std::chrono::steady_clock::now()}; now - last_progress >= PROGRESS_INTERVAL) {
+                  last_progress = now;
+                  auto resumable = reader != nullptr && !key_spill::limited();
+                  progress.offset = resumable ? reader->offset() : reader != nullptr ? reader->range_begin() : 0;
+                  progress.domains = resumable ? reader->take_new_keys() : std::vector<uint64_t>{};
+                  leader.send(utils::ProtocolEvent(progress).marshal());
+               }
             }
+         };
+
+         // Anything but mapping rows is fetching, as far as the leader is concerned.
+         // Only the last item can be shared, its rows then go with the result instead.
+         typename T::Result result{};
+         utils::Timings timings{};
+         std::optional<utils::Checkpoint> shared{};
+         {
+            PhaseClock clock{timings};
+            for (std::size_t i = 0; i < items.size(); i++) {
+               auto last = i + 1 == items.size();
+               shared = map_chunk<T>(items[i], i == 0 ? resume : nullptr, [&](ChunkReader<T>* reader) { report(reader, last); }, clock, pool, handles, result);
+               if (shared.has_value()) {
+                  break;
+               }
+               progress.items_done = i + 1;
+               progress.result = T::count(result);
+               report(nullptr, last);
+            }
+         }
+
+         utils::ProtocolEvent response{T::count(result), timings};
+         response.summary = T::serialize(result);
+         if (shared.has_value()) {
+            // Hashes too many for one message go ahead of it, in order like a given away range
+            auto& domains = shared->domains;
+            while (domains.size() > utils::MAX_MESSAGE_HASHES) {
+               utils::ProtocolEvent keys{};
+               keys.kind = utils::ProtocolEventKind::KEYS;
+               keys.checkpoint.domains.assign(domains.end() - utils::MAX_MESSAGE_HASHES, domains.end());
+               domains.resize(domains.size() - utils::MAX_MESSAGE_HASHES);
+               leader.give_away(keys.marshal());
+            }
+            response.checkpoint = std::move(*shared);
+         }
+         leader.deliver(response.marshal());
+      });
+   };
+
+   // This is the main loop of the worker. It receives messages from the leader and
+   // queues their work, which runs on its own thread so the connection can be made
+   // again meanwhile. The worker continues until the leader is gone for good or
+   // sends something we don't understand, then exits once the queued work is done.
+   {
+      ThreadPool workThread{1};
+      while (auto received{leader.receive()}) {
+         auto proto{utils::unmarshal_proto(*received)};
+         // Steals are answered by the work, once it can tell what is left of it
+         if (proto.has_value() && proto->kind == utils::ProtocolEventKind::STEAL) {
+            steal_requested = true;
+            continue;
+         }
 
+         if (!proto.has_value() || proto->kind != utils::ProtocolEventKind::WORK) {
             break;
          }
-      } while (running);
-   });
 
-   mainThread.join();
-   heartbeatThread.join();
+         workThread.submit([&, work = std::move(*proto)] {
+            busy = true;
+            handle_work(work);
+            busy = false;
+         });
+      }
+   }
 
-   close(sockfd);
+   running = false;
+   heartbeatThread.join();
 
    return 0;
 }